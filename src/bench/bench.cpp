@@ -0,0 +1,372 @@
+#include "common.h"
+
+#include "io/cache.h"
+#include "io/loader.h"
+#include "io/stegano.h"
+#include "vm/machine.h"
+#include "vm/input.h"
+#include "vm/raster.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+/*
+* headless cart runner used to measure performance without a display or a frontend:
+*
+*   retro8-bench [-f frames] [-i input] [-g gc] [-b cache] [-a] [-r rate] [-o rate] [-c] cart...
+*
+*   -f frames   number of _update/_draw pairs to execute for each cart (default 600)
+*   -i input    scripted input, each line is "frame player mask" where mask uses btn() bits,
+*               the mask is held until another line for the same player changes it
+*   -g gc       Lua collector scheduling, frame (default) or incremental
+*   -b cache    directory where compiled carts are cached, the second run of a cart loads from it
+*   -a          render audio through the APU every frame
+*   -r rate     rate the APU renders channels at
+*   -o rate     rate of the rendered audio, resampled from the APU rate when they differ
+*   -c          print results as csv
+*/
+
+namespace r8 = retro8;
+
+r8::Machine* machine;
+
+uint32_t Platform::getTicks()
+{
+  using namespace std::chrono;
+  return uint32_t(duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count());
+}
+
+namespace
+{
+  using clock_type = std::chrono::steady_clock;
+
+  enum Phase { UPDATE, DRAW, GC, RASTERIZE, AUDIO, FRAME, PHASE_COUNT };
+  const char* PHASE_NAMES[PHASE_COUNT] = { "update", "draw", "gc", "rasterize", "audio", "frame" };
+
+#if !defined(SF2000)
+  constexpr int32_t SAMPLE_RATE = 44100;
+#else
+  constexpr int32_t SAMPLE_RATE = 11025;
+#endif
+
+  struct InputEvent
+  {
+    uint32_t frame;
+    uint32_t player;
+    uint32_t mask;
+  };
+
+  struct Options
+  {
+    uint32_t frames = 600;
+    bool audio = false;
+    int32_t rate = SAMPLE_RATE, outputRate = SAMPLE_RATE;
+    bool csv = false;
+    lua::GcSettings gc = lua::Code::defaultGcSettings();
+    std::string cache;
+    std::vector<InputEvent> input;
+    std::vector<std::string> carts;
+  };
+
+  struct Timings
+  {
+    std::vector<double> samples[PHASE_COUNT];
+    double load;
+    uint32_t fps;
+  };
+
+  double elapsed(clock_type::time_point start, clock_type::time_point end)
+  {
+    return std::chrono::duration<double, std::micro>(end - start).count();
+  }
+
+  bool loadInput(const std::string& path, std::vector<InputEvent>& events)
+  {
+    std::ifstream file(path);
+    if (!file)
+      return false;
+
+    std::string line;
+    while (std::getline(file, line))
+    {
+      InputEvent event;
+      if (line.empty() || line[0] == '#')
+        continue;
+      else if (std::sscanf(line.c_str(), "%u %u %u", &event.frame, &event.player, &event.mask) == 3 && event.player < r8::PLAYER_COUNT)
+        events.push_back(event);
+    }
+
+    std::stable_sort(events.begin(), events.end(), [](const InputEvent& a, const InputEvent& b) { return a.frame < b.frame; });
+    return true;
+  }
+
+  bool loadCartridge(const std::string& path, const std::string& cacheDirectory, r8::Machine& dest)
+  {
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+      return false;
+
+    std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    const r8::io::Cache cache(cacheDirectory);
+    const uint64_t key = r8::io::Cache::keyFor(data.data(), data.size());
+
+    if (!cacheDirectory.empty() && cache.load(key, dest))
+      return true;
+
+    dest.code().keepBytecode(!cacheDirectory.empty());
+
+    if (r8::io::Loader::isPngCartridge(path))
+    {
+      r8::io::Stegano stegano;
+      if (!stegano.load(data.data(), data.size(), dest))
+        return false;
+    }
+    else
+    {
+      r8::io::Loader loader;
+      loader.loadRaw(reinterpret_cast<const char*>(data.data()), data.size(), dest);
+    }
+
+    if (!cacheDirectory.empty())
+      cache.store(key, dest);
+    dest.code().keepBytecode(false);
+
+    return true;
+  }
+
+  bool run(const std::string& path, const Options& options, Timings& timings)
+  {
+    machine = new r8::Machine();
+    machine->font().load();
+    machine->code().setGcSettings(options.gc);
+    machine->code().loadAPI();
+#if SOUND_ENABLED
+    machine->sound().setSampleRate(options.rate, options.outputRate);
+#endif
+
+    r8::input::InputManager input;
+    input.setMachine(machine);
+
+    const auto loadStart = clock_type::now();
+    if (!loadCartridge(path, options.cache, *machine))
+    {
+      delete machine;
+      machine = nullptr;
+      return false;
+    }
+
+    timings.load = elapsed(loadStart, clock_type::now());
+
+    machine->memory().backupCartridge();
+
+    if (machine->code().hasInit())
+      machine->code().init();
+
+#if SOUND_ENABLED
+    machine->sound().init();
+#endif
+
+    timings.fps = machine->code().require60fps() ? 60 : 30;
+
+    r8::gfx::ColorTable colorTable;
+    colorTable.init([](uint8_t r, uint8_t g, uint8_t b) { return r8::gfx::ColorTable::pixel_t(0xff000000 | (r << 16) | (g << 8) | b); });
+    r8::gfx::Rasterizer rasterizer;
+
+    std::vector<uint32_t> screen(r8::gfx::SCREEN_WIDTH * r8::gfx::SCREEN_HEIGHT);
+    std::vector<int16_t> audio(2 * size_t(options.outputRate) / timings.fps);
+
+    uint32_t mask[r8::PLAYER_COUNT] = { 0 };
+    auto event = options.input.begin();
+
+    for (auto& samples : timings.samples)
+      samples.reserve(options.frames);
+
+    for (uint32_t frame = 0; frame < options.frames; ++frame)
+    {
+      for (; event != options.input.end() && event->frame <= frame; ++event)
+      {
+        for (size_t bt = 0; bt < r8::BUTTON_COUNT; ++bt)
+        {
+          const bool wasSet = (mask[event->player] >> bt) & 1, isSet = (event->mask >> bt) & 1;
+          if (wasSet != isSet)
+            input.manageKey(event->player, bt, isSet);
+        }
+
+        mask[event->player] = event->mask;
+      }
+
+      const auto start = clock_type::now();
+
+      machine->tick();
+      machine->code().update();
+      const auto updated = clock_type::now();
+
+      machine->code().draw();
+      const auto drawn = clock_type::now();
+
+      auto& memory = machine->memory();
+      if (memory.isScreenDirty())
+      {
+        r8::gfx::color_lut_t<uint32_t> lut;
+        r8::gfx::buildColorLut(colorTable, *memory.paletteAt(r8::gfx::SCREEN_PALETTE_INDEX), lut);
+
+        for (r8::coord_t y = 0; y < r8::gfx::SCREEN_HEIGHT; ++y)
+          if (memory.isScreenRowDirty(y))
+            rasterizer.rasterize(memory.screenData(0, y), screen.data() + y * r8::gfx::SCREEN_WIDTH, r8::gfx::SCREEN_PITCH, lut);
+
+        memory.clearScreenDirty();
+      }
+      const auto rasterized = clock_type::now();
+
+#if SOUND_ENABLED
+      if (options.audio)
+        machine->sound().renderSounds(audio.data(), audio.size() / 2);
+#endif
+      const auto end = clock_type::now();
+
+      input.manageKeyRepeat();
+      input.tick();
+
+      timings.samples[UPDATE].push_back(elapsed(start, updated));
+      /* collector runs at the end of draw() */
+      const double gc = std::chrono::duration<double, std::micro>(machine->code().gcTime()).count();
+      timings.samples[DRAW].push_back(elapsed(updated, drawn) - gc);
+      timings.samples[GC].push_back(gc);
+      timings.samples[RASTERIZE].push_back(elapsed(drawn, rasterized));
+      timings.samples[AUDIO].push_back(elapsed(rasterized, end));
+      timings.samples[FRAME].push_back(elapsed(start, end));
+    }
+
+    delete machine;
+    machine = nullptr;
+    return true;
+  }
+
+  /* nearest rank percentile, samples must be sorted */
+  double percentile(const std::vector<double>& samples, double p)
+  {
+    if (samples.empty())
+      return 0.0;
+
+    const size_t rank = size_t(p / 100.0 * (samples.size() - 1) + 0.5);
+    return samples[std::min(rank, samples.size() - 1)];
+  }
+
+  void report(const std::string& path, Timings& timings, bool csv)
+  {
+    if (!csv)
+    {
+      std::printf("%s: %zu frames at %ufps, loaded in %.1fms\n", path.c_str(), timings.samples[FRAME].size(), timings.fps, timings.load / 1000.0);
+      std::printf("  %-10s %10s %10s %10s %10s %10s\n", "phase", "p50(us)", "p90(us)", "p99(us)", "max(us)", "total(ms)");
+    }
+
+    for (size_t i = 0; i < PHASE_COUNT; ++i)
+    {
+      auto& samples = timings.samples[i];
+      std::sort(samples.begin(), samples.end());
+
+      double total = 0.0;
+      for (double sample : samples) total += sample;
+
+      const char* format = csv ? "%s,%s,%.1f,%.1f,%.1f,%.1f,%.3f\n" : "  %s%-10s %10.1f %10.1f %10.1f %10.1f %10.3f\n";
+      std::printf(format, csv ? path.c_str() : "", PHASE_NAMES[i],
+        percentile(samples, 50), percentile(samples, 90), percentile(samples, 99), samples.empty() ? 0.0 : samples.back(), total / 1000.0);
+    }
+  }
+
+  void usage(const char* name)
+  {
+    std::fprintf(stderr, "usage: %s [-f frames] [-i input] [-g gc] [-b cache] [-a] [-r rate] [-o rate] [-c] cart...\n", name);
+  }
+}
+
+int main(int argc, char* argv[])
+{
+  Options options;
+
+  for (int i = 1; i < argc; ++i)
+  {
+    const std::string arg = argv[i];
+
+    if (arg == "-f" && i + 1 < argc)
+      options.frames = uint32_t(std::strtoul(argv[++i], nullptr, 10));
+    else if (arg == "-i" && i + 1 < argc)
+    {
+      if (!loadInput(argv[++i], options.input))
+      {
+        std::fprintf(stderr, "unable to read input script %s\n", argv[i]);
+        return 1;
+      }
+    }
+    else if (arg == "-g" && i + 1 < argc)
+    {
+      const std::string mode = argv[++i];
+      if (mode == "incremental")
+      {
+        options.gc.mode = lua::GcSettings::Mode::INCREMENTAL;
+        options.gc.pause = 200;
+      }
+      else if (mode != "frame")
+      {
+        usage(argv[0]);
+        return 1;
+      }
+    }
+    else if (arg == "-b" && i + 1 < argc)
+      options.cache = argv[++i];
+    else if (arg == "-a")
+      options.audio = true;
+    else if ((arg == "-r" || arg == "-o") && i + 1 < argc)
+    {
+      const int32_t rate = int32_t(std::strtol(argv[++i], nullptr, 10));
+      if (rate < 128)
+      {
+        usage(argv[0]);
+        return 1;
+      }
+      (arg == "-r" ? options.rate : options.outputRate) = rate;
+    }
+    else if (arg == "-c")
+      options.csv = true;
+    else if (arg[0] == '-')
+    {
+      usage(argv[0]);
+      return 1;
+    }
+    else
+      options.carts.push_back(arg);
+  }
+
+  if (options.carts.empty())
+  {
+    usage(argv[0]);
+    return 1;
+  }
+
+  if (options.csv)
+    std::printf("cart,phase,p50_us,p90_us,p99_us,max_us,total_ms\n");
+
+  int result = 0;
+  for (const auto& cart : options.carts)
+  {
+    Timings timings;
+
+    if (run(cart, options, timings))
+      report(cart, timings, options.csv);
+    else
+    {
+      std::fprintf(stderr, "unable to load cartridge %s\n", cart.c_str());
+      result = 1;
+    }
+  }
+
+  return result;
+}
@@ -0,0 +1,145 @@
+#include "common.h"
+
+#include "vm/machine.h"
+#include "vm/lua_binding.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+/*
+* measures the call overhead of the generated binding thunks against handwritten lua_CFunction
+* equivalents which decode arguments with lua_tonumber and lua_gettop:
+*
+*   retro8-bench-bindings [calls]
+*
+* each API is called from a Lua loop, the time of an empty loop is subtracted
+*/
+
+namespace r8 = retro8;
+
+r8::Machine* machine;
+
+uint32_t Platform::getTicks()
+{
+  using namespace std::chrono;
+  return uint32_t(duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count());
+}
+
+namespace handwritten
+{
+  int pset(lua_State* L)
+  {
+    int x = lua_tonumber(L, 1);
+    int y = lua_tonumber(L, 2);
+    int c = lua_gettop(L) == 3 ? int(lua_tonumber(L, 3)) : int(machine->memory().penColor()->low());
+
+    machine->pset(x, y, static_cast<r8::color_t>(c));
+
+    return 0;
+  }
+
+  int rectfill(lua_State* L)
+  {
+    int x0 = lua_tonumber(L, 1);
+    int y0 = lua_tonumber(L, 2);
+    int x1 = lua_tonumber(L, 3);
+    int y1 = lua_tonumber(L, 4);
+    int c = lua_gettop(L) >= 5 ? int(lua_tonumber(L, 5)) : int(machine->memory().penColor()->low());
+
+    machine->rectfill(x0, y0, x1, y1, static_cast<r8::color_t>(c));
+
+    return 0;
+  }
+
+  int peek(lua_State* L)
+  {
+    r8::address_t addr = lua_tonumber(L, 1);
+    lua_pushnumber(L, machine->memory().base()[addr]);
+
+    return 1;
+  }
+
+  int mid(lua_State* L)
+  {
+    float a = lua_tonumber(L, 1);
+    float b = lua_tonumber(L, 2);
+    float c = lua_gettop(L) >= 3 ? lua_tonumber(L, 3) : 0.0f;
+
+    if ((a <= b && b <= c) || (c <= b && b <= a))
+      lua_pushnumber(L, b);
+    else if ((b <= a && a <= c) || (c <= a && a <= b))
+      lua_pushnumber(L, a);
+    else
+      lua_pushnumber(L, c);
+
+    return 1;
+  }
+}
+
+namespace
+{
+  struct Case
+  {
+    const char* name;
+    lua_CFunction handwritten;
+    const char* call;
+  };
+
+  const Case CASES[] = {
+    { "pset", handwritten::pset, "(i & 127, 64, 7)" },
+    { "rectfill", handwritten::rectfill, "(0, 0, 1, 1, 3)" },
+    { "peek", handwritten::peek, "(0x4300 + (i & 255))" },
+    { "mid", handwritten::mid, "(i, 2.5, 100)" },
+  };
+
+  /* seconds spent by calls iterations of call, run as a compiled chunk */
+  double measure(lua_State* L, const std::string& call, uint32_t calls)
+  {
+    const std::string code = "for i = 1, " + std::to_string(calls) + " do " + call + " end";
+    if (luaL_loadstring(L, code.c_str()))
+    {
+      std::fprintf(stderr, "%s\n", lua_tostring(L, -1));
+      std::exit(1);
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    lua_call(L, 0, 0);
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  }
+}
+
+int main(int argc, char* argv[])
+{
+#if R8_FIXED_POINT
+  /* handwritten versions assume float numbers */
+  std::fprintf(stderr, "retro8-bench-bindings requires a float build\n");
+  return 1;
+#endif
+
+  const uint32_t calls = argc > 1 ? uint32_t(std::strtoul(argv[1], nullptr, 10)) : 2000000;
+
+  machine = new r8::Machine();
+
+  lua_State* L = luaL_newstate();
+  lua::registerFunctions(L);
+
+  const double empty = measure(L, "local _ = i", calls);
+
+  std::printf("%-10s %12s %12s\n", "function", "thunk(ns)", "hand(ns)");
+  for (const Case& c : CASES)
+  {
+    lua_register(L, "handwritten", c.handwritten);
+
+    const double thunk = measure(L, std::string(c.name) + c.call, calls) - empty;
+    const double hand = measure(L, std::string("handwritten") + c.call, calls) - empty;
+
+    std::printf("%-10s %12.1f %12.1f\n", c.name, thunk * 1e9 / calls, hand * 1e9 / calls);
+  }
+
+  lua_close(L);
+  delete machine;
+
+  return 0;
+}
@@ -0,0 +1,303 @@
+#include "common.h"
+
+#include "io/legacy.h"
+#include "io/pxa.h"
+#include "vm/machine.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+
+/*
+* compares the PXA decoder against the previous bit by bit implementation and measures the
+* throughput of both compressors:
+*
+*   retro8-bench-pxa [-n iterations] [cart.png...]
+*
+* PNG carts are decoded as they are, without carts a synthetic corpus of Lua sources is encoded
+* first. The code of every stream is compressed again with PXA and with the :c: format and must
+* decode back to itself. Random streams are also decoded by both PXA decoders, which must agree
+*/
+
+namespace r8 = retro8;
+
+r8::Machine* machine;
+
+uint32_t Platform::getTicks() { return 0; }
+
+namespace reference
+{
+  /* decoder shipped before, bounds checks were added so that random streams are well defined */
+  class PXADecoder
+  {
+  public:
+    const uint8_t* data;
+    size_t size;
+    size_t b;
+    size_t o;
+    size_t expected;
+    uint8_t m[256];
+
+  private:
+    bool readBit()
+    {
+      int v = o < size ? data[o] & (1 << b) : 0;
+      ++b;
+
+      if (b == 8)
+      {
+        b = 0;
+        ++o;
+      }
+
+      return v;
+    }
+
+    int32_t readBits(size_t c)
+    {
+      int32_t r = 0;
+      for (size_t i = 0; i < c; ++i)
+        if (readBit())
+          r |= 1 << i;
+
+      return r;
+    }
+
+    void moveToFront(size_t i)
+    {
+      int v = m[i];
+      for (int j = int(i); j > 0; --j)
+        m[j] = m[j - 1];
+      m[0] = uint8_t(v);
+    }
+
+  public:
+    PXADecoder(const uint8_t* data, size_t size, size_t expected) : data(data), size(size), b(0), o(0), expected(expected)
+    {
+      for (size_t i = 0; i < 256; ++i)
+        m[i] = uint8_t(i);
+    }
+
+    bool process(std::string& code)
+    {
+      code.clear();
+      while (code.size() < expected)
+      {
+        if (readBit())
+        {
+          int unary = 0;
+          while (readBit())
+            ++unary;
+
+          if (unary > 4)
+            return false;
+
+          uint8_t unaryMask = uint8_t((1 << unary) - 1);
+          uint8_t index = uint8_t(readBits(4 + unary) + (unaryMask << 4));
+
+          code += char(m[index]);
+          moveToFront(index);
+        }
+        else
+        {
+          int32_t offsetBits;
+
+          if (readBit())
+            offsetBits = readBit() ? 5 : 10;
+          else
+            offsetBits = 15;
+
+          size_t offset = readBits(offsetBits) + 1;
+
+          if (offsetBits == 10 && offset == 1)
+          {
+            uint8_t v = uint8_t(readBits(8));
+            while (v && code.size() < expected)
+            {
+              code += char(v);
+              v = uint8_t(readBits(8));
+            }
+          }
+          else
+          {
+            int32_t length = 3, part = 0;
+            do
+            {
+              part = readBits(3);
+              length += part;
+            } while (part == 0b111);
+
+            if (offset > code.size())
+              return false;
+
+            size_t start = code.size() - offset;
+            for (int32_t l = 0; l < length && code.size() < expected; ++l)
+              code += code[start + l];
+          }
+        }
+      }
+
+      return true;
+    }
+  };
+}
+
+namespace
+{
+  using clock_type = std::chrono::steady_clock;
+
+  struct Stream
+  {
+    std::string name;
+    std::vector<uint8_t> data;
+    size_t length;
+  };
+
+  std::string syntheticSource(std::mt19937& rng, size_t length)
+  {
+    static const char* TOKENS[] = { "function ", "end\n", "local ", "if ", "then\n", "else\n", "for i=1,", " do\n", "return ",
+      "spr(", "map(", "pset(", "x", "y", "dx", "dy", "self.", "t", "+", "-", "*", "==", "=", ",", ")", "(", "0", "1", "8", "16",
+      "128", "  ", "\n", "btn(", "actor", "player", "cls()\n", "{", "}", "[", "]", "\"hello\"" };
+
+    std::string source;
+    std::uniform_int_distribution<size_t> token(0, sizeof(TOKENS) / sizeof(TOKENS[0]) - 1);
+    while (source.size() < length)
+      source += TOKENS[token(rng)];
+    source.resize(length);
+    return source;
+  }
+
+  uint8_t assembleByte(const uint8_t* rgba)
+  {
+    return uint8_t((rgba[3] & 0b11) << 6 | (rgba[0] & 0b11) << 4 | (rgba[1] & 0b11) << 2 | (rgba[2] & 0b11));
+  }
+
+  bool loadCart(const std::string& path, Stream& stream)
+  {
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+      return false;
+
+    std::vector<uint8_t> png((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    std::vector<uint8_t> rgba;
+    unsigned long width, height;
+    if (Platform::loadPNG(rgba, width, height, png.data(), png.size(), true) != 0 || rgba.size() < 0x8000 * 4)
+      return false;
+
+    std::vector<uint8_t> bytes(0x8000);
+    for (size_t i = 0; i < bytes.size(); ++i)
+      bytes[i] = assembleByte(&rgba[i * 4]);
+
+    if (std::memcmp(&bytes[0x4300], "\0pxa", 4))
+      return false;
+
+    stream.name = path;
+    stream.length = size_t(bytes[0x4304]) << 8 | bytes[0x4305];
+    const size_t compressed = std::min(size_t(bytes[0x4306]) << 8 | bytes[0x4307], size_t(0x8000 - 0x4300)) - 8;
+    stream.data.assign(bytes.begin() + 0x4308, bytes.begin() + 0x4308 + compressed);
+    return true;
+  }
+
+  template<typename F>
+  double measure(size_t iterations, F decode)
+  {
+    const auto start = clock_type::now();
+    for (size_t i = 0; i < iterations; ++i)
+      decode();
+    return std::chrono::duration<double, std::micro>(clock_type::now() - start).count() / iterations;
+  }
+}
+
+int main(int argc, char* argv[])
+{
+  size_t iterations = 200;
+  std::vector<Stream> streams;
+  std::mt19937 rng(8);
+
+  for (int i = 1; i < argc; ++i)
+  {
+    const std::string arg = argv[i];
+    Stream stream;
+
+    if (arg == "-n" && i + 1 < argc)
+      iterations = std::strtoul(argv[++i], nullptr, 10);
+    else if (loadCart(arg, stream))
+      streams.push_back(stream);
+    else
+    {
+      std::fprintf(stderr, "usage: %s [-n iterations] [cart.png...]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  if (streams.empty())
+  {
+    for (size_t length : { 4096, 16384, 65535 })
+    {
+      const std::string source = syntheticSource(rng, length);
+      Stream stream = { "synthetic " + std::to_string(length), std::vector<uint8_t>(), length };
+      r8::io::pxa::compress(source.data(), source.size(), stream.data);
+      streams.push_back(stream);
+    }
+  }
+
+  bool success = true;
+
+  std::printf("%-24s %8s %10s %10s %10s %10s %10s %10s %10s\n", "stream", "bytes",
+    "before(us)", "after(us)", "pxa", "pxa(us)", ":c:", ":c:(us)", ":c:dec(us)");
+  for (const Stream& stream : streams)
+  {
+    std::string expected, decoded;
+    reference::PXADecoder(stream.data.data(), stream.data.size(), stream.length).process(expected);
+    r8::io::pxa::decompress(stream.data.data(), stream.data.size(), decoded, stream.length);
+
+    std::vector<uint8_t> pxa, legacy;
+    std::string pxaDecoded, legacyDecoded;
+    r8::io::pxa::compress(decoded.data(), decoded.size(), pxa);
+    r8::io::pxa::decompress(pxa.data(), pxa.size(), pxaDecoded, decoded.size());
+    r8::io::legacy::compress(decoded.data(), decoded.size(), legacy);
+    r8::io::legacy::decompress(legacy.data(), legacy.size(), legacyDecoded, decoded.size());
+
+    if (decoded != expected || pxaDecoded != decoded || legacyDecoded != decoded)
+    {
+      std::printf("%-24s MISMATCH\n", stream.name.c_str());
+      success = false;
+      continue;
+    }
+
+    const double before = measure(iterations, [&]() { reference::PXADecoder(stream.data.data(), stream.data.size(), stream.length).process(expected); });
+    const double after = measure(iterations, [&]() { r8::io::pxa::decompress(stream.data.data(), stream.data.size(), decoded, stream.length); });
+    const double pxaTime = measure(std::max(iterations / 10, size_t(1)), [&]() { pxa.clear(); r8::io::pxa::compress(decoded.data(), decoded.size(), pxa); });
+    const double legacyTime = measure(std::max(iterations / 10, size_t(1)), [&]() { legacy.clear(); r8::io::legacy::compress(decoded.data(), decoded.size(), legacy); });
+    const double legacyDecode = measure(iterations, [&]() { r8::io::legacy::decompress(legacy.data(), legacy.size(), legacyDecoded, decoded.size()); });
+
+    std::printf("%-24s %8zu %10.1f %10.1f %10zu %10.1f %10zu %10.1f %10.1f\n", stream.name.c_str(), stream.length,
+      before, after, pxa.size(), pxaTime, legacy.size(), legacyTime, legacyDecode);
+  }
+
+  /* random streams are mostly malformed, both decoders must stop at the same place */
+  std::uniform_int_distribution<int> byte(0, 255);
+  size_t mismatches = 0;
+  for (size_t i = 0; i < 10000; ++i)
+  {
+    std::vector<uint8_t> data(64);
+    for (uint8_t& value : data)
+      value = uint8_t(byte(rng));
+    data[0] |= 1;
+
+    std::string expected, decoded;
+    const bool valid = reference::PXADecoder(data.data(), data.size(), 256).process(expected);
+    if (r8::io::pxa::decompress(data.data(), data.size(), decoded, 256) != valid || decoded != expected)
+      ++mismatches;
+  }
+
+  std::printf("random streams: %zu mismatches\n", mismatches);
+  return success && !mismatches ? 0 : 1;
+}
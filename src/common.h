@@ -55,6 +55,11 @@ struct Platform
 {
   static uint32_t getTicks();
   static int loadPNG(std::vector<unsigned char>& out_image, unsigned long& image_width, unsigned long& image_height, const unsigned char* in_png, size_t in_size, bool convert_to_rgba32 = true);
+  /* decodes a PNG passing each RGBA32 row to the callback as soon as it is unfiltered, without building the RGBA image (the whole inflated data is still held) */
+  using png_row_callback = void(*)(void* user_data, unsigned long y, const unsigned char* rgba, unsigned long width);
+  static int loadPNGRows(const unsigned char* in_png, size_t in_size, png_row_callback rows, void* user_data);
+  /* encodes a RGBA32 image, pixel data is stored without compression */
+  static void savePNG(std::vector<unsigned char>& out_png, const unsigned char* in_image, unsigned long image_width, unsigned long image_height);
 };
 
 #include "config.h"
@@ -4,11 +4,14 @@
 #define PLATFORM_LIBRETRO 1
 #define PLATFORM_OPENDINGUX 2
 #define PLATFORM_FUNKEY 3
+#define PLATFORM_HEADLESS 4
 
 #define SOUND_ENABLED true
 
 #if defined(FUNKEY_S)
 #define PLATFORM PLATFORM_FUNKEY
+#elif defined(R8_HEADLESS)
+#define PLATFORM PLATFORM_HEADLESS
 #elif defined(__LIBRETRO__)
 #define PLATFORM PLATFORM_LIBRETRO
 #elif defined(_WIN32)
@@ -19,9 +22,24 @@
 #define TEST_MODE false
 
 #define R8_OPTS_ENABLED true
+
+/* per API call timings and Lua stack sampling, see vm/profiler.h */
+#ifndef R8_PROFILER_ENABLED
+#define R8_PROFILER_ENABLED false
+#endif
+
+/* Lua numbers are PICO-8 16.16 fixed point values instead of floats, see lua/lfix.h */
+#ifndef R8_FIXED_POINT
+#define R8_FIXED_POINT false
+#endif
+
+/* trigonometry and sqrt through libm floats instead of the vm/fastmath tables */
+#ifndef R8_LIBM_MATH
+#define R8_LIBM_MATH false
+#endif
 #define R8_USE_LODE_PNG true
 
-#if PLATFORM != PLATFORM_LIBRETRO
+#if PLATFORM != PLATFORM_LIBRETRO && PLATFORM != PLATFORM_HEADLESS
 
   #include "SDL.h"
   #define LOGD(x , ...) printf(x"\n", ## __VA_ARGS__)
@@ -0,0 +1,117 @@
+#include "cache.h"
+
+#include "lua/lua.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+using namespace retro8;
+using namespace retro8::io;
+
+namespace
+{
+  /* bumped whenever the layout of an entry or the RAM image changes */
+  constexpr uint32_t VERSION = 1;
+  constexpr char MAGIC[4] = { 'R', '8', 'C', 'C' };
+
+  struct Header
+  {
+    char magic[4];
+    uint32_t version;
+    uint64_t key;
+    uint32_t ramLength;
+    uint32_t bytecodeLength;
+  };
+}
+
+uint64_t Cache::keyFor(const void* data, size_t length)
+{
+  /* FNV-1a, the build is mixed in since chunks depend on the number format, the Lua version and the
+     parser, which changes with every commit */
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  auto mix = [&hash](const void* data, size_t length) {
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < length; ++i)
+    {
+      hash ^= bytes[i];
+      hash *= 0x100000001b3ULL;
+    }
+  };
+
+#ifdef GIT_VERSION
+  mix(GIT_VERSION, sizeof(GIT_VERSION));
+#endif
+  const uint32_t build[] = { VERSION, uint32_t(R8_FIXED_POINT), uint32_t(LUA_VERSION_NUM), uint32_t(sizeof(lua_Number)), uint32_t(sizeof(lua_Integer)) };
+  mix(build, sizeof(build));
+  mix(data, length);
+
+  return hash;
+}
+
+std::string Cache::pathFor(uint64_t key) const
+{
+  char name[32];
+  std::snprintf(name, sizeof(name), "retro8-%016llx.cache", static_cast<unsigned long long>(key));
+  return _directory.empty() ? name : _directory + "/" + name;
+}
+
+bool Cache::load(uint64_t key, Machine& dest) const
+{
+  std::ifstream file(pathFor(key), std::ios::binary);
+  if (!file)
+    return false;
+
+  Header header;
+  if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) || std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) ||
+    header.version != VERSION || header.key != key || header.ramLength != address::CART_DATA_LENGTH)
+    return false;
+
+  std::vector<uint8_t> ram(header.ramLength);
+  std::string bytecode(header.bytecodeLength, '\0');
+  if (!file.read(reinterpret_cast<char*>(ram.data()), ram.size()) || !file.read(&bytecode[0], bytecode.size()))
+    return false;
+
+  /* top level code of the cart can already read cartridge data */
+  std::memcpy(dest.memory().base(), ram.data(), ram.size());
+  dest.memory().markDirty(0, ram.size());
+  dest.memory().backupCartridge();
+
+  if (!dest.code().initFromBytecode(bytecode))
+  {
+    /* chunk from another build, memory goes back to the state the loaders expect */
+    std::memset(dest.memory().base(), 0, ram.size());
+    return false;
+  }
+
+  return true;
+}
+
+bool Cache::store(uint64_t key, Machine& machine) const
+{
+  const std::string& bytecode = machine.code().bytecode();
+  if (bytecode.empty())
+    return false;
+
+  const Header header = { { MAGIC[0], MAGIC[1], MAGIC[2], MAGIC[3] }, VERSION, key, uint32_t(address::CART_DATA_LENGTH), uint32_t(bytecode.size()) };
+
+  /* written aside and renamed so that an interrupted write never leaves a truncated entry */
+  const std::string path = pathFor(key), temporary = path + ".tmp";
+  {
+    std::ofstream file(temporary, std::ios::binary);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    /* memory itself may have been changed by the top level code already */
+    file.write(reinterpret_cast<const char*>(machine.memory().backup()), header.ramLength);
+    file.write(bytecode.data(), bytecode.size());
+
+    if (!file)
+    {
+      file.close();
+      std::remove(temporary.c_str());
+      return false;
+    }
+  }
+
+  return std::rename(temporary.c_str(), path.c_str()) == 0;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "common.h"
+
+#include "vm/machine.h"
+
+#include <string>
+
+namespace retro8
+{
+  namespace io
+  {
+    /* compiled carts kept on disk: each entry holds the cartridge RAM image and the Lua chunk dumped
+       after parsing, so that loading it again skips PNG decoding, decompression and parsing */
+    class Cache
+    {
+    private:
+      std::string _directory;
+
+      std::string pathFor(uint64_t key) const;
+
+    public:
+      Cache(const std::string& directory) : _directory(directory) { }
+
+      /* entries are keyed by the cartridge file contents */
+      static uint64_t keyFor(const void* data, size_t length);
+
+      /* fills cartridge memory and runs the cached chunk, false on a miss or a stale entry */
+      bool load(uint64_t key, Machine& dest) const;
+      /* must be invoked right after loading the cart with Code::keepBytecode enabled, the RAM image is
+         the cartridge backup the loaders take before running the code */
+      bool store(uint64_t key, Machine& machine) const;
+    };
+  }
+}
@@ -0,0 +1,105 @@
+#include "legacy.h"
+
+#include <algorithm>
+#include <cstring>
+
+using namespace retro8;
+using namespace retro8::io;
+
+namespace
+{
+  const char LOOKUP[] = "\n 0123456789abcdefghijklmnopqrstuvwxyz!#%(){}[]<>+=/*:;.,~_";
+  constexpr size_t LOOKUP_LENGTH = sizeof(LOOKUP) - 1;
+  static_assert(LOOKUP_LENGTH == 0x3b, "Must be 0x3b characters");
+
+  constexpr uint8_t FIRST_REFERENCE = 0x3c;
+  constexpr size_t MIN_MATCH = 2;
+  constexpr size_t MAX_MATCH = 0xf + MIN_MATCH;
+  constexpr size_t MAX_OFFSET = ((0xff - FIRST_REFERENCE) << 4) + 0xf;
+}
+
+bool legacy::decompress(const uint8_t* data, size_t size, std::string& dest, size_t length)
+{
+  dest.clear();
+  dest.reserve(length);
+
+  for (size_t i = 0; i < size && dest.size() < length; ++i)
+  {
+    const uint8_t v = data[i];
+
+    /* copy next */
+    if (v == 0x00)
+    {
+      if (++i < size)
+        dest += char(data[i]);
+    }
+    /* lookup */
+    else if (v < FIRST_REFERENCE)
+      dest += LOOKUP[v - 1];
+    else
+    {
+      const uint8_t vn = ++i < size ? data[i] : 0;
+
+      const size_t offset = ((v - FIRST_REFERENCE) << 4) + (vn & 0xf);
+      const size_t count = std::min(size_t(vn >> 4) + MIN_MATCH, length - dest.size());
+
+      if (offset == 0 || offset > dest.size())
+        return false;
+
+      const size_t start = dest.size() - offset;
+      for (size_t j = 0; j < count; ++j)
+        dest += dest[start + j];
+    }
+  }
+
+  return true;
+}
+
+void legacy::compress(const char* data, size_t length, std::vector<uint8_t>& dest)
+{
+  uint8_t codes[256] = { 0 };
+  for (size_t i = 0; i < LOOKUP_LENGTH; ++i)
+    codes[uint8_t(LOOKUP[i])] = uint8_t(i + 1);
+
+  for (size_t i = 0; i < length; )
+  {
+    /* the window is small enough for an exhaustive search */
+    size_t best = 0, offset = 0;
+    for (size_t candidate = 1; candidate <= std::min(i, MAX_OFFSET); ++candidate)
+    {
+      size_t count = 0;
+      while (count < MAX_MATCH && i + count < length && data[i - candidate + count] == data[i + count])
+        ++count;
+
+      if (count > best)
+      {
+        best = count;
+        offset = candidate;
+        if (best == MAX_MATCH)
+          break;
+      }
+    }
+
+    /* a reference takes two bytes, as much as two table characters */
+    const size_t literalBytes = best >= MIN_MATCH ? (codes[uint8_t(data[i])] ? 1 : 2) + (codes[uint8_t(data[i + 1])] ? 1 : 2) : 0;
+
+    if (best > MIN_MATCH || (best == MIN_MATCH && literalBytes > 2))
+    {
+      dest.push_back(uint8_t(FIRST_REFERENCE + (offset >> 4)));
+      dest.push_back(uint8_t((best - MIN_MATCH) << 4 | (offset & 0xf)));
+      i += best;
+    }
+    else
+    {
+      const uint8_t code = codes[uint8_t(data[i])];
+      if (code)
+        dest.push_back(code);
+      else
+      {
+        dest.push_back(0x00);
+        dest.push_back(uint8_t(data[i]));
+      }
+      ++i;
+    }
+  }
+}
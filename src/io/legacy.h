@@ -0,0 +1,22 @@
+#pragma once
+
+#include "common.h"
+
+#include <string>
+#include <vector>
+
+namespace retro8
+{
+  namespace io
+  {
+    /* code compression of cartridges saved before PICO-8 0.2 (":c:" header): every byte is a
+       character of a fixed table, an escaped literal or the first of a two bytes back reference */
+    namespace legacy
+    {
+      /* decodes until length bytes are produced or data is over, false on a reference before the start
+         of the output in which case dest holds the bytes decoded so far */
+      bool decompress(const uint8_t* data, size_t size, std::string& dest, size_t length);
+      void compress(const char* data, size_t length, std::vector<uint8_t>& dest);
+    }
+  }
+}
@@ -6,7 +6,7 @@
 #include <algorithm>
 #include <iterator>
 #include <cassert>
-#include <sstream>
+#include <cstring>
 //#include <cctype>
 
 using namespace retro8;
@@ -19,37 +19,29 @@ void Loader::fixLine(std::string& line)
     line = "print(" + line.substr(1) + ")";
 }
 
-int Loader::valueForHexDigit(char c)
+namespace
 {
-  int v = (c >= 'A') ? (c >= 'a') ? (c - 'a' + 10) : (c - 'A' + 10) : (c - '0');
-  assert(v >= 0 && v <= 0xf);
-  return v;
-}
-
-color_t Loader::colorFromDigit(char d)
-{
-  return static_cast<color_t>(valueForHexDigit(d));
-}
+  /* every byte maps to its hex value, anything that is not a digit decodes as 0 */
+  struct HexTable
+  {
+    uint8_t values[256];
 
-sprite_index_t Loader::spriteIndexFromString(const char* c)
-{
-  int h = valueForHexDigit(c[0]);
-  int l = valueForHexDigit(c[1]);
-  return (h << 4) | l;
-}
+    HexTable()
+    {
+      for (int c = 0; c < 256; ++c)
+      {
+        if (c >= '0' && c <= '9') values[c] = uint8_t(c - '0');
+        else if (c >= 'a' && c <= 'f') values[c] = uint8_t(c - 'a' + 10);
+        else if (c >= 'A' && c <= 'F') values[c] = uint8_t(c - 'A' + 10);
+        else values[c] = 0;
+      }
+    }
+  };
 
-uint8_t Loader::valueForUint8(const char* c)
-{
-  int h = valueForHexDigit(c[0]);
-  int l = valueForHexDigit(c[1]);
-  return (h << 4) | l;
-}
+  const HexTable HEX;
 
-retro8::sprite_flags_t Loader::spriteFlagsFromString(const char* c)
-{
-  int h = valueForHexDigit(c[0]);
-  int l = valueForHexDigit(c[1]);
-  return (h << 4) | l;
+  inline uint8_t hexDigit(char c) { return HEX.values[uint8_t(c)]; }
+  inline uint8_t hexByte(const char* p) { return uint8_t(hexDigit(p[0]) << 4 | hexDigit(p[1])); }
 }
 
 bool Loader::isPngCartridge(const std::string& path)
@@ -57,44 +49,56 @@ bool Loader::isPngCartridge(const std::string& path)
   return path.length() >= 4 && path.substr(path.length() - 4) == ".png";
 }
 
-template<typename T>
-std::vector<std::string> Loader::loadLines(T& input)
+void Loader::loadFile(const std::string& path, Machine& dest)
 {
-  std::vector<std::string> lines;
+  std::ifstream stream(path, std::ios::binary | std::ios::ate);
 
-  for (std::string line; std::getline(input, line); /**/)
-    lines.push_back(line);
+  /* a missing or unreadable file loads an empty cart */
+  const std::streamoff length = stream ? std::streamoff(stream.tellg()) : -1;
+  if (length < 0)
+  {
+    load("", 0, dest);
+    return;
+  }
 
-  for (auto& line : lines)
-    if (!line.empty() && line.back() == '\r')
-      line.resize(line.length() - 1);
+  /* whole file is read with a single allocation and parsed in place */
+  std::vector<char> data(static_cast<size_t>(length));
+  stream.seekg(0);
+  stream.read(data.data(), data.size());
 
-  return lines;
+  load(data.data(), size_t(stream.gcount()), dest);
 }
 
-void Loader::loadFile(const std::string& path, Machine& dest)
+void Loader::loadRaw(const char* data, size_t length, Machine& dest)
 {
-  std::ifstream stream(path);
-  assert(stream.good());
-  load(loadLines(stream), dest);
+  load(data, length, dest);
 }
 
-void Loader::loadRaw(const std::string& data, Machine& dest)
+void Loader::load(const char* data, size_t length, Machine& dest)
 {
-  std::stringstream stream(data);
-  load(loadLines(stream), dest);
+  std::string code;
+  parse(data, length, dest, code);
+  /* cartridge data as the file has it, before the code gets a chance to change it */
+  dest.memory().backupCartridge();
+  dest.code().initFromSource(code);
 }
 
-void Loader::load(const std::vector<std::string>& lines, Machine& m)
-{ 
-  enum class State { HEADER, CODE, GFX, GFF, LABEL, MAP, SFX, MUSIC };
-
-  State state = State::HEADER;
+void Loader::parse(const char* data, size_t length, Machine& m, std::string& code)
+{
+  enum class State { HEADER, CODE, GFX, GFF, LABEL, MAP, SFX, MUSIC, OTHER };
 
-  //TODO: not efficient but for now it's fine
-  std::stringstream code;
+  struct Section
+  {
+    const char* name;
+    size_t length;
+    State state;
+  };
 
-  coord_t sy = 0, my = 0, fy = 0, snd = 0, msc = 0;
+  static const Section SECTIONS[] = {
+    { "__lua__", 7, State::CODE }, { "__gfx__", 7, State::GFX }, { "__gff__", 7, State::GFF },
+    { "__label__", 9, State::LABEL }, { "__map__", 7, State::MAP }, { "__sfx__", 7, State::SFX },
+    { "__music__", 9, State::MUSIC }
+  };
 
   static constexpr size_t DIGITS_PER_PIXEL_ROW = 128;
   static constexpr size_t BYTES_PER_GFX_ROW = DIGITS_PER_PIXEL_ROW / 2;
@@ -105,141 +109,141 @@ void Loader::load(const std::vector<std::string>& lines, Machine& m)
   static constexpr size_t DIGITS_PER_SOUND = 168;
   static constexpr size_t DIGITS_PER_MUSIC_PATTERN = 2 + 1 + 8;
 
+  State state = State::HEADER;
 
-  for (auto& line : lines)
+  /* code is a contiguous run of lines, it's copied once its end is found */
+  code.clear();
+  const char* codeBegin = nullptr;
+
+  auto appendCode = [&code](const char* begin, const char* end) {
+    code.reserve(code.size() + (end - begin));
+    for (const char* p = begin; p < end; ++p)
+      if (*p != '\r')
+        code += *p;
+  };
+
+  coord_t sy = 0, my = 0, fy = 0, snd = 0, msc = 0;
+
+  const char* const end = data + length;
+
+  for (const char* line = data; line < end; /**/)
   {
-    /* change state according to */
-    if (line == "__lua__")
-      state = State::CODE;
-    else if (line == "__gfx__")
-      state = State::GFX;
-    else if (line == "__gff__")
-      state = State::GFF;
-    else if (line == "__label__")
-      state = State::LABEL;
-    else if (line == "__map__")
-      state = State::MAP;
-    else if (line == "__sfx__")
-      state = State::SFX;
-    else if (line == "__music__")
-      state = State::MUSIC;
-    else if (line.empty()) /* skip empty lines */
-      continue;
-    /*else if (std::all_of(line.begin(), line.end(), [](char c) { return std::isspace(c); }))
-      continue;*/
-    else
+    const char* eol = static_cast<const char*>(std::memchr(line, '\n', end - line));
+    const char* next = eol ? eol + 1 : end;
+    if (!eol) eol = end;
+    if (eol > line && eol[-1] == '\r') --eol;
+
+    const size_t lineLength = eol - line;
+
+    /* section headers look like __name__, unknown ones (eg. __meta:*__) are skipped */
+    if (lineLength > 4 && line[0] == '_' && line[1] == '_' && eol[-1] == '_' && eol[-2] == '_' && std::find(line, eol, ' ') == eol)
+    {
+      if (state == State::CODE)
+        appendCode(codeBegin, line);
+
+      auto section = std::find_if(std::begin(SECTIONS), std::end(SECTIONS), [line, lineLength](const Section& candidate) {
+        return candidate.length == lineLength && std::memcmp(candidate.name, line, lineLength) == 0;
+      });
+
+      state = section != std::end(SECTIONS) ? section->state : State::OTHER;
+      codeBegin = next;
+    }
+    /* empty lines are kept in code so that errors report the right line */
+    else if (lineLength)
     {
       switch (state)
       {
-      case State::CODE:
-        //fixOperators(line);
-        code << line << std::endl;
-        break;
-
       case State::GFX:
-        assert(line.length() == DIGITS_PER_PIXEL_ROW);
-        for (coord_t x = 0; x < BYTES_PER_GFX_ROW; ++x)
+        if (lineLength >= DIGITS_PER_PIXEL_ROW && sy < coord_t(gfx::SPRITE_SHEET_HEIGHT))
         {
-          const char* pair = line.c_str() + x * 2;
-          auto* dest = m.memory().as<gfx::color_byte_t>(address::SPRITE_SHEET + sy * BYTES_PER_GFX_ROW + x);
-
-          dest->setBoth(colorFromDigit(pair[0]), colorFromDigit(pair[1]));
+          /* pixels are stored low nibble first */
+          uint8_t* dest = m.memory().base() + address::SPRITE_SHEET + sy * BYTES_PER_GFX_ROW;
+          for (size_t x = 0; x < BYTES_PER_GFX_ROW; ++x)
+            dest[x] = uint8_t(hexDigit(line[x * 2]) | hexDigit(line[x * 2 + 1]) << 4);
+          ++sy;
         }
-
-        ++sy;
         break;
 
       case State::MAP:
-      {
-        assert(line.length() == DIGITS_PER_MAP_ROW);
-        for (coord_t x = 0; x < gfx::TILE_MAP_WIDTH; ++x)
+        if (lineLength >= DIGITS_PER_MAP_ROW && my < coord_t(gfx::TILE_MAP_HEIGHT))
         {
-          const char* index = line.c_str() + x * 2;
-          sprite_index_t sindex = spriteIndexFromString(index);
-          *m.memory().spriteInTileMap(x, my) = sindex;
+          sprite_index_t* dest = m.memory().spriteInTileMap(0, my);
+          for (size_t x = 0; x < gfx::TILE_MAP_WIDTH; ++x)
+            dest[x] = hexByte(line + x * 2);
+          ++my;
         }
-        ++my;
         break;
-      }
+
       case State::GFF:
-      {
-        assert(line.length() == DIGITS_PER_SPRITE_FLAGS_ROW);
-        for (coord_t x = 0; x < DIGITS_PER_SPRITE_FLAGS_ROW/2; ++x)
+        if (lineLength >= DIGITS_PER_SPRITE_FLAGS_ROW && fy < coord_t(gfx::SPRITE_COUNT / 128))
         {
-          const char* sflags = line.c_str() + x * 2;
-          sprite_flags_t flags = spriteFlagsFromString(sflags);
-          *m.memory().spriteFlagsFor(128*fy + x) = flags;
+          sprite_flags_t* dest = m.memory().spriteFlagsFor(128 * fy);
+          for (size_t x = 0; x < DIGITS_PER_SPRITE_FLAGS_ROW / 2; ++x)
+            dest[x] = hexByte(line + x * 2);
+          ++fy;
         }
-        ++fy;
         break;
-      }
+
 #if SOUND_ENABLED
       case State::SFX:
-      {
-        assert(line.length() == DIGITS_PER_SOUND);
-        const char* p = line.c_str();
+        if (lineLength >= DIGITS_PER_SOUND && snd < coord_t(sfx::SOUND_COUNT))
+        {
+          sfx::Sound* sound = m.memory().sound(snd);
+          sound->speed = hexByte(line + 2);
+          sound->loopStart = hexByte(line + 4);
+          sound->loopEnd = hexByte(line + 6);
 
-        sfx::Sound* sound = m.memory().sound(snd);
-        sound->speed = valueForUint8(p+2);
-        sound->loopStart = valueForUint8(p+4);
-        sound->loopEnd = valueForUint8(p+6);
+          const char* p = line + 8;
 
-        p = p + 8;
+          for (size_t i = 0; i < sound->samples.size(); ++i, p += 5)
+          {
+            auto& sample = sound->samples[i];
 
-        for (size_t i = 0; i < sound->samples.size(); ++i)
-        {
-          const char* s = p + (i * 5);
-          
-          auto& sample = sound->samples[i];
-          
-          sample.setPitch(valueForUint8(s));
-          sample.setWaveform(sfx::Waveform(valueForHexDigit(s[2])));
-          sample.setVolume(valueForHexDigit(s[3]));
-          sample.setEffect(sfx::Effect(valueForHexDigit(s[4])));
-        }
+            sample.setPitch(hexByte(p));
+            sample.setWaveform(sfx::Waveform(hexDigit(p[2])));
+            sample.setVolume(hexDigit(p[3]));
+            sample.setEffect(sfx::Effect(hexDigit(p[4])));
+          }
 
-        ++snd;
+          ++snd;
+        }
         break;
 
-      }
       case State::MUSIC:
-      {
-        const char* p = line.c_str();
-
-        if (!line.empty())
+        if (lineLength >= DIGITS_PER_MUSIC_PATTERN && msc < coord_t(sfx::MUSIC_COUNT))
         {
           sfx::Music* music = m.memory().music(msc);
 
           /* XX AABBCCDD*/
           constexpr sfx::sound_index_t UNUSED_CHANNEL = 0x40;
 
-          uint8_t flags = valueForUint8(p);
+          uint8_t flags = hexByte(line);
 
           if (flags & 0b1) music->markLoopBegin();
           else if (flags & 0b10) music->markLoopEnd();
           else if (flags & 0b100) music->markStop();
 
-          for (sfx::channel_index_t i = 0; i < sfx::APU::CHANNEL_COUNT; ++i)
+          for (sfx::channel_index_t i = 0; i < sfx::channel_index_t(sfx::APU::CHANNEL_COUNT); ++i)
           {
-            sfx::sound_index_t index = valueForUint8(p + 3 + 2 * i);
+            sfx::sound_index_t index = hexByte(line + 3 + 2 * i);
 
             if (index < UNUSED_CHANNEL)
               music->setSound(i, index);
-            else
-              assert(true || (index == UNUSED_CHANNEL + i + 1));
           }
 
           ++msc;
-
         }
-        
         break;
-      }
 #endif
-      }
 
+      default:
+        break;
+      }
     }
+
+    line = next;
   }
 
-  m.code().initFromSource(code.str());
+  if (state == State::CODE)
+    appendCode(codeBegin, end);
 }
@@ -12,20 +12,17 @@ namespace retro8
     class Loader
     {
     private:
-      int valueForHexDigit(char c);
-      retro8::color_t colorFromDigit(char d);
-      retro8::sprite_index_t spriteIndexFromString(const char* c);
-      retro8::sprite_flags_t spriteFlagsFromString(const char* c);
-      uint8_t valueForUint8(const char* c);
-
-      template<typename T> std::vector<std::string> loadLines(T& stream);
-      void load(const std::vector<std::string>& lines, Machine& dest);
+      void load(const char* data, size_t length, Machine& dest);
 
     public:
 
-      void loadRaw(const std::string& data, Machine& dest);
+      void loadRaw(const char* data, size_t length, Machine& dest);
+      void loadRaw(const std::string& data, Machine& dest) { loadRaw(data.data(), data.size(), dest); }
       void loadFile(const std::string& path, Machine& dest);
 
+      /* fills cartridge memory and returns the code without running it */
+      void parse(const char* data, size_t length, Machine& dest, std::string& code);
+
       static bool isPngCartridge(const std::string& path);
 
       static void fixLine(std::string& line);
@@ -26,7 +26,7 @@ convert_to_rgba32: optional parameter, true by default.
 return: 0 if success, not 0 if some error occured.
 */
 
-int decodePNG(std::vector<unsigned char>& out_image, unsigned long& image_width, unsigned long& image_height, const unsigned char* in_png, size_t in_size, bool convert_to_rgba32 = true)
+int decodePNG(std::vector<unsigned char>& out_image, unsigned long& image_width, unsigned long& image_height, const unsigned char* in_png, size_t in_size, bool convert_to_rgba32 = true, Platform::png_row_callback rows = nullptr, void* user_data = nullptr)
 {
   // picoPNG version 20101224
   // Copyright (c) 2005-2010 Lode Vandevenne
@@ -258,9 +258,9 @@ int decodePNG(std::vector<unsigned char>& out_image, unsigned long& image_width,
       std::vector<unsigned char> palette;
     } info;
     int error;
-    void decode(std::vector<unsigned char>& out, const unsigned char* in, size_t size, bool convert_to_rgba32)
+    void decode(std::vector<unsigned char>& out, const unsigned char* in, size_t size, bool convert_to_rgba32, Platform::png_row_callback rows, void* user_data)
     {
-      error = 0;
+      error = 0; info.width = info.height = 0;
       if (size == 0 || in == 0) { error = 48; return; } //the given data is empty
       readPngHeader(&in[0], size); if (error) return;
       size_t pos = 33; //first byte of the first chunk after the header
@@ -325,6 +325,20 @@ int decodePNG(std::vector<unsigned char>& out_image, unsigned long& image_width,
       std::vector<unsigned char> scanlines(((info.width * (info.height * bpp + 7)) / 8) + info.height); //now the out buffer will be filled
       Zlib zlib; //decompress with the Zlib decompressor
       error = zlib.decompress(scanlines, idat); if (error) return; //stop if the zlib decompressor returned an error
+      if (rows && info.interlaceMethod == 0 && info.colorType == 6 && info.bitDepth == 8) //retro8: RGBA rows are handed out as they are unfiltered, the RGBA image is never built (the inflated scanlines still are)
+      {
+        size_t linestart = 0, linelength = info.width * 4;
+        std::vector<unsigned char> lines(2 * linelength);
+        for (unsigned long y = 0; y < info.height; y++)
+        {
+          unsigned char* line = &lines[(y & 1) * linelength];
+          const unsigned char* prevline = (y == 0) ? 0 : &lines[((y - 1) & 1) * linelength];
+          unFilterScanline(line, &scanlines[linestart + 1], prevline, 4, scanlines[linestart], linelength); if (error) return;
+          rows(user_data, y, line, info.width);
+          linestart += (1 + linelength);
+        }
+        return;
+      }
       size_t bytewidth = (bpp + 7) / 8, outlength = (info.height * info.width * bpp + 7) / 8;
       out.resize(outlength); //time to fill the out buffer
       unsigned char* out_ = outlength ? &out[0] : 0; //use a regular pointer to the std::vector for faster code if compiled without optimization
@@ -532,7 +546,7 @@ int decodePNG(std::vector<unsigned char>& out_image, unsigned long& image_width,
       return (unsigned char)((pa <= pb && pa <= pc) ? a : pb <= pc ? b : c);
     }
   };
-  PNG decoder; decoder.decode(out_image, in_png, in_size, convert_to_rgba32);
+  PNG decoder; decoder.decode(out_image, in_png, in_size, convert_to_rgba32, rows, user_data);
   image_width = decoder.info.width; image_height = decoder.info.height;
   return decoder.error;
 }
@@ -542,4 +556,20 @@ int Platform::loadPNG(std::vector<unsigned char>& out_image, unsigned long& imag
   return decodePNG(out_image, image_width, image_height, in_png, in_size, convert_to_rgba32);
 }
 
+int Platform::loadPNGRows(const unsigned char* in_png, size_t in_size, png_row_callback rows, void* user_data)
+{
+  std::vector<unsigned char> image;
+  unsigned long width, height;
+  int error = decodePNG(image, width, height, in_png, in_size, true, rows, user_data);
+
+  /* interlaced or non RGBA pictures are converted as a whole first */
+  if (error == 0 && !image.empty())
+  {
+    for (unsigned long y = 0; y < height; y++)
+      rows(user_data, y, &image[y * width * 4], width);
+  }
+
+  return error;
+}
+
 #endif
\ No newline at end of file
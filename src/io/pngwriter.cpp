@@ -0,0 +1,98 @@
+#include "common.h"
+
+#include <algorithm>
+
+namespace
+{
+  /* PNG stores integers big endian */
+  void put32(std::vector<unsigned char>& out, uint32_t value)
+  {
+    out.push_back((unsigned char)(value >> 24));
+    out.push_back((unsigned char)(value >> 16));
+    out.push_back((unsigned char)(value >> 8));
+    out.push_back((unsigned char)(value));
+  }
+
+  uint32_t crc32(const unsigned char* data, size_t length)
+  {
+    static uint32_t table[256] = { 0 };
+    if (!table[1])
+    {
+      for (uint32_t n = 0; n < 256; ++n)
+      {
+        uint32_t c = n;
+        for (int k = 0; k < 8; ++k)
+          c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+        table[n] = c;
+      }
+    }
+
+    uint32_t crc = 0xffffffffu;
+    for (size_t i = 0; i < length; ++i)
+      crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    return crc ^ 0xffffffffu;
+  }
+
+  void chunk(std::vector<unsigned char>& out, const char* type, const std::vector<unsigned char>& data)
+  {
+    put32(out, uint32_t(data.size()));
+    const size_t start = out.size();
+    out.insert(out.end(), type, type + 4);
+    out.insert(out.end(), data.begin(), data.end());
+    put32(out, crc32(&out[start], out.size() - start));
+  }
+}
+
+void Platform::savePNG(std::vector<unsigned char>& out_png, const unsigned char* in_image, unsigned long image_width, unsigned long image_height)
+{
+  static const unsigned char SIGNATURE[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+  out_png.assign(SIGNATURE, SIGNATURE + sizeof(SIGNATURE));
+
+  std::vector<unsigned char> header;
+  put32(header, uint32_t(image_width));
+  put32(header, uint32_t(image_height));
+  /* 8 bits per channel, RGBA, default compression, filter and no interlacing */
+  const unsigned char format[] = { 8, 6, 0, 0, 0 };
+  header.insert(header.end(), format, format + sizeof(format));
+  chunk(out_png, "IHDR", header);
+
+  /* every row is prefixed by filter type 0 */
+  const size_t stride = image_width * 4;
+  std::vector<unsigned char> raw;
+  raw.reserve((stride + 1) * image_height);
+  for (unsigned long y = 0; y < image_height; ++y)
+  {
+    raw.push_back(0);
+    raw.insert(raw.end(), in_image + y * stride, in_image + (y + 1) * stride);
+  }
+
+  /* zlib stream made of stored deflate blocks */
+  std::vector<unsigned char> zlib = { 0x78, 0x01 };
+  uint32_t a = 1, b = 0;
+
+  size_t offset = 0;
+  do
+  {
+    const size_t length = std::min(raw.size() - offset, size_t(0xffff));
+    const bool last = offset + length == raw.size();
+
+    zlib.push_back(last ? 1 : 0);
+    zlib.push_back((unsigned char)(length));
+    zlib.push_back((unsigned char)(length >> 8));
+    zlib.push_back((unsigned char)(~length));
+    zlib.push_back((unsigned char)(~length >> 8));
+    zlib.insert(zlib.end(), raw.begin() + offset, raw.begin() + offset + length);
+
+    for (size_t i = offset; i < offset + length; ++i)
+    {
+      a = (a + raw[i]) % 65521;
+      b = (b + a) % 65521;
+    }
+
+    offset += length;
+  } while (offset < raw.size());
+
+  put32(zlib, b << 16 | a);
+  chunk(out_png, "IDAT", zlib);
+  chunk(out_png, "IEND", std::vector<unsigned char>());
+}
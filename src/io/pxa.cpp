@@ -0,0 +1,336 @@
+#include "pxa.h"
+
+#include <algorithm>
+#include <cstring>
+
+using namespace retro8;
+using namespace retro8::io;
+
+namespace
+{
+  /* bits are consumed from the least significant bit of each byte, a 64 bit buffer is refilled a
+     byte at a time so that every read up to 56 bits is a mask and a shift */
+  class BitReader
+  {
+  private:
+    const uint8_t* _data;
+    const uint8_t* _end;
+    uint64_t _buffer;
+    uint32_t _count;
+
+    void refill()
+    {
+      while (_count <= 56)
+      {
+        const uint64_t byte = _data < _end ? *_data++ : 0;
+        _buffer |= byte << _count;
+        _count += 8;
+      }
+    }
+
+  public:
+    BitReader(const uint8_t* data, size_t size) : _data(data), _end(data + size), _buffer(0), _count(0) { }
+
+    uint32_t read(uint32_t bits)
+    {
+      if (_count < bits)
+        refill();
+
+      const uint32_t value = uint32_t(_buffer & ((uint64_t(1) << bits) - 1));
+      _buffer >>= bits;
+      _count -= bits;
+      return value;
+    }
+
+    bool bit() { return read(1) != 0; }
+
+    /* number of consecutive set bits, the terminating zero is consumed */
+    uint32_t unary()
+    {
+      uint32_t count = 0;
+      while (bit())
+        ++count;
+      return count;
+    }
+  };
+}
+
+bool pxa::decompress(const uint8_t* data, size_t size, std::string& dest, size_t length)
+{
+  BitReader reader(data, size);
+
+  uint8_t mtf[256];
+  for (size_t i = 0; i < sizeof(mtf); ++i)
+    mtf[i] = uint8_t(i);
+
+  dest.resize(length);
+  char* const begin = &dest[0];
+  char* const end = begin + length;
+  char* out = begin;
+
+  while (out < end)
+  {
+    /* literal: index in the move-to-front list */
+    if (reader.bit())
+    {
+      const uint32_t unary = reader.unary();
+
+      /* 16 + 32 + 64 + 128 indices are covered by the first four lengths, the fifth reaches 255 but
+         its 8 bits could go up to 495 */
+      const uint32_t index = unary > 4 ? sizeof(mtf) : reader.read(4 + unary) + (((1 << unary) - 1) << 4);
+      if (index >= sizeof(mtf))
+      {
+        dest.resize(out - begin);
+        return false;
+      }
+
+      const uint8_t value = mtf[index];
+
+      std::memmove(mtf + 1, mtf, index);
+      mtf[0] = value;
+      *out++ = char(value);
+    }
+    else
+    {
+      const uint32_t offsetBits = reader.bit() ? (reader.bit() ? 5 : 10) : 15;
+      const size_t offset = reader.read(offsetBits) + 1;
+
+      /* bytes emitted as is until a zero, without affecting the move-to-front list */
+      if (offsetBits == 10 && offset == 1)
+      {
+        for (uint8_t value = uint8_t(reader.read(8)); value && out < end; value = uint8_t(reader.read(8)))
+          *out++ = char(value);
+      }
+      else
+      {
+        size_t count = 3;
+        for (uint32_t part = 0b111; part == 0b111; count += part)
+          part = reader.read(3);
+
+        if (offset > size_t(out - begin))
+        {
+          dest.resize(out - begin);
+          return false;
+        }
+
+        count = std::min(count, size_t(end - out));
+        const char* from = out - offset;
+
+        /* overlapping references repeat the last offset bytes so they are copied forward */
+        if (offset >= count)
+          std::memcpy(out, from, count);
+        else
+          for (size_t i = 0; i < count; ++i)
+            out[i] = from[i];
+
+        out += count;
+      }
+    }
+  }
+
+  return true;
+}
+
+namespace
+{
+  class BitWriter
+  {
+  private:
+    std::vector<uint8_t>& _data;
+    uint64_t _buffer;
+    uint32_t _count;
+
+  public:
+    BitWriter(std::vector<uint8_t>& data) : _data(data), _buffer(0), _count(0) { }
+
+    void write(uint32_t value, uint32_t bits)
+    {
+      _buffer |= uint64_t(value) << _count;
+      _count += bits;
+
+      for (; _count >= 8; _count -= 8, _buffer >>= 8)
+        _data.push_back(uint8_t(_buffer));
+    }
+
+    void flush()
+    {
+      if (_count)
+        _data.push_back(uint8_t(_buffer));
+      _buffer = 0;
+      _count = 0;
+    }
+  };
+
+  constexpr size_t WINDOW = 1 << 15;
+  constexpr size_t MIN_MATCH = 3;
+  constexpr size_t HASH_BITS = 14;
+
+  /* literals of index i use unary prefix u so that i < ((2 << u) - 1) * 16 */
+  inline uint32_t literalUnary(size_t index)
+  {
+    uint32_t unary = 0;
+    while (index >= ((size_t(2) << unary) - 1) << 4)
+      ++unary;
+    return unary;
+  }
+
+  inline uint32_t literalBits(size_t index)
+  {
+    const uint32_t unary = literalUnary(index);
+    return 1 + (unary + 1) + (4 + unary);
+  }
+
+  inline uint32_t offsetBits(size_t offset) { return offset <= 32 ? 5 : (offset <= 1024 ? 10 : 15); }
+
+  inline uint32_t matchBits(size_t offset, size_t length)
+  {
+    const uint32_t bits = offsetBits(offset);
+    return 1 + (bits == 15 ? 1 : 2) + bits + 3 * uint32_t((length - MIN_MATCH) / 7 + 1);
+  }
+
+  inline uint32_t hash(const char* p)
+  {
+    const uint32_t v = uint32_t(uint8_t(p[0])) | uint32_t(uint8_t(p[1])) << 8 | uint32_t(uint8_t(p[2])) << 16;
+    return (v * 2654435761u) >> (32 - HASH_BITS);
+  }
+
+  /* positions are stored + 1 so that 0 marks an empty slot */
+  class MatchFinder
+  {
+  private:
+    const char* _data;
+    size_t _length;
+    size_t _depth;
+    std::vector<uint32_t> _head;
+    std::vector<uint32_t> _previous;
+    size_t _inserted;
+
+  public:
+    MatchFinder(const char* data, size_t length, size_t depth) : _data(data), _length(length), _depth(depth),
+      _head(size_t(1) << HASH_BITS, 0), _previous(WINDOW, 0), _inserted(0) { }
+
+    /* adds every position before i to the chains */
+    void advance(size_t i)
+    {
+      for (; _inserted < i && _inserted + MIN_MATCH <= _length; ++_inserted)
+      {
+        uint32_t& head = _head[hash(_data + _inserted)];
+        _previous[_inserted % WINDOW] = head;
+        head = uint32_t(_inserted + 1);
+      }
+    }
+
+    /* longest match at i, the closest one wins ties since offsets are cheaper */
+    size_t find(size_t i, size_t& offset)
+    {
+      if (i + MIN_MATCH > _length)
+        return 0;
+
+      advance(i);
+
+      size_t best = 0;
+      uint32_t candidate = _head[hash(_data + i)];
+
+      for (size_t d = 0; candidate && d < _depth; ++d)
+      {
+        const size_t position = candidate - 1;
+        if (i - position > WINDOW)
+          break;
+
+        if (_data[position + best] == _data[i + best])
+        {
+          size_t length = 0;
+          while (i + length < _length && _data[position + length] == _data[i + length])
+            ++length;
+
+          if (length > best)
+          {
+            best = length;
+            offset = i - position;
+            if (i + best == _length)
+              break;
+          }
+        }
+
+        const uint32_t next = _previous[position % WINDOW];
+        if (next >= candidate)
+          break;
+        candidate = next;
+      }
+
+      return best >= MIN_MATCH ? best : 0;
+    }
+  };
+}
+
+void pxa::compress(const char* data, size_t length, std::vector<uint8_t>& dest, size_t depth)
+{
+  BitWriter writer(dest);
+  MatchFinder finder(data, length, depth);
+
+  uint8_t mtf[256];
+  for (size_t i = 0; i < sizeof(mtf); ++i)
+    mtf[i] = uint8_t(i);
+
+  auto indexOf = [&mtf](char value) { return size_t(static_cast<const uint8_t*>(std::memchr(mtf, uint8_t(value), sizeof(mtf))) - mtf); };
+
+  size_t offset = 0, matched = finder.find(0, offset);
+
+  for (size_t i = 0; i < length; )
+  {
+    /* short matches are only worth it against literals deep in the move-to-front list */
+    if (matched && matched < 5)
+    {
+      uint32_t literals = 0;
+      for (size_t j = 0; j < matched; ++j)
+        literals += literalBits(indexOf(data[i + j]));
+      if (literals <= matchBits(offset, matched))
+        matched = 0;
+    }
+
+    /* lazy evaluation: a literal followed by a longer match is usually cheaper */
+    size_t nextOffset = 0, next = matched ? finder.find(i + 1, nextOffset) : 0;
+
+    if (matched && next <= matched + 1)
+    {
+      writer.write(0, 1);
+
+      const uint32_t bits = offsetBits(offset);
+      if (bits == 5) writer.write(0b11, 2);
+      else if (bits == 10) writer.write(0b01, 2);
+      else writer.write(0, 1);
+      writer.write(uint32_t(offset - 1), bits);
+
+      size_t rest = matched - MIN_MATCH;
+      for (; rest >= 7; rest -= 7)
+        writer.write(0b111, 3);
+      writer.write(uint32_t(rest), 3);
+
+      i += matched;
+      matched = finder.find(i, offset);
+    }
+    else
+    {
+      const size_t index = indexOf(data[i]);
+      const uint32_t unary = literalUnary(index);
+
+      writer.write(1, 1);
+      writer.write((1u << unary) - 1, unary + 1);
+      writer.write(uint32_t(index - (((size_t(1) << unary) - 1) << 4)), 4 + unary);
+
+      std::memmove(mtf + 1, mtf, index);
+      mtf[0] = uint8_t(data[i]);
+
+      ++i;
+      if (next)
+      {
+        matched = next;
+        offset = nextOffset;
+      }
+      else
+        matched = finder.find(i, offset);
+    }
+  }
+
+  writer.flush();
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include "common.h"
+
+#include <string>
+#include <vector>
+
+namespace retro8
+{
+  namespace io
+  {
+    /* PXA is the code compression used by PICO-8 0.2 cartridges: literals are coded as indices in a
+       move-to-front list of byte values and repetitions as back references into the output */
+    namespace pxa
+    {
+      /* decodes exactly length bytes into dest, reads past the end of data see zero bits. On a malformed
+         stream, a reference before the start of the output or an invalid literal, dest is truncated to
+         the bytes decoded so far and false is returned */
+      bool decompress(const uint8_t* data, size_t size, std::string& dest, size_t length);
+
+      /* matches are searched through hash chains, depth bounds how many candidates are tried for
+         each position, output is decoded back exactly by decompress */
+      static constexpr size_t DEFAULT_SEARCH_DEPTH = 64;
+      void compress(const char* data, size_t length, std::vector<uint8_t>& dest, size_t depth = DEFAULT_SEARCH_DEPTH);
+    }
+  }
+}
@@ -1,7 +1,11 @@
 #include "stegano.h"
 
+#include "legacy.h"
+#include "pxa.h"
+
 #include <cassert>
 #include <algorithm>
+#include <utility>
 
 using namespace retro8;
 using namespace io;
@@ -9,179 +13,75 @@ using namespace io;
 constexpr size_t RAW_DATA_LENGTH = 0x4300;
 constexpr size_t MAGIC_LENGTH = 4;
 constexpr size_t HEADER_20_LENGTH = 8;
+/* bytes after the code are not read by PICO-8 */
+constexpr size_t CART_LENGTH = 0x8000;
 
 #if DEBUGGER
 #include <fstream>
 static std::string fileName = "foo.p8";
 #endif
 
-uint8_t Stegano::assembleByte(const uint32_t v)
+/* each byte is spread over the two lowest bits of a pixel, from the highest bits alpha, red, green
+   and blue. Pixels are read as R | G << 8 | B << 16 | A << 24, once masked a single multiplication
+   moves the four pairs in the top byte without overlapping so that loops over it vectorize */
+static inline uint8_t assembleByte(const uint32_t v)
 {
-  constexpr uint32_t MASK_ALPHA = 0xff000000;
-  constexpr uint32_t MASK_RED = 0x00ff0000;
-  constexpr uint32_t MASK_GREEN = 0x0000ff00;
-  constexpr uint32_t MASK_BLUE = 0x000000ff;
-
-  constexpr uint32_t SHIFT_ALPHA = 24;
-  constexpr uint32_t SHIFT_RED = 16;
-  constexpr uint32_t SHIFT_GREEN = 8;
-  constexpr uint32_t SHIFT_BLUE = 0;
-
-  return
-    ((((v & MASK_ALPHA) >> SHIFT_ALPHA) & 0b11) << 6) |
-    ((((v & MASK_RED) >> SHIFT_RED) & 0b11) << 0) |
-    ((((v & MASK_GREEN) >> SHIFT_GREEN) & 0b11) << 2) |
-    ((((v & MASK_BLUE) >> SHIFT_BLUE) & 0b11) << 4);
-}
-
+  constexpr uint32_t MASK = 0x03030303;
+  constexpr uint32_t GATHER = (1 << 28) | (1 << 18) | (1 << 8) | (1 << 6);
 
+  return uint8_t(((v & MASK) * GATHER) >> 24);
+}
 
-class PXADecoder
+void Stegano::assemble(const uint32_t* pixels, size_t count, uint8_t* dest)
 {
-public:
-  const uint8_t* data;
-  size_t b; /* bit index */
-  size_t o; /* byte index */
-  size_t expected;
-  std::array<uint8_t, 256> m;
-
-private:
-  bool readBit()
-  {
-    int v = data[o] & (1 << b);
-    ++b;
-
-    if (b == 8)
-    {
-      b = 0;
-      ++o;
-    }
-
-    return v;
-  }
-
-  int32_t readBits(size_t c)
-  {
-    int32_t r = 0;
-    for (size_t i = 0; i < c; ++i)
-      if (readBit())
-        r |= 1 << i;
+  for (size_t i = 0; i < count; ++i)
+    dest[i] = assembleByte(pixels[i]);
+}
 
-    return r;
-  }
+static void assemble(const uint8_t* rgba, size_t count, uint8_t* dest)
+{
+  for (size_t i = 0; i < count; ++i, rgba += 4)
+    dest[i] = assembleByte(uint32_t(rgba[0]) | uint32_t(rgba[1]) << 8 | uint32_t(rgba[2]) << 16 | uint32_t(rgba[3]) << 24);
+}
 
-  void moveToFront(size_t i)
-  {
-    int v = m[i];
-    for (int j = i; j > 0; --j)
-      m[j] = m[j - 1];
-    m[0] = v;
-  }
+void Stegano::assembleRow(void* self, unsigned long y, const uint8_t* rgba, unsigned long width)
+{
+  auto* data = static_cast<std::pair<Stegano*, Machine*>*>(self);
 
-public:
-  PXADecoder(const uint8_t* data, size_t expected) : data(data), b(0), o(0), expected(expected)
+  if (width != IMAGE_WIDTH)
   {
-    /* initalize mapping, each value to itself */
-    //TODO
-    for (size_t i = 0; i < m.size(); ++i)
-      m[i] = i;
+    data->first->_code.clear();
+    return;
   }
+  else if (y >= IMAGE_HEIGHT)
+    return;
 
-  std::string process()
-  {
-    std::string code;
-    while (code.size() < expected)
-    {
-      bool h = readBit();
-
-      /* read index to move to front, and output value */
-      if (h == 1)
-      {
-        int unary = 0;
-        while (readBit())
-          ++unary;
-
-        uint8_t unaryMask = ((1 << unary) - 1);
-        uint8_t index = readBits(4 + unary) + (unaryMask << 4);
-
-        code += m[index];
-        moveToFront(index);
-      }
-      /* copy section */
-      else
-      {
-        /* read offset */
-        int32_t offsetBits;
-
-        if (readBit())
-          offsetBits = readBit() ? 5 : 10;
-        else
-          offsetBits = 15;
-
-        auto offset = readBits(offsetBits) + 1;
-
-        /* special hacky case in which bytes are directly emitted without
-           affecting move-to-front
-         */
-        if (offsetBits == 10 && offset == 1)
-        {
-          uint8_t v = readBits(8);
-          while (v)
-          {
-            code += v;
-            v = readBits(8);
-          }
-        }
-        else
-        {
-          /* read length */
-          int32_t length = 3, part = 0;
-          do
-          {
-            part = readBits(3);
-            length += part;
-          } while (part == 0b111);
-
-          assert(offset <= code.size());
-
-          size_t start = code.size() - offset;
-          for (int32_t l = 0; l < length; ++l)
-          {
-            code += code[start + l];
-          }
-        }
-      }
-
-    }
-
-    return code;
-  }
-
-};
+  /* the row that straddles the end of the raw data is split between memory and code */
+  const size_t o = y * IMAGE_WIDTH;
+  const size_t raw = o < RAW_DATA_LENGTH ? std::min(size_t(IMAGE_WIDTH), RAW_DATA_LENGTH - o) : 0;
 
+  ::assemble(rgba, raw, data->second->memory().base() + o);
+  if (raw < IMAGE_WIDTH)
+    ::assemble(rgba + raw * 4, IMAGE_WIDTH - raw, data->first->_code.data() + o + raw - RAW_DATA_LENGTH);
+}
 
-void Stegano::load20(const PngData& data, Machine& m)
+void Stegano::load20(Machine& m)
 {
-  auto* d = data.data;
-  size_t o = RAW_DATA_LENGTH + MAGIC_LENGTH;
+  auto* d = _code.data();
+  size_t o = MAGIC_LENGTH;
 
-  size_t decompressedLength = assembleByte(d[o]) << 8 | assembleByte(d[o+1]);
-  size_t compressedLength = assembleByte(d[o+2]) << 8 | assembleByte(d[o+3]);
+  size_t decompressedLength = d[o] << 8 | d[o + 1];
+  size_t compressedLength = d[o + 2] << 8 | d[o + 3];
   o += 4;
 
   compressedLength -= HEADER_20_LENGTH; /* subtract header length */
 
   compressedLength = std::min(size_t(32769ULL - RAW_DATA_LENGTH), compressedLength);
 
-  assert(o == RAW_DATA_LENGTH + HEADER_20_LENGTH);
-
-  std::vector<uint8_t> assembled(compressedLength);
-  std::generate(assembled.begin(), assembled.end(), [this, &d, &o] () { return assembleByte(d[o++]); });
+  assert(o == HEADER_20_LENGTH);
 
-  assert(o == RAW_DATA_LENGTH + HEADER_20_LENGTH + compressedLength);
-
-  auto decoder = PXADecoder(assembled.data(), decompressedLength);
-  std::string code = decoder.process();
+  std::string code;
+  pxa::decompress(d + o, compressedLength, code, decompressedLength);
 
 #if DEBUGGER
   std::ofstream output(fileName);
@@ -192,55 +92,17 @@ void Stegano::load20(const PngData& data, Machine& m)
   m.code().initFromSource(code);
 }
 
-void Stegano::load10(const PngData& data, Machine& m)
+void Stegano::load10(Machine& m)
 {
-  auto* d = data.data;
-  size_t o = RAW_DATA_LENGTH + MAGIC_LENGTH;
-
-  /* read uint6_t msb compressed length*/
-  size_t compressedLength = assembleByte(d[o]) << 8 | assembleByte(d[o + 1]);
-  o += 2;
-  /* skip 2 null*/
-  o += 2;
+  auto* d = _code.data();
+  size_t o = MAGIC_LENGTH;
 
-  compressedLength = std::min(size_t(32769ULL - RAW_DATA_LENGTH), compressedLength);
+  /* uint16_t msb decompressed length followed by 2 null */
+  size_t decompressedLength = d[o] << 8 | d[o + 1];
+  o += 4;
 
-  const std::string lookup = "\n 0123456789abcdefghijklmnopqrstuvwxyz!#%(){}[]<>+=/*:;.,~_";
   std::string code;
-
-  assert(0x3b == lookup.length());
-  //TODO: optimize concatenation on string by reserving space
-
-  for (size_t i = 0; i < compressedLength; ++i)
-  {
-    uint8_t v = assembleByte(d[o + i]);
-
-    /* copy next */
-    if (v == 0x00)
-    {
-      uint8_t vn = assembleByte(d[o + i + 1]);
-      code += vn;
-      ++i;
-    }
-    /* lookup */
-    else if (v <= 0x3b)
-    {
-      code += lookup[v - 1];
-    }
-    else
-    {
-      uint8_t vn = assembleByte(d[o + i + 1]);
-
-      auto offset = ((v - 0x3c) << 4) + (vn & 0xf);
-      auto length = (vn >> 4) + 2;
-
-      const size_t start = code.length() - offset;
-      for (size_t j = 0; j < length; ++j)
-        code += code[start + j];
-
-      ++i;
-    }
-  }
+  legacy::decompress(d + o, _code.size() - o, code, decompressedLength);
 
 #if DEBUGGER
   std::ofstream output(fileName);
@@ -251,8 +113,7 @@ void Stegano::load10(const PngData& data, Machine& m)
   m.code().initFromSource(code);
 }
 
-
-void Stegano::load(const PngData& data, Machine& m)
+bool Stegano::loadCode(Machine& m)
 {
   constexpr size_t SPRITE_SHEET_SIZE = gfx::SPRITE_SHEET_HEIGHT * gfx::SPRITE_SHEET_WIDTH / gfx::PIXEL_TO_BYTE_RATIO;
   constexpr size_t TILE_MAP_SIZE = gfx::TILE_MAP_WIDTH * gfx::TILE_MAP_HEIGHT * sizeof(sprite_index_t) / 2;
@@ -266,32 +127,123 @@ void Stegano::load(const PngData& data, Machine& m)
 
   static_assert(RAW_DATA_LENGTH == SPRITE_SHEET_SIZE + TILE_MAP_SIZE + SPRITE_FLAGS_SIZE + MUSIC_SIZE + SOUND_SIZE, "Must be equal");
 #endif
-  assert(data.length == IMAGE_WIDTH * IMAGE_HEIGHT);
-
-  auto* d = data.data;
-
-  /* first 0x4300 are read directly into the cart */
-  for (size_t i = 0; i < RAW_DATA_LENGTH; ++i)
-    m.memory().base()[i] = assembleByte(d[i]);
 
-  size_t o = RAW_DATA_LENGTH;
-  std::array<uint8_t, MAGIC_LENGTH> magic;
+  if (_code.size() != IMAGE_WIDTH * IMAGE_HEIGHT - RAW_DATA_LENGTH)
+    return false;
 
   /* two different magic numbers according to version */
+  std::array<uint8_t, MAGIC_LENGTH> magic;
   std::array<uint8_t, MAGIC_LENGTH> expected = { { ':', 'c', ':', '\0' } };
   std::array<uint8_t, MAGIC_LENGTH> expected2 = { { '\0', 'p', 'x', 'a' } };
 
   /* read magic code heaader */
-  for (size_t i = 0; i < magic.size(); ++i)
-    magic[i] = assembleByte(d[o++]);
+  std::copy(_code.begin(), _code.begin() + MAGIC_LENGTH, magic.begin());
+
+  /* cartridge data as the file has it, before the code gets a chance to change it */
+  m.memory().backupCartridge();
 
   /* use different algorithms according to cartridge version */
   if (magic == expected)
-    load10(data, m);
+    load10(m);
   else if (magic == expected2)
-    load20(data, m);
+    load20(m);
+  else
+    return false;
+
+  return true;
+}
+
+void Stegano::load(const PngData& data, Machine& m)
+{
+  assert(data.length == IMAGE_WIDTH * IMAGE_HEIGHT);
+
+  /* first 0x4300 are read directly into the cart */
+  assemble(data.data, RAW_DATA_LENGTH, m.memory().base());
+
+  _code.resize(IMAGE_WIDTH * IMAGE_HEIGHT - RAW_DATA_LENGTH);
+  assemble(data.data + RAW_DATA_LENGTH, _code.size(), _code.data());
+
+  bool valid = loadCode(m);
+  assert(valid);
+  (void)valid;
+}
+
+bool Stegano::load(const uint8_t* png, size_t length, Machine& m)
+{
+  _code.assign(IMAGE_WIDTH * IMAGE_HEIGHT - RAW_DATA_LENGTH, 0);
+
+  std::pair<Stegano*, Machine*> data = { this, &m };
+  if (Platform::loadPNGRows(png, length, &Stegano::assembleRow, &data) != 0)
+    return false;
+
+  return loadCode(m);
+}
+
+bool Stegano::encode(const uint8_t* rom, const std::string& code, Format format, std::vector<uint8_t>& cart)
+{
+  if (code.size() > 0xffff)
+    return false;
+
+  std::vector<uint8_t> compressed;
+  std::array<uint8_t, MAGIC_LENGTH> magic;
+
+  if (format == Format::PXA)
+  {
+    pxa::compress(code.data(), code.size(), compressed);
+    magic = { { '\0', 'p', 'x', 'a' } };
+  }
   else
-    assert(false);
+  {
+    legacy::compress(code.data(), code.size(), compressed);
+    magic = { { ':', 'c', ':', '\0' } };
+  }
+
+  const size_t total = HEADER_20_LENGTH + compressed.size();
+  if (RAW_DATA_LENGTH + total > CART_LENGTH)
+    return false;
+
+  cart.assign(IMAGE_WIDTH * IMAGE_HEIGHT, 0);
+  std::copy(rom, rom + RAW_DATA_LENGTH, cart.begin());
+
+  auto o = cart.begin() + RAW_DATA_LENGTH;
+  o = std::copy(magic.begin(), magic.end(), o);
+  *o++ = uint8_t(code.size() >> 8);
+  *o++ = uint8_t(code.size());
 
+  /* compressed length including the header for PXA, zero for the old format */
+  *o++ = format == Format::PXA ? uint8_t(total >> 8) : 0;
+  *o++ = format == Format::PXA ? uint8_t(total) : 0;
 
+  std::copy(compressed.begin(), compressed.end(), o);
+  return true;
+}
+
+void Stegano::embed(const std::vector<uint8_t>& cart, std::vector<uint8_t>& rgba)
+{
+  assert(cart.size() == IMAGE_WIDTH * IMAGE_HEIGHT);
+
+  /* without a picture the cart is a plain dark blue one */
+  if (rgba.size() != IMAGE_WIDTH * IMAGE_HEIGHT * 4)
+  {
+    rgba.resize(IMAGE_WIDTH * IMAGE_HEIGHT * 4);
+    for (size_t i = 0; i < rgba.size(); i += 4)
+    {
+      rgba[i] = 0x1d;
+      rgba[i + 1] = 0x2b;
+      rgba[i + 2] = 0x53;
+      rgba[i + 3] = 0xff;
+    }
+  }
+
+  /* inverse of assembleByte, from the lowest bits blue, green, red and alpha hold two bits each */
+  for (size_t i = 0; i < cart.size(); ++i)
+  {
+    uint8_t* p = &rgba[i * 4];
+    const uint8_t v = cart[i];
+
+    p[0] = uint8_t((p[0] & ~0b11) | ((v >> 4) & 0b11));
+    p[1] = uint8_t((p[1] & ~0b11) | ((v >> 2) & 0b11));
+    p[2] = uint8_t((p[2] & ~0b11) | (v & 0b11));
+    p[3] = uint8_t((p[3] & ~0b11) | ((v >> 6) & 0b11));
+  }
 }
@@ -4,6 +4,9 @@
 
 #include "vm/machine.h"
 
+#include <string>
+#include <vector>
+
 namespace retro8
 {
   namespace io
@@ -22,13 +25,29 @@ namespace retro8
       static constexpr size_t IMAGE_HEIGHT = 205;
 
     private:
-      uint8_t assembleByte(const uint32_t v);
+      /* cart bytes following the 0x4300 ones copied into memory */
+      std::vector<uint8_t> _code;
+
+      static void assemble(const uint32_t* pixels, size_t count, uint8_t* dest);
+      static void assembleRow(void* self, unsigned long y, const uint8_t* rgba, unsigned long width);
 
-      void load10(const PngData& data, Machine& dest);
-      void load20(const PngData& data, Machine& dest);
+      void load10(Machine& dest);
+      void load20(Machine& dest);
+      bool loadCode(Machine& dest);
 
     public:
+      enum class Format { LEGACY, PXA };
+
       void load(const PngData& data, Machine& dest);
+      /* decodes a PNG cart straight into the machine: hidden bytes are taken from each row as it is
+         unfiltered, false if it isn't a valid cart */
+      bool load(const uint8_t* png, size_t length, Machine& dest);
+
+      /* builds the IMAGE_WIDTH * IMAGE_HEIGHT bytes hidden in a cartridge: the 0x4300 bytes of rom
+         followed by the compressed code, false if the code doesn't fit */
+      static bool encode(const uint8_t* rom, const std::string& code, Format format, std::vector<uint8_t>& cart);
+      /* stores cart bytes in the low bits of a RGBA picture, a plain one is made if rgba is empty */
+      static void embed(const std::vector<uint8_t>& cart, std::vector<uint8_t>& rgba);
     };
   }
 }
\ No newline at end of file
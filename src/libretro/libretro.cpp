@@ -2,7 +2,9 @@
 
 #include "common.h"
 #include "vm/gfx.h"
+#include "vm/raster.h"
 
+#include "io/cache.h"
 #include "io/loader.h"
 #include "io/stegano.h"
 #include "vm/machine.h"
@@ -11,6 +13,8 @@
 #include <stdio.h>
 #include <cstdarg>
 #include <cstring>
+#include <cstdlib>
+#include <algorithm>
 
 #define LIBRETRO_LOG(x, ...) env.logger(retro_log_level::RETRO_LOG_INFO, x # __VA_ARGS__)
 
@@ -21,8 +25,11 @@ constexpr int SAMPLE_RATE = 44100;
 #else
 constexpr int SAMPLE_RATE = 11025;
 #endif
-constexpr int SAMPLES_PER_FRAME = SAMPLE_RATE / 60;
+/* highest output rate offered, at 60 frames a second */
+constexpr int MAX_SAMPLE_RATE = 48000;
+constexpr int MAX_SAMPLES_PER_FRAME = MAX_SAMPLE_RATE / 60 + 1;
 constexpr int SOUND_CHANNELS = 2;
+constexpr unsigned MAX_SCALE = 4;
 
 r8::Machine *machine;
 r8::io::Loader loader;
@@ -35,31 +42,45 @@ public:
     delete[] buffer;
   }
 
-  void draw(const r8::gfx::color_byte_t *data, r8::gfx::palette_t *palette) {
-    auto pointer = buffer;
+  void draw(r8::Memory& memory) {
+    if (!memory.isScreenDirty())
+      return;
 
-    for (size_t i = 0; i < r8::gfx::BYTES_PER_SCREEN; ++i) {
-      const r8::gfx::color_byte_t* pixels = data + i;
-      const auto rc1 = colorTable.get(palette->get((pixels)->low()));
-      const auto rc2 = colorTable.get(palette->get((pixels)->high()));
+    r8::gfx::color_lut_t<pixel_t> lut;
+    r8::gfx::buildColorLut(colorTable, *memory.paletteAt(r8::gfx::SCREEN_PALETTE_INDEX), lut);
 
-      *(pointer) = rc1;
-      *((pointer)+1) = rc2;
-      (pointer) += 2;
+    /* only scanlines modified since last frame are converted, already upscaled */
+    for (r8::coord_t y = 0; y < r8::coord_t(r8::gfx::SCREEN_HEIGHT); ++y) {
+      if (memory.isScreenRowDirty(y))
+        rasterizer.rasterize(memory.screenData(0, y), buffer + y * scale * width(), r8::gfx::SCREEN_PITCH, lut, scale, width());
     }
+
+    memory.clearScreenDirty();
+  }
+
+  /* buffer always has room for the biggest scale so changing it doesn't reallocate */
+  void setScale(unsigned scale) {
+    this->scale = std::min(std::max(scale, 1U), MAX_SCALE);
   }
 
   const pixel_t *getBuffer() {
     return buffer;
   }
+
+  unsigned width() const { return r8::gfx::SCREEN_WIDTH * scale; }
+  unsigned height() const { return r8::gfx::SCREEN_HEIGHT * scale; }
+  size_t pitch() const { return width() * sizeof(pixel_t); }
+
 protected:
-  Screen(): buffer(new pixel_t[r8::gfx::SCREEN_WIDTH * r8::gfx::SCREEN_HEIGHT]) {
+  Screen(): buffer(new pixel_t[r8::gfx::SCREEN_WIDTH * r8::gfx::SCREEN_HEIGHT * MAX_SCALE * MAX_SCALE]), scale(1) {
   }
 
 protected:
   r8::gfx::ColorTable colorTable;
+  r8::gfx::Rasterizer rasterizer;
 private:
   pixel_t *buffer;
+  unsigned scale;
 };
 
 struct Screen32 : Screen<uint32_t> {
@@ -117,7 +138,13 @@ struct RetroArchEnv
 
   uint32_t frameCounter;
   uint16_t buttonState;
+  unsigned scale = 1;
   bool isRGB32;
+
+  /* frames count since the output rate was set, rates which aren't a multiple of 60 alternate lengths */
+  int32_t outputRate = SAMPLE_RATE;
+  uint64_t audioFrames = 0;
+  bool outputRateChanged = false;
 };
 
 RetroArchEnv env;
@@ -125,13 +152,85 @@ RetroArchEnv env;
 //TODO
 uint32_t Platform::getTicks() { return 0; }
 
+static const retro_variable variables[] = {
+  { "retro8_scale", "Integer upscaling; 1x|2x|3x|4x" },
+  { "retro8_gc", "Lua garbage collection; frame|incremental" },
+  { "retro8_memory_limit", "Lua memory limit; 16MB|2MB|4MB|8MB" },
+#if !defined(SF2000)
+  { "retro8_sound_rate", "Sound synthesis rate; 44100|22050|11025" },
+  { "retro8_audio_rate", "Audio output rate; 44100|48000|32000|22050|11025" },
+#else
+  { "retro8_sound_rate", "Sound synthesis rate; 11025|22050|44100" },
+  { "retro8_audio_rate", "Audio output rate; 11025|22050|32000|44100|48000" },
+#endif
+  { nullptr, nullptr }
+};
+
+/* reads core options, returns true if the output geometry changed */
+static bool updateVariables() {
+  retro_variable var = { "retro8_scale", nullptr };
+  unsigned scale = 1;
+
+  if (env.retro_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+    scale = std::min(std::max(unsigned(std::atoi(var.value)), 1U), MAX_SCALE);
+
+  const bool changed = scale != env.scale;
+  env.scale = scale;
+
+  if (screen32) screen32->setScale(scale);
+  if (screen16) screen16->setScale(scale);
+
+  /* frame collects in the time left after _draw, incremental keeps the stock Lua pacing */
+  var = { "retro8_gc", nullptr };
+  if (machine && env.retro_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+  {
+    lua::GcSettings gc = lua::Code::defaultGcSettings();
+    if (std::strcmp(var.value, "incremental") == 0)
+    {
+      gc.mode = lua::GcSettings::Mode::INCREMENTAL;
+      gc.pause = 200;
+    }
+    machine->code().setGcSettings(gc);
+  }
+
+  /* PICO-8 stops carts at 2MB, the default leaves room for bigger 64 bit objects */
+  var = { "retro8_memory_limit", nullptr };
+  if (machine && env.retro_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+    machine->code().setMemoryLimit(size_t(std::atoi(var.value)) << 20);
+
+#if SOUND_ENABLED
+  /* slow devices can synthesize at a low rate, the APU resamples to what the frontend gets */
+  int32_t rate = SAMPLE_RATE, outputRate = SAMPLE_RATE;
+
+  var = { "retro8_sound_rate", nullptr };
+  if (env.retro_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+    rate = std::atoi(var.value);
+
+  var = { "retro8_audio_rate", nullptr };
+  if (env.retro_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+    outputRate = std::min(std::atoi(var.value), MAX_SAMPLE_RATE);
+
+  if (machine)
+    machine->sound().setSampleRate(rate, outputRate);
+
+  if (outputRate != env.outputRate)
+  {
+    env.outputRate = outputRate;
+    env.audioFrames = 0;
+    env.outputRateChanged = true;
+  }
+#endif
+
+  return changed;
+}
+
 static bool tryScreen32() {
   retro_pixel_format pixelFormat = RETRO_PIXEL_FORMAT_XRGB8888;
   if (!env.retro_cb(RETRO_ENVIRONMENT_SET_PIXEL_FORMAT, &pixelFormat))
     return false;
   env.isRGB32 = true;
   screen32 = new Screen32();
-  env.logger(retro_log_level::RETRO_LOG_INFO, "Initializing XRGB8888 screen buffer of %d bytes\n", 4*r8::gfx::SCREEN_WIDTH*r8::gfx::SCREEN_HEIGHT);
+  env.logger(retro_log_level::RETRO_LOG_INFO, "Initializing XRGB8888 screen buffer of %d bytes\n", 4*r8::gfx::SCREEN_WIDTH*r8::gfx::SCREEN_HEIGHT*MAX_SCALE*MAX_SCALE);
   return true;
 }
 
@@ -141,7 +240,7 @@ static bool tryScreen16() {
     return false;
   env.isRGB32 = false;
   screen16 = new Screen16();
-  env.logger(retro_log_level::RETRO_LOG_INFO, "Initializing RGB565 screen buffer of %d bytes\n", 2*r8::gfx::SCREEN_WIDTH*r8::gfx::SCREEN_HEIGHT);
+  env.logger(retro_log_level::RETRO_LOG_INFO, "Initializing RGB565 screen buffer of %d bytes\n", 2*r8::gfx::SCREEN_WIDTH*r8::gfx::SCREEN_HEIGHT*MAX_SCALE*MAX_SCALE);
   return true;
 }
 
@@ -172,8 +271,8 @@ extern "C"
 
   void retro_init()
   {
-    audioBuffer = new int16_t[SAMPLE_RATE * 2];
-    env.logger(retro_log_level::RETRO_LOG_INFO, "Initializing audio buffer of %d bytes\n", sizeof(int16_t) * SAMPLE_RATE * 2);
+    audioBuffer = new int16_t[MAX_SAMPLES_PER_FRAME * 2];
+    env.logger(retro_log_level::RETRO_LOG_INFO, "Initializing audio buffer of %d bytes\n", sizeof(int16_t) * MAX_SAMPLES_PER_FRAME * 2);
   }
 
   void retro_deinit()
@@ -198,11 +297,11 @@ extern "C"
   void retro_get_system_av_info(retro_system_av_info* info)
   {
     info->timing.fps = 60.0f;
-    info->timing.sample_rate = SAMPLE_RATE;
-    info->geometry.base_width = retro8::gfx::SCREEN_WIDTH;
-    info->geometry.base_height = retro8::gfx::SCREEN_HEIGHT;
-    info->geometry.max_width = retro8::gfx::SCREEN_WIDTH;
-    info->geometry.max_height = retro8::gfx::SCREEN_HEIGHT;
+    info->timing.sample_rate = env.outputRate;
+    info->geometry.base_width = retro8::gfx::SCREEN_WIDTH * env.scale;
+    info->geometry.base_height = retro8::gfx::SCREEN_HEIGHT * env.scale;
+    info->geometry.max_width = retro8::gfx::SCREEN_WIDTH * MAX_SCALE;
+    info->geometry.max_height = retro8::gfx::SCREEN_HEIGHT * MAX_SCALE;
     info->geometry.aspect_ratio = retro8::gfx::SCREEN_WIDTH / float(retro8::gfx::SCREEN_HEIGHT);
   }
 
@@ -215,6 +314,7 @@ extern "C"
       env.logger = logger.log;
 
     e(RETRO_ENVIRONMENT_SET_INPUT_DESCRIPTORS, input_desc);
+    e(RETRO_ENVIRONMENT_SET_VARIABLES, (void*)variables);
   }
 
   void retro_set_video_refresh(retro_video_refresh_t callback) { env.video = callback; }
@@ -225,9 +325,37 @@ extern "C"
   void retro_set_controller_port_device(unsigned port, unsigned device) { /* TODO */ }
   
 
-  size_t retro_serialize_size(void) { return 0; }
-  bool retro_serialize(void *data, size_t size) { return true; }
-  bool retro_unserialize(const void *data, size_t size) { return true; }
+  size_t retro_serialize_size(void)
+  {
+    return machine ? sizeof(env.frameCounter) + machine->stateSize() : 0;
+  }
+
+  bool retro_serialize(void *data, size_t size)
+  {
+    if (!machine)
+      return false;
+
+    r8::StateWriter writer(data, size);
+    writer.write(env.frameCounter);
+    machine->saveState(writer);
+    return writer.good();
+  }
+
+  bool retro_unserialize(const void *data, size_t size)
+  {
+    if (!machine)
+      return false;
+
+    r8::StateReader reader(data, size);
+    uint32_t frameCounter = 0;
+
+    if (!reader.read(frameCounter) || !machine->loadState(reader))
+      return false;
+
+    env.frameCounter = frameCounter;
+    return true;
+  }
+
   void retro_cheat_reset(void) { }
   void retro_cheat_set(unsigned index, bool enabled, const char *code) { }
   unsigned retro_get_region(void) { return 0; }
@@ -238,6 +366,9 @@ extern "C"
   bool retro_load_game(const retro_game_info* info)
   {
     machine = new r8::Machine();
+    /* core options go first so that the memory limit and the collector settings already apply while
+       the cart is compiled and runs its top level code and _init */
+    updateVariables();
     machine->font().load();
     machine->code().loadAPI();
     input.setMachine(machine);
@@ -250,31 +381,38 @@ extern "C"
 
       env.logger(RETRO_LOG_INFO, "[Retro8] Loading %s\n", info->path);
 
+      /* compiled carts are cached in the save directory */
+      const char* saveDirectory = nullptr;
+      if (!env.retro_cb(RETRO_ENVIRONMENT_GET_SAVE_DIRECTORY, &saveDirectory))
+        saveDirectory = nullptr;
+
+      const uint64_t cacheKey = r8::io::Cache::keyFor(info->data, info->size);
+      machine->code().keepBytecode(saveDirectory != nullptr);
 
-      if (std::memcmp(bdata, "\x89PNG", 4) == 0)
+      if (saveDirectory && r8::io::Cache(saveDirectory).load(cacheKey, *machine))
+      {
+        env.logger(RETRO_LOG_INFO, "[Retro8] Game loaded from cache.\n");
+      }
+      else if (std::memcmp(bdata, "\x89PNG", 4) == 0)
       {
         env.logger(RETRO_LOG_INFO, "[Retro8] Game is in PNG format, decoding it.\n");
 
-        std::vector<uint8_t> out;
-        unsigned long width, height;
-        int result = Platform::loadPNG(out, width, height, (uint8_t*)bdata, info->size, true);
-        assert(result == 0);
         r8::io::Stegano stegano;
-        uint32_t *buf = new uint32_t[out.size() / 4];
-        for (int i = 0; i < out.size() / 4; i++) {
-          buf[i] = out[4 * i] | (out[4 * i + 1] << 8) | (out[4 * i + 2] << 16) | (out[4 * i + 3] << 24);
+        if (!stegano.load(static_cast<const uint8_t*>(info->data), info->size, *machine))
+        {
+          env.logger(RETRO_LOG_ERROR, "[Retro8] Invalid PNG cartridge.\n");
+          return false;
         }
-        r8::io::PngData pngData = { buf, NULL, out.size() / 4 };
-        stegano.load(pngData, *machine);
-        delete[] buf;
       }
       else
       {
-        //TODO: not efficient since it's copied and it's not checking for '\0'
-        std::string raw(bdata);
-        loader.loadRaw(raw, *machine);
+        loader.loadRaw(bdata, info->size, *machine);
       }
 
+      if (saveDirectory && !machine->code().bytecode().empty())
+        r8::io::Cache(saveDirectory).store(cacheKey, *machine);
+      machine->code().keepBytecode(false);
+
       machine->memory().backupCartridge();
 
       if (machine->code().hasInit())
@@ -304,6 +442,17 @@ extern "C"
 	  return false;
 	}
 
+      if (screen32) screen32->setScale(env.scale);
+      if (screen16) screen16->setScale(env.scale);
+      /* frontend asks for the timing once the game is loaded */
+      env.outputRateChanged = false;
+
+      /* Lua heap is restored in place so snapshots are tied to the running instance, they can't be moved to
+         another one which rules out netplay and run-ahead with a second instance */
+      uint64_t quirks = RETRO_SERIALIZATION_QUIRK_INCOMPLETE | RETRO_SERIALIZATION_QUIRK_CORE_VARIABLE_SIZE | RETRO_SERIALIZATION_QUIRK_SINGLE_SESSION |
+        RETRO_SERIALIZATION_QUIRK_ENDIAN_DEPENDENT | RETRO_SERIALIZATION_QUIRK_PLATFORM_DEPENDENT;
+      env.retro_cb(RETRO_ENVIRONMENT_SET_SERIALIZATION_QUIRKS, &quirks);
+
       return true;
     }
 
@@ -320,50 +469,67 @@ extern "C"
     screen16 = NULL;
     screen32 = NULL;
     delete machine;
+    machine = NULL;
   }
 
   void retro_run()
   {
+    bool updated = false;
+    if (env.retro_cb(RETRO_ENVIRONMENT_GET_VARIABLE_UPDATE, &updated) && updated && updateVariables())
+    {
+      retro_game_geometry geometry;
+      geometry.base_width = r8::gfx::SCREEN_WIDTH * env.scale;
+      geometry.base_height = r8::gfx::SCREEN_HEIGHT * env.scale;
+      geometry.max_width = r8::gfx::SCREEN_WIDTH * MAX_SCALE;
+      geometry.max_height = r8::gfx::SCREEN_HEIGHT * MAX_SCALE;
+      geometry.aspect_ratio = r8::gfx::SCREEN_WIDTH / float(r8::gfx::SCREEN_HEIGHT);
+      env.retro_cb(RETRO_ENVIRONMENT_SET_GEOMETRY, &geometry);
+
+      /* whole buffer has to be converted again at the new size */
+      machine->memory().markScreenDirty();
+    }
+
+    if (env.outputRateChanged)
+    {
+      retro_system_av_info info;
+      retro_get_system_av_info(&info);
+      env.retro_cb(RETRO_ENVIRONMENT_SET_SYSTEM_AV_INFO, &info);
+      env.outputRateChanged = false;
+    }
+
     /* if code is at 60fps or every 2 frames (30fps) */
     if (machine->code().require60fps() || env.frameCounter % 2 == 0)
     {
       /* call _update and _draw of PICO-8 code */
+      machine->tick();
       machine->code().update();
       machine->code().draw();
 
       /* rasterize screen memory to ARGB framebuffer */
-      auto* data = machine->memory().screenData();
-      auto* screenPalette = machine->memory().paletteAt(retro8::gfx::SCREEN_PALETTE_INDEX);
-
       if (env.isRGB32)
-	screen32->draw(data, screenPalette);
+	screen32->draw(machine->memory());
       else
-	screen16->draw(data, screenPalette);
+	screen16->draw(machine->memory());
 
       input.manageKeyRepeat();
     }
 
     if (env.isRGB32)
-      env.video(screen32->getBuffer(), r8::gfx::SCREEN_WIDTH, r8::gfx::SCREEN_HEIGHT, r8::gfx::SCREEN_WIDTH * sizeof(uint32_t));
+      env.video(screen32->getBuffer(), screen32->width(), screen32->height(), screen32->pitch());
     else
-      env.video(screen16->getBuffer(), r8::gfx::SCREEN_WIDTH, r8::gfx::SCREEN_HEIGHT, r8::gfx::SCREEN_WIDTH * sizeof(uint16_t));
+      env.video(screen16->getBuffer(), screen16->width(), screen16->height(), screen16->pitch());
     ++env.frameCounter;
 
+    const size_t samples = size_t(env.outputRate * (env.audioFrames + 1) / 60 - env.outputRate * env.audioFrames / 60);
+    ++env.audioFrames;
+
 #if SOUND_ENABLED
-    machine->sound().renderSounds(audioBuffer, SAMPLES_PER_FRAME);
-    
-    /* duplicate channels */
-    auto* audioBuffer2 = audioBuffer + SAMPLE_RATE;
-    for (size_t i = 0; i < SAMPLES_PER_FRAME; ++i)
-    {
-      audioBuffer2[2*i] = audioBuffer[i];
-      audioBuffer2[2*i + 1] = audioBuffer[i];
-    }
-    
-    env.audioBatch(audioBuffer2, SAMPLES_PER_FRAME);
+    /* mixer writes interleaved stereo frames straight into the buffer handed to the frontend */
+    machine->sound().renderSounds(audioBuffer, samples);
+    env.audioBatch(audioBuffer, samples);
 #else
-    memset(audioBuffer, 0, sizeof(audioBuffer[0]) * 2 * SAMPLES_PER_FRAME);
-    env.audioBatch(audioBuffer, SAMPLES_PER_FRAME);
+    memset(audioBuffer, 0, sizeof(audioBuffer[0]) * 2 * samples);
+    env.audioBatch(audioBuffer, samples);
 #endif
 
     /* manage input */
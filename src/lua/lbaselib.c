@@ -183,7 +183,7 @@ static int luaB_collectgarbage (lua_State *L) {
   switch (o) {
     case LUA_GCCOUNT: {
       int b = lua_gc(L, LUA_GCCOUNTB, 0);
-      lua_pushnumber(L, (lua_Number)res + ((lua_Number)b/1024));
+      lua_pushnumber(L, lua_uac2number((LUAI_UACNUMBER)res + ((LUAI_UACNUMBER)b/1024)));
       return 1;
     }
     case LUA_GCSTEP: case LUA_GCISRUNNING: {
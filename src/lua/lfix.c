@@ -0,0 +1,61 @@
+/*
+** 16.16 fixed point numbers
+** See Copyright Notice in lua.h
+*/
+
+#define lfix_c
+#define LUA_CORE
+
+#include "lprefix.h"
+
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "lua.h"
+
+#if defined(LUA_FIXED_POINT)
+
+
+lfix_t lfix_pow (lfix_t a, lfix_t b) {
+  return lfix_fromdouble(pow(lfix_todouble(a), lfix_todouble(b)));
+}
+
+
+/*
+** Numerals are parsed as reals and rounded, values outside of the
+** range wrap around as integers do (so that '0xffff.ffff' is '-0x0.0001').
+*/
+lfix_t lfix_str2number (const char *s, char **endptr) {
+  double d = strtod(s, endptr);
+  d -= floor(d / 65536.0 + 0.5) * 65536.0;
+  return lfix_fromdouble(d);
+}
+
+
+/*
+** Writes at most 4 decimals like PICO-8 'tostr', without trailing
+** zeros. Rounding is done on integers so that it is exact.
+*/
+int lfix_number2str (char *buff, size_t sz, lfix_t x) {
+  uint32_t u = x < 0 ? 0u - (uint32_t)x : (uint32_t)x;
+  uint64_t scaled = ((uint64_t)u * 10000 + (LFIX_ONE / 2)) >> LFIX_BITS;
+  const char *sign = (x < 0 && scaled != 0) ? "-" : "";
+  unsigned int ipart, fpart;
+  int digits = 4;
+  if (u <= (uint32_t)LFIX_MAX && scaled > 327679999)  /* +/-0x7fff.ffff must not round up */
+    scaled = 327679999;
+  ipart = (unsigned int)(scaled / 10000);
+  fpart = (unsigned int)(scaled % 10000);
+  if (fpart == 0)
+    return snprintf(buff, sz, "%s%u", sign, ipart);
+  while (fpart % 10 == 0) {
+    fpart /= 10;
+    digits--;
+  }
+  return snprintf(buff, sz, "%s%u.%0*u", sign, ipart, digits, fpart);
+}
+
+
+#endif
@@ -0,0 +1,91 @@
+/*
+** 16.16 fixed point numbers
+** Used as 'lua_Number' when LUA_FIXED_POINT is defined, they follow
+** PICO-8 semantics: arithmetic wraps around and never raises errors.
+*/
+
+#ifndef lfix_h
+#define lfix_h
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+typedef int32_t lfix_t;
+
+#define LFIX_BITS	16
+#define LFIX_ONE	((lfix_t)1 << LFIX_BITS)
+#define LFIX_MAX	((lfix_t)0x7fffffff)
+#define LFIX_MIN	(-LFIX_MAX - 1)
+
+/* limits used through 'l_mathlim' */
+#define LFIX_MANT_DIG	(32 - LFIX_BITS)
+#define LFIX_MAX_10_EXP	5
+
+
+/*
+** Conversions. Integers wrap around to 16 bits, reals are rounded to
+** the nearest value and truncation to integers rounds towards minus
+** infinity as 'flr' does.
+*/
+#define lfix_fromint(i)	((lfix_t)((uint32_t)(i) << LFIX_BITS))
+#define lfix_toint(x)	((x) >> LFIX_BITS)
+#define lfix_floor(x)	((lfix_t)((uint32_t)(x) & ~(uint32_t)(LFIX_ONE - 1)))
+
+static inline lfix_t lfix_fromdouble (double d) {
+  return (lfix_t)(uint32_t)(int64_t)floor(d * LFIX_ONE + 0.5);
+}
+
+static inline double lfix_todouble (lfix_t x) {
+  return (double)x / LFIX_ONE;
+}
+
+
+/*
+** Primitive operations, computed on unsigned values so that overflows
+** wrap around without undefined behaviour.
+*/
+#define lfix_add(a,b)	((lfix_t)((uint32_t)(a) + (uint32_t)(b)))
+#define lfix_sub(a,b)	((lfix_t)((uint32_t)(a) - (uint32_t)(b)))
+#define lfix_unm(a)	((lfix_t)(0u - (uint32_t)(a)))
+#define lfix_mul(a,b)	((lfix_t)(uint32_t)(((int64_t)(a) * (b)) >> LFIX_BITS))
+
+/* division by zero or overflowing the range saturates to +/-0x7fff.ffff */
+static inline lfix_t lfix_div (lfix_t a, lfix_t b) {
+  int64_t q;
+  if (b == 0)
+    return a >= 0 ? LFIX_MAX : -LFIX_MAX;
+  q = ((int64_t)a * LFIX_ONE) / b;
+  if (q > LFIX_MAX) return LFIX_MAX;
+  else if (q < -LFIX_MAX) return -LFIX_MAX;
+  return (lfix_t)q;
+}
+
+/* floored modulo, the result has the sign of the divisor; 'a % 0' is 0 */
+static inline lfix_t lfix_mod (lfix_t a, lfix_t b) {
+  int64_t m;
+  if (b == 0)
+    return 0;
+  m = (int64_t)a % b;
+  if (m != 0 && (m ^ b) < 0) m += b;
+  return (lfix_t)m;
+}
+
+/* shifts of the raw bits, '>>' is arithmetic like PICO-8 'shr' */
+static inline lfix_t lfix_shl (lfix_t x, int n) {
+  if (n < 0) return n <= -32 ? (x < 0 ? -1 : 0) : x >> -n;
+  return n >= 32 ? 0 : (lfix_t)((uint32_t)x << n);
+}
+
+static inline lfix_t lfix_shr (lfix_t x, int n) {
+  if (n < 0) return n <= -32 ? 0 : (lfix_t)((uint32_t)x << -n);
+  return n >= 32 ? (x < 0 ? -1 : 0) : x >> n;
+}
+
+
+LUAI_FUNC lfix_t lfix_pow (lfix_t a, lfix_t b);
+LUAI_FUNC lfix_t lfix_str2number (const char *s, char **endptr);
+LUAI_FUNC int lfix_number2str (char *buff, size_t sz, lfix_t x);
+
+#endif
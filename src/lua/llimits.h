@@ -112,7 +112,11 @@ typedef LUAI_UACINT l_uacInt;
 
 #define cast_void(i)	cast(void, (i))
 #define cast_byte(i)	cast(lu_byte, (i))
+#if defined(LUA_FIXED_POINT)
+#define cast_num(i)	lfix_fromint(i)
+#else
 #define cast_num(i)	cast(lua_Number, (i))
+#endif
 #define cast_int(i)	cast(int, (i))
 #define cast_uchar(i)	cast(unsigned char, (i))
 
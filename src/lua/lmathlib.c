@@ -18,6 +18,9 @@
 #include "lauxlib.h"
 #include "lualib.h"
 
+/* PICO-8 math functions are bound by the machine, with fixed point numbers this library is left out */
+#if !defined(LUA_FIXED_POINT)
+
 
 #undef PI
 #define PI	(l_mathop(3.141592653589793238462643383279502884))
@@ -408,3 +411,4 @@ LUAMOD_API int luaopen_math (lua_State *L) {
   return 1;
 }
 
+#endif
@@ -100,6 +100,25 @@ static lua_Integer intarith (lua_State *L, int op, lua_Integer v1,
 }
 
 
+#if defined(LUA_FIXED_POINT)
+/*
+** bitwise operations work on the raw bits of fixed point numbers,
+** shift amounts are truncated to integers
+*/
+static lua_Number fixbitarith (int op, lua_Number v1, lua_Number v2) {
+  switch (op) {
+    case LUA_OPBAND: return v1 & v2;
+    case LUA_OPBOR: return v1 | v2;
+    case LUA_OPBXOR: return v1 ^ v2;
+    case LUA_OPSHL: return lfix_shl(v1, lfix_toint(v2));
+    case LUA_OPSHR: return lfix_shr(v1, lfix_toint(v2));
+    case LUA_OPBNOT: return ~v1;
+    default: lua_assert(0); return 0;
+  }
+}
+#endif
+
+
 static lua_Number numarith (lua_State *L, int op, lua_Number v1,
                                                   lua_Number v2) {
   switch (op) {
@@ -126,11 +145,19 @@ void luaO_arith (lua_State *L, int op, const TValue *p1, const TValue *p2,
     case LUA_OPBAND: case LUA_OPBOR: case LUA_OPBXOR:
     case LUA_OPSHL: case LUA_OPSHR:
     case LUA_OPBNOT: {  /* operate only on integers */
+#if defined(LUA_FIXED_POINT)
+      lua_Number n1; lua_Number n2;
+      if (tonumber(p1, &n1) && tonumber(p2, &n2)) {
+        setfltvalue(res, fixbitarith(op, n1, n2));
+        return;
+      }
+#else
       lua_Integer i1; lua_Integer i2;
       if (tointeger(p1, &i1) && tointeger(p2, &i2)) {
         setivalue(res, intarith(L, op, i1, i2));
         return;
       }
+#endif
       else break;  /* go to the end */
     }
     case LUA_OPDIV: case LUA_OPPOW: {  /* operate only on floats */
@@ -242,6 +269,33 @@ static lua_Number lua_strx2number (const char *s, char **endptr) {
 #endif
 /* }====================================================== */
 
+#if defined(LUA_FIXED_POINT)
+/* binary digits are the raw bits, 16 fractional digits at most are kept */
+lua_Number lua_strb2number(const char* s, char** endptr)
+{
+  lua_Unsigned bits = 0;
+  int digits = 0;
+
+  if (s[0] != '0' || (s[1] != 'b' && s[1] != 'B'))
+    return 0;
+
+  s += 2;
+
+  for (; *s == '0' || *s == '1'; ++s)
+    bits = (bits << 1) | (*s == '1');
+  bits <<= LFIX_BITS;
+
+  if (*s == '.')
+  {
+    for (++s; *s == '0' || *s == '1'; ++s, ++digits)
+      if (*s == '1' && digits < LFIX_BITS)
+        bits |= (lua_Unsigned)1 << (LFIX_BITS - 1 - digits);
+  }
+
+  *endptr = cast(char*, s);
+  return l_castU2S(bits);
+}
+#else
 lua_Number lua_strb2number(const char* s, char** endptr)
 {
   if (s[0] != '0' || (s[1] != 'b' && s[1] != 'B'))
@@ -282,6 +336,7 @@ lua_Number lua_strb2number(const char* s, char** endptr)
   *endptr = cast(char*, s);
   return result;
 }
+#endif
 
 /* maximum length of a numeral */
 #if !defined (L_MAXLENNUM)
@@ -383,7 +438,11 @@ size_t luaO_str2num (const char *s, TValue *o) {
   lua_Integer i; lua_Number n;
   const char *e;
   if ((e = l_str2int(s, &i)) != NULL) {  /* try as an integer */
+#if defined(LUA_FIXED_POINT)
+    setfltvalue(o, cast_num(i));  /* PICO-8 numerals are all fixed point */
+#else
     setivalue(o, i);
+#endif
   }
   else if ((e = l_str2d(s, &n)) != NULL) {  /* else try as a float */
     setfltvalue(o, n);
@@ -478,7 +537,7 @@ const char *luaO_pushvfstring (lua_State *L, const char *fmt, va_list argp) {
         goto top2str;
       }
       case 'f': {  /* a 'lua_Number' */
-        setfltvalue(L->top, cast_num(va_arg(argp, l_uacNumber)));
+        setfltvalue(L->top, lua_uac2number(va_arg(argp, l_uacNumber)));
       top2str:  /* convert the top element to a string */
         luaD_inctop(L);
         luaO_tostring(L, L->top - 1);
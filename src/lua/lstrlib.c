@@ -1054,7 +1054,7 @@ static int str_format (lua_State *L) {
         case 'g': case 'G': {
           lua_Number n = luaL_checknumber(L, arg);
           addlenmod(form, LUA_NUMBER_FRMLEN);
-          nb = l_sprintf(buff, MAX_ITEM, form, (LUAI_UACNUMBER)n);
+          nb = l_sprintf(buff, MAX_ITEM, form, lua_number2uac(n));
           break;
         }
         case 'q': {
@@ -1365,8 +1365,8 @@ static int str_pack (lua_State *L) {
         volatile Ftypes u;
         char *buff = luaL_prepbuffsize(&b, size);
         lua_Number n = luaL_checknumber(L, arg);  /* get argument */
-        if (size == sizeof(u.f)) u.f = (float)n;  /* copy it into 'u' */
-        else if (size == sizeof(u.d)) u.d = (double)n;
+        if (size == sizeof(u.f)) u.f = (float)lua_number2uac(n);  /* copy it into 'u' */
+        else if (size == sizeof(u.d)) u.d = (double)lua_number2uac(n);
         else u.n = n;
         /* move 'u' to final result, correcting endianness if needed */
         copywithendian(buff, u.buff, size, h.islittle);
@@ -1503,8 +1503,8 @@ static int str_unpack (lua_State *L) {
         volatile Ftypes u;
         lua_Number num;
         copywithendian(u.buff, data + pos, size, h.islittle);
-        if (size == sizeof(u.f)) num = (lua_Number)u.f;
-        else if (size == sizeof(u.d)) num = (lua_Number)u.d;
+        if (size == sizeof(u.f)) num = lua_uac2number(u.f);
+        else if (size == sizeof(u.d)) num = lua_uac2number(u.d);
         else num = u.n;
         lua_pushnumber(L, num);
         break;
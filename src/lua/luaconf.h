@@ -114,8 +114,24 @@
 #define LUA_FLOAT_FLOAT		1
 #define LUA_FLOAT_DOUBLE	2
 #define LUA_FLOAT_LONGDOUBLE	3
+#define LUA_FLOAT_FIXED		4
 
-#if defined(LUA_32BITS)		/* { */
+/*
+@@ LUA_FIXED_POINT makes floats 16.16 fixed point numbers with PICO-8
+** semantics (see 'lfix.h'), it is enabled by the R8_FIXED_POINT option.
+*/
+#if defined(R8_FIXED_POINT) && R8_FIXED_POINT
+#define LUA_FIXED_POINT
+#endif
+
+#if defined(LUA_FIXED_POINT)	/* { */
+/*
+** 32-bit integers and 16.16 fixed point
+*/
+#define LUA_INT_TYPE	LUA_INT_INT
+#define LUA_FLOAT_TYPE	LUA_FLOAT_FIXED
+
+#elif defined(LUA_32BITS)		/* }{ */
 /*
 ** 32-bit integers and 'float'
 */
@@ -434,7 +450,14 @@
 #define l_floor(x)		(l_mathop(floor)(x))
 
 #define lua_number2str(s,sz,n)  \
-	l_sprintf((s), sz, LUA_NUMBER_FMT, (LUAI_UACNUMBER)(n))
+	l_sprintf((s), sz, LUA_NUMBER_FMT, lua_number2uac(n))
+
+/*
+@@ lua_number2uac converts a float to its default argument promotion
+** (to pass it to printf-like functions), lua_uac2number converts back.
+*/
+#define lua_number2uac(n)	((LUAI_UACNUMBER)(n))
+#define lua_uac2number(u)	((LUA_NUMBER)(u))
 
 /*
 @@ lua_numbertointeger converts a float number to an integer, or
@@ -498,6 +521,23 @@
 
 #define lua_str2number(s,p)	strtod((s), (p))
 
+#elif LUA_FLOAT_TYPE == LUA_FLOAT_FIXED	/* }{ 16.16 fixed point */
+
+#include "lfix.h"
+
+#define LUA_NUMBER	lfix_t
+
+#define l_mathlim(n)		(LFIX_##n)
+
+#define LUAI_UACNUMBER	double
+
+#define LUA_NUMBER_FRMLEN	""
+#define LUA_NUMBER_FMT		"%.4f"
+
+#define l_mathop(op)		lfix_##op
+
+#define lua_str2number(s,p)	lfix_str2number((s), (p))
+
 #else						/* }{ */
 
 #error "numeric float type not defined"
@@ -635,7 +675,7 @@
 */
 #if !defined(LUA_USE_C89)
 #define lua_number2strx(L,b,sz,f,n)  \
-	((void)L, l_sprintf(b,sz,f,(LUAI_UACNUMBER)(n)))
+	((void)L, l_sprintf(b,sz,f,lua_number2uac(n)))
 #endif
 
 
@@ -645,7 +685,8 @@
 ** availability of these variants. ('math.h' is already included in
 ** all files that use these macros.)
 */
-#if defined(LUA_USE_C89) || (defined(HUGE_VAL) && !defined(HUGE_VALF))
+#if (defined(LUA_USE_C89) || (defined(HUGE_VAL) && !defined(HUGE_VALF))) && \
+    LUA_FLOAT_TYPE != LUA_FLOAT_FIXED
 #undef l_mathop  /* variants not available */
 #undef lua_str2number
 #define l_mathop(op)		(lua_Number)op  /* no variant */
@@ -653,6 +694,51 @@
 #endif
 
 
+/*
+** Fixed point floats are plain integers for the C compiler, so every
+** conversion and primitive operation over them goes through 'lfix.h'.
+*/
+#if LUA_FLOAT_TYPE == LUA_FLOAT_FIXED	/* { */
+
+#undef l_floor
+#define l_floor(x)		lfix_floor(x)
+
+#undef lua_number2str
+#define lua_number2str(s,sz,n)	lfix_number2str((s), (sz), (n))
+
+/* PICO-8 writes integral values without a '.0' */
+#define LUA_COMPAT_FLOATSTRING
+
+#undef lua_numbertointeger
+#define lua_numbertointeger(n,p)	((*(p) = (LUA_INTEGER)lfix_toint(n)), 1)
+
+#undef lua_number2uac
+#undef lua_uac2number
+#define lua_number2uac(n)	lfix_todouble(n)
+#define lua_uac2number(u)	lfix_fromdouble(u)
+
+/* integers which have an exact fixed point representation */
+#define l_intfitsf(i)		(-32768 <= (i) && (i) <= 32767)
+
+/* integral values are stored as integer keys, others hash their bits */
+#define l_hashfloat(n)		((int)((unsigned int)(n) & INT_MAX))
+
+#define luai_numadd(L,a,b)	((void)L, lfix_add(a,b))
+#define luai_numsub(L,a,b)	((void)L, lfix_sub(a,b))
+#define luai_nummul(L,a,b)	((void)L, lfix_mul(a,b))
+#define luai_numdiv(L,a,b)	((void)L, lfix_div(a,b))
+#define luai_numidiv(L,a,b)	((void)L, lfix_floor(lfix_div(a,b)))
+#define luai_nummod(L,a,b,m)	{ (void)L; (m) = lfix_mod(a,b); }
+#define luai_numpow(L,a,b)	((void)L, lfix_pow(a,b))
+#define luai_numunm(L,a)	((void)L, lfix_unm(a))
+#define luai_numeq(a,b)		((a)==(b))
+#define luai_numlt(a,b)		((a)<(b))
+#define luai_numle(a,b)		((a)<=(b))
+#define luai_numisnan(a)	0
+
+#endif					/* } */
+
+
 /*
 @@ LUA_KCONTEXT is the type of the context ('ctx') for continuation
 ** functions.  It must be a numerical type; Lua will use 'intptr_t' if
@@ -100,7 +100,7 @@ int luaV_tointeger (const TValue *obj, lua_Integer *p, int mode) {
     if (n != f) {  /* not an integral value? */
       if (mode == 0) return 0;  /* fails if mode demands integral value */
       else if (mode > 1)  /* needs ceil? */
-        f += 1;  /* convert floor to ceil (remember: n != f) */
+        f += cast_num(1);  /* convert floor to ceil (remember: n != f) */
     }
     return lua_numbertointeger(f, p);
   }
@@ -279,7 +279,10 @@ static int l_strcmp (const TString *ls, const TString *rs) {
 ** in false.
 */
 static int LTintfloat (lua_Integer i, lua_Number f) {
-#if defined(l_intfitsf)
+#if defined(LUA_FIXED_POINT)
+  if (!l_intfitsf(i))  /* beyond the range of fixed point numbers? */
+    return (i < 0);
+#elif defined(l_intfitsf)
   if (!l_intfitsf(i)) {
     if (f >= -cast_num(LUA_MININTEGER))  /* -minint == maxint + 1 */
       return 1;  /* f >= maxint + 1 > i */
@@ -298,7 +301,10 @@ static int LTintfloat (lua_Integer i, lua_Number f) {
 ** See comments on previous function.
 */
 static int LEintfloat (lua_Integer i, lua_Number f) {
-#if defined(l_intfitsf)
+#if defined(LUA_FIXED_POINT)
+  if (!l_intfitsf(i))  /* beyond the range of fixed point numbers? */
+    return (i < 0);
+#elif defined(l_intfitsf)
   if (!l_intfitsf(i)) {
     if (f >= -cast_num(LUA_MININTEGER))  /* -minint == maxint + 1 */
       return 1;  /* f >= maxint + 1 > i */
@@ -746,6 +752,19 @@ void luaV_finishOp (lua_State *L) {
 
 #define Protect(x)	{ {x;}; base = ci->u.l.base; }
 
+#if defined(LUA_FIXED_POINT)
+/*
+** PICO-8 bitwise operators work on the raw bits of fixed point numbers;
+** operands other than two floats go through 'luaO_arith', which converts
+** integers and strings and falls back to metamethods.
+*/
+#define fixbitwise(op,exp) { \
+  if (ttisfloat(rb) && ttisfloat(rc)) { \
+    lua_Number nb = fltvalue(rb); lua_Number nc = fltvalue(rc); \
+    UNUSED(nc); setfltvalue(ra, exp); } \
+  else Protect(luaO_arith(L, op, rb, rc, ra)); }
+#endif
+
 #define checkGC(L,c)  \
 	{ luaC_condGC(L, L->top = (c),  /* limit of live values */ \
                          Protect(L->top = ci->top));  /* restore top */ \
@@ -941,51 +960,71 @@ void luaV_execute (lua_State *L) {
       vmcase(OP_BAND) {
         TValue *rb = RKB(i);
         TValue *rc = RKC(i);
+#if defined(LUA_FIXED_POINT)
+        fixbitwise(LUA_OPBAND, nb & nc);
+#else
         lua_Integer ib; lua_Integer ic;
         if (tointeger(rb, &ib) && tointeger(rc, &ic)) {
           setivalue(ra, intop(&, ib, ic));
         }
         else { Protect(luaT_trybinTM(L, rb, rc, ra, TM_BAND)); }
+#endif
         vmbreak;
       }
       vmcase(OP_BOR) {
         TValue *rb = RKB(i);
         TValue *rc = RKC(i);
+#if defined(LUA_FIXED_POINT)
+        fixbitwise(LUA_OPBOR, nb | nc);
+#else
         lua_Integer ib; lua_Integer ic;
         if (tointeger(rb, &ib) && tointeger(rc, &ic)) {
           setivalue(ra, intop(|, ib, ic));
         }
         else { Protect(luaT_trybinTM(L, rb, rc, ra, TM_BOR)); }
+#endif
         vmbreak;
       }
       vmcase(OP_BXOR) {
         TValue *rb = RKB(i);
         TValue *rc = RKC(i);
+#if defined(LUA_FIXED_POINT)
+        fixbitwise(LUA_OPBXOR, nb ^ nc);
+#else
         lua_Integer ib; lua_Integer ic;
         if (tointeger(rb, &ib) && tointeger(rc, &ic)) {
           setivalue(ra, intop(^, ib, ic));
         }
         else { Protect(luaT_trybinTM(L, rb, rc, ra, TM_BXOR)); }
+#endif
         vmbreak;
       }
       vmcase(OP_SHL) {
         TValue *rb = RKB(i);
         TValue *rc = RKC(i);
+#if defined(LUA_FIXED_POINT)
+        fixbitwise(LUA_OPSHL, lfix_shl(nb, lfix_toint(nc)));
+#else
         lua_Integer ib; lua_Integer ic;
         if (tointeger(rb, &ib) && tointeger(rc, &ic)) {
           setivalue(ra, luaV_shiftl(ib, ic));
         }
         else { Protect(luaT_trybinTM(L, rb, rc, ra, TM_SHL)); }
+#endif
         vmbreak;
       }
       vmcase(OP_SHR) {
         TValue *rb = RKB(i);
         TValue *rc = RKC(i);
+#if defined(LUA_FIXED_POINT)
+        fixbitwise(LUA_OPSHR, lfix_shr(nb, lfix_toint(nc)));
+#else
         lua_Integer ib; lua_Integer ic;
         if (tointeger(rb, &ib) && tointeger(rc, &ic)) {
           setivalue(ra, luaV_shiftl(ib, -ic));
         }
         else { Protect(luaT_trybinTM(L, rb, rc, ra, TM_SHR)); }
+#endif
         vmbreak;
       }
       vmcase(OP_MOD) {
@@ -1045,6 +1084,10 @@ void luaV_execute (lua_State *L) {
       }
       vmcase(OP_BNOT) {
         TValue *rb = RB(i);
+#if defined(LUA_FIXED_POINT)
+        TValue *rc = rb;
+        fixbitwise(LUA_OPBNOT, ~nb);
+#else
         lua_Integer ib;
         if (tointeger(rb, &ib)) {
           setivalue(ra, intop(^, ~l_castS2U(0), ib));
@@ -1052,6 +1095,7 @@ void luaV_execute (lua_State *L) {
         else {
           Protect(luaT_trybinTM(L, rb, rb, ra, TM_BNOT));
         }
+#endif
         vmbreak;
       }
       vmcase(OP_NOT) {
@@ -52,5 +52,10 @@ int main(int argc, char* argv[])
   ui.loop();
   ui.deinit();
 
+#if R8_PROFILER_ENABLED
+  /* profile is dumped when the code is destroyed */
+  delete machine;
+#endif
+
   return 0;
 }
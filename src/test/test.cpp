@@ -6,9 +6,18 @@
 #include "catch.hpp"
 
 #include "vm/machine.h"
+#include "vm/arena.h"
+#include "vm/raster.h"
+#include "vm/fastmath.h"
+#include "vm/wavetable.h"
+#include "io/cache.h"
+#include "io/legacy.h"
 #include "io/loader.h"
+#include "io/pxa.h"
+#include "io/stegano.h"
 #include "lua/lua.hpp"
 
+#include <random>
 #include <unordered_set>
 #include <filesystem>
 
@@ -102,6 +111,38 @@ TEST_CASE("mid")
   }
 }
 
+TEST_CASE("generated bindings")
+{
+  Machine m;
+
+  auto eval = [&m](const std::string& code) {
+    m.code().initFromSource("function _test() return " + code + " end");
+    m.code().callFunction("_test", 1);
+    /* booleans have no lua_tostring conversion */
+    std::string result = luaL_tolstring(m.code().state(), -1, nullptr);
+    lua_pop(m.code().state(), 2);
+    return result;
+  };
+
+  SECTION("fractional arguments are floored")
+  {
+    REQUIRE(eval("mget(-0.5, 0)") == "0");
+    REQUIRE(eval("peek2(0.5) == peek2(0)") == "true");
+  }
+
+  SECTION("nil is a missing optional argument")
+  {
+    REQUIRE(eval("sub('hello', 2, nil)") == "ello");
+    REQUIRE(eval("sub('hello', -3)") == "llo");
+  }
+
+  SECTION("reload reads all its arguments")
+  {
+    machine->memory().backupCartridge();
+    REQUIRE(eval("(function() poke(0x10, 7) reload(0x10, 0x10, 1) return tostr(peek(0x10) == 0) end)()") == "true");
+  }
+}
+
 TEST_CASE("bitwise")
 {
   Machine m;
@@ -132,6 +173,1061 @@ TEST_CASE("bitwise")
   REQUIRE(lua_tonumber(m.code().state(), -1) == expected);
 }
 
+TEST_CASE("rasterizer backends are bit exact with scalar path")
+{
+  std::mt19937 rnd(1234);
+
+  std::vector<color_byte_t> data(BYTES_PER_SCREEN + 3);
+  for (auto& pair : data) pair.value = rnd();
+
+  color_lut_t<uint32_t> lut32;
+  color_lut_t<uint16_t> lut16;
+  for (size_t i = 0; i < COLOR_COUNT; ++i)
+  {
+    lut32[i] = rnd();
+    lut16[i] = rnd();
+  }
+
+  auto backend = GENERATE(Rasterizer::Backend::SSSE3, Rasterizer::Backend::AVX2, Rasterizer::Backend::NEON);
+  auto length = GENERATE(size_t(1), size_t(15), size_t(16), size_t(33), SCREEN_PITCH, BYTES_PER_SCREEN);
+  auto offset = GENERATE(size_t(0), size_t(3));
+
+  if (Rasterizer::isSupported(backend))
+  {
+    Rasterizer scalar(Rasterizer::Backend::SCALAR), simd(backend);
+
+    std::vector<uint32_t> expected32(length * 2), actual32(length * 2);
+    std::vector<uint16_t> expected16(length * 2), actual16(length * 2);
+
+    scalar.rasterize(data.data() + offset, expected32.data(), length, lut32);
+    simd.rasterize(data.data() + offset, actual32.data(), length, lut32);
+    scalar.rasterize(data.data() + offset, expected16.data(), length, lut16);
+    simd.rasterize(data.data() + offset, actual16.data(), length, lut16);
+
+    REQUIRE(expected32 == actual32);
+    REQUIRE(expected16 == actual16);
+  }
+}
+
+TEST_CASE("sprite blits match drawing pixel by pixel")
+{
+  Machine m;
+  std::mt19937 rnd(7);
+
+  uint8_t* sheet = m.memory().base() + address::SPRITE_SHEET;
+  for (size_t i = 0; i < gfx::SPRITE_SHEET_HEIGHT * gfx::SPRITE_SHEET_PITCH; ++i)
+    sheet[i] = uint8_t(rnd());
+
+  gfx::color_byte_t* screen = m.memory().screenData();
+  std::vector<uint8_t> background(gfx::BYTES_PER_SCREEN), expected(gfx::BYTES_PER_SCREEN);
+  for (auto& byte : background)
+    byte = uint8_t(rnd());
+
+  const gfx::palette_t* palette = m.memory().paletteAt(gfx::DRAW_PALETTE_INDEX);
+
+  /* what the per pixel loops did: every opaque sheet pixel through pset */
+  auto reference = [&](coord_t sx, coord_t sy, coord_t w, coord_t h, coord_t x, coord_t y, bool flipX, bool flipY) {
+    for (coord_t ty = 0; ty < h; ++ty)
+      for (coord_t tx = 0; tx < w; ++tx)
+      {
+        const color_t color = m.memory().spriteSheet(sx + tx, sy + ty)->get(sx + tx);
+        if (!palette->transparent(color))
+          m.pset(x + (flipX ? w - tx - 1 : tx), y + (flipY ? h - ty - 1 : ty), color);
+      }
+  };
+
+  for (int i = 0; i < 2000; ++i)
+  {
+    /* transparent colors, remaps, clip, camera and positions across every screen edge */
+    m.memory().paletteAt(gfx::DRAW_PALETTE_INDEX)->reset();
+    for (int c = 0; c < 4; ++c)
+      m.pal(color_t(rnd() % 16), color_t(rnd() % 16), gfx::DRAW_PALETTE_INDEX);
+    m.memory().paletteAt(gfx::DRAW_PALETTE_INDEX)->transparent(color_t(rnd() % 16), true);
+    m.memory().markPaletteDirty(gfx::DRAW_PALETTE_INDEX);
+
+    const uint8_t cx0 = uint8_t(rnd() % 64), cy0 = uint8_t(rnd() % 64);
+    m.memory().clipRect()->set(cx0, cy0, uint8_t(cx0 + rnd() % 72), uint8_t(cy0 + rnd() % 72));
+    if (i % 4 == 0)
+      m.memory().clipRect()->reset();
+    m.memory().camera()->set(int16_t(int(rnd() % 33) - 16), int16_t(int(rnd() % 33) - 16));
+
+    const index_t idx = index_t(rnd() % 256);
+    const coord_t x = coord_t(rnd() % 160) - 24, y = coord_t(rnd() % 160) - 24;
+    const bool flipX = rnd() & 1, flipY = rnd() & 1;
+    const float sw = 0.5f * (1 + rnd() % 6), sh = 0.5f * (1 + rnd() % 6);
+    const coord_t w = coord_t(sw * gfx::SPRITE_WIDTH), h = coord_t(sh * gfx::SPRITE_HEIGHT);
+    const coord_t sx = coord_t(idx % 16) * gfx::SPRITE_WIDTH, sy = coord_t(idx / 16) * gfx::SPRITE_HEIGHT;
+
+    /* wider sprites continue on the same sheet row, taller ones would leave the sheet */
+    if (sy + h > coord_t(gfx::SPRITE_SHEET_HEIGHT) || sx + w > coord_t(gfx::SPRITE_SHEET_WIDTH))
+      continue;
+
+    std::memcpy(screen, background.data(), background.size());
+    reference(sx, sy, w, h, x, y, flipX, flipY);
+    std::memcpy(expected.data(), screen, expected.size());
+
+    std::memcpy(screen, background.data(), background.size());
+    m.spr(idx, x, y, sw, sh, flipX, flipY);
+    REQUIRE(std::memcmp(expected.data(), screen, expected.size()) == 0);
+
+    if (w == coord_t(gfx::SPRITE_WIDTH) && h == coord_t(gfx::SPRITE_HEIGHT) && !flipX && !flipY)
+    {
+      std::memcpy(screen, background.data(), background.size());
+      m.spr(idx, x, y);
+      REQUIRE(std::memcmp(expected.data(), screen, expected.size()) == 0);
+    }
+
+    /* sspr at 1:1 reads the same pixels, flipping is not supported by it */
+    std::memcpy(screen, background.data(), background.size());
+    reference(sx, sy, w, h, x, y, false, false);
+    std::memcpy(expected.data(), screen, expected.size());
+
+    std::memcpy(screen, background.data(), background.size());
+    m.sspr(sx, sy, w, h, x, y, w, h, flipX, flipY);
+    REQUIRE(std::memcmp(expected.data(), screen, expected.size()) == 0);
+  }
+}
+
+TEST_CASE("pair remap follows the draw palette")
+{
+  std::mt19937 rnd(11);
+  gfx::palette_t palette;
+  gfx::pair_remap_t remap;
+
+  for (int i = 0; i < 100; ++i)
+  {
+    palette.reset();
+    for (size_t c = 0; c < gfx::COLOR_COUNT; ++c)
+    {
+      palette.set(color_t(c), color_t(rnd() % 16));
+      palette.transparent(color_t(c), rnd() % 4 == 0);
+    }
+    remap.build(palette);
+
+    for (int v = 0; v < 256; ++v)
+    {
+      const gfx::color_byte_t pair = gfx::color_byte_t(color_t(v & 0x0f), color_t(v >> 4));
+      const auto& entry = remap[pair];
+
+      /* transparent nibbles are flagged, the others hold the remapped color */
+      REQUIRE(((entry.transparency & gfx::pair_remap_t::LOW_TRANSPARENT) != 0) == palette.transparent(pair.low()));
+      REQUIRE(((entry.transparency & gfx::pair_remap_t::HIGH_TRANSPARENT) != 0) == palette.transparent(pair.high()));
+      if (!palette.transparent(pair.low()))
+        REQUIRE(entry.value.low() == palette.get(pair.low()));
+      if (!palette.transparent(pair.high()))
+        REQUIRE(entry.value.high() == palette.get(pair.high()));
+    }
+
+    for (size_t c = 0; c < gfx::COLOR_COUNT; ++c)
+    {
+      REQUIRE(remap.get(color_t(c)) == palette.get(color_t(c)));
+      REQUIRE(remap.transparent(color_t(c)) == palette.transparent(color_t(c)));
+    }
+  }
+
+  SECTION("cached remap is rebuilt when palette memory changes")
+  {
+    Machine m;
+    REQUIRE(m.memory().drawRemap().get(color_t(3)) == color_t(3));
+
+    m.pal(color_t(3), color_t(9), gfx::DRAW_PALETTE_INDEX);
+    REQUIRE(m.memory().drawRemap().get(color_t(3)) == color_t(9));
+
+    /* poke straight into the palette, transparency is bit 4 of each entry */
+    m.memory().base()[address::PALETTES + 3] = 0x19;
+    m.memory().markDirty(address::PALETTES + 3, 1);
+    REQUIRE(m.memory().drawRemap().transparent(color_t(3)));
+  }
+}
+
+TEST_CASE("dirty rows cover every changed scanline")
+{
+  Machine m;
+  m.font().load();
+  std::mt19937 rnd(5);
+
+  uint8_t* sheet = m.memory().base() + address::SPRITE_SHEET;
+  for (size_t i = 0; i < gfx::SPRITE_SHEET_HEIGHT * gfx::SPRITE_SHEET_PITCH; ++i)
+    sheet[i] = uint8_t(rnd());
+
+  gfx::color_byte_t* screen = m.memory().screenData();
+  std::vector<uint8_t> before(gfx::BYTES_PER_SCREEN);
+
+  const size_t ROWS = gfx::SCREEN_HEIGHT;
+  auto changedRows = [&]() {
+    std::vector<bool> rows(ROWS);
+    for (size_t y = 0; y < ROWS; ++y)
+      rows[y] = std::memcmp(before.data() + y * gfx::SCREEN_PITCH, reinterpret_cast<uint8_t*>(screen) + y * gfx::SCREEN_PITCH, gfx::SCREEN_PITCH) != 0;
+    return rows;
+  };
+
+  /* exact draws mark the rows they change and nothing else, the others may mark more */
+  auto check = [&](const std::function<void()>& draw, bool exact) {
+    /* colors drawn are never 0 so every pixel drawn is a change */
+    std::memset(screen, 0, gfx::BYTES_PER_SCREEN);
+    std::memcpy(before.data(), screen, before.size());
+    m.memory().clearScreenDirty();
+    draw();
+
+    const std::vector<bool> changed = changedRows();
+    for (coord_t y = 0; y < coord_t(ROWS); ++y)
+    {
+      if (changed[y])
+        REQUIRE(m.memory().isScreenRowDirty(y));
+      else if (exact)
+        REQUIRE(!m.memory().isScreenRowDirty(y));
+    }
+  };
+
+  SECTION("cls marks the whole screen")
+  {
+    m.memory().clearScreenDirty();
+    m.cls(color_t(0));
+    for (coord_t y = 0; y < coord_t(ROWS); ++y)
+      REQUIRE(m.memory().isScreenRowDirty(y));
+  }
+
+  SECTION("primitives with camera and clip")
+  {
+    for (int i = 0; i < 500; ++i)
+    {
+      m.memory().clipRect()->reset();
+
+      const uint8_t cx0 = uint8_t(rnd() % 64), cy0 = uint8_t(rnd() % 64);
+      if (i % 2)
+        m.memory().clipRect()->set(cx0, cy0, uint8_t(cx0 + rnd() % 72), uint8_t(cy0 + rnd() % 72));
+      m.memory().camera()->set(int16_t(int(rnd() % 129) - 64), int16_t(int(rnd() % 129) - 64));
+
+      auto coord = [&rnd]() { return coord_t(rnd() % 256) - 64; };
+      const coord_t x0 = coord(), y0 = coord(), x1 = coord(), y1 = coord();
+      const color_t color = color_t(1 + rnd() % 15);
+
+      check([&]() { m.rectfill(std::min(x0, x1), std::min(y0, y1), std::max(x0, x1), std::max(y0, y1), color); }, true);
+      check([&]() { m.line(x0, y0, x1, y1, color); }, true);
+      check([&]() { m.pset(x0, y0, color); }, true);
+      check([&]() { m.rect(x0, y0, x1, y1, color); }, false);
+      check([&]() { m.circfill(x0, y0, amount_t(rnd() % 40), color); }, false);
+      check([&]() { m.spr(index_t(rnd() % 256), x0, y0, 2.0f, 2.0f, rnd() & 1, rnd() & 1); }, false);
+      check([&]() { m.print("dirty", x0, y0, color); }, false);
+    }
+  }
+}
+
+TEST_CASE("fastmath kernels match PICO-8 within one 16.16 step")
+{
+  struct reference { int32_t a, b, expected; };
+  auto near = [](fix16 value, int32_t expected) { return std::abs(value.bits() - expected) <= 1; };
+
+  SECTION("reference values")
+  {
+    /* raw bits printed by PICO-8 with tostr(v, true) */
+    const reference sines[] = { { 0x0000, 0, 0x0000 }, { 0x2000, 0, -0xb505 }, { 0x4000, 0, -0x10000 }, { 0xc000, 0, 0x10000 }, { -0x2000, 0, 0xb505 } };
+    const reference cosines[] = { { 0x0000, 0, 0x10000 }, { 0x2000, 0, 0xb505 }, { 0x8000, 0, -0x10000 }, { 0x18000, 0, -0x10000 } };
+    const reference atans[] = { { 0x10000, 0, 0x0000 }, { 0, 0x10000, 0xc000 }, { -0x10000, 0, 0x8000 }, { 0, -0x10000, 0x4000 }, { 0x10000, 0x10000, 0xe000 }, { 0x10000, -0x10000, 0x2000 }, { 0, 0, 0x4000 } };
+    const reference roots[] = { { 0x20000, 0, 0x16a0a }, { 0x40000, 0, 0x20000 }, { 0x4000, 0, 0x8000 }, { 0x7fff0000, 0, 0xb5043e }, { -0x10000, 0, 0 } };
+
+    for (const auto& r : sines) REQUIRE(near(fastmath::sin(fix16::raw(r.a)), r.expected));
+    for (const auto& r : cosines) REQUIRE(near(fastmath::cos(fix16::raw(r.a)), r.expected));
+    for (const auto& r : atans) REQUIRE(near(fastmath::atan2(fix16::raw(r.a), fix16::raw(r.b)), r.expected));
+    for (const auto& r : roots) REQUIRE(near(fastmath::sqrt(fix16::raw(r.a)), r.expected));
+  }
+
+  SECTION("every angle against libm")
+  {
+    const double PI = 3.14159265358979323846;
+
+    for (int32_t a = 0; a < 0x10000; ++a)
+    {
+      REQUIRE(near(fastmath::sin(fix16::raw(a)), int32_t(std::lround(-std::sin(2 * PI * a / 0x10000) * 0x10000))));
+      REQUIRE(near(fastmath::cos(fix16::raw(a)), int32_t(std::lround(std::cos(2 * PI * a / 0x10000) * 0x10000))));
+    }
+  }
+
+  SECTION("random atan2 and sqrt against libm")
+  {
+    const double PI = 3.14159265358979323846;
+    std::mt19937 rnd(1234);
+
+    for (int i = 0; i < 100000; ++i)
+    {
+      const int32_t x = int32_t(rnd()) >> (rnd() % 16), y = int32_t(rnd()) >> (rnd() % 16);
+
+      double turns = std::atan2(-double(y), double(x)) / (2 * PI);
+      int32_t expected = int32_t(std::lround((turns < 0 ? turns + 1 : turns) * 0x10000)) & 0xffff;
+      int32_t delta = std::abs(fastmath::atan2(fix16::raw(x), fix16::raw(y)).bits() - expected);
+      REQUIRE(std::min(delta, 0x10000 - delta) <= 1);
+
+      const int32_t v = int32_t(rnd() >> 1);
+      REQUIRE(near(fastmath::sqrt(fix16::raw(v)), int32_t(std::llround(std::sqrt(double(v) / 0x10000) * 0x10000))));
+    }
+  }
+}
+
+#if !R8_FIXED_POINT
+TEST_CASE("math bindings keep float range")
+{
+  Machine m;
+  m.code().loadAPI();
+
+  auto eval = [&m](const std::string& code) {
+    m.code().initFromSource("function _test() return " + code + " end");
+    m.code().callFunction("_test", 1);
+    const float value = float(lua_tonumber(m.code().state(), -1));
+    lua_pop(m.code().state(), 1);
+    return value;
+  };
+
+  /* past 32767 16.16 values would wrap */
+  REQUIRE(eval("sqrt(40000)") == 200.0f);
+  REQUIRE(eval("sqrt(1000)") == Approx(31.6227766f).epsilon(1e-6));
+  REQUIRE(eval("sqrt(-4)") == 0.0f);
+  REQUIRE(eval("atan2(40000, 1)") == Approx(1.0f).epsilon(1e-4));
+  REQUIRE(eval("atan2(-40000, 0)") == Approx(0.5f));
+  REQUIRE(eval("atan2(0, 100000)") == Approx(0.75f));
+  REQUIRE(eval("sin(40000.25)") == Approx(-1.0f));
+  REQUIRE(eval("cos(-50000.5)") == Approx(-1.0f));
+}
+#endif
+
+TEST_CASE("time() follows the frame clock")
+{
+  /* t() reads the machine the bindings are attached to */
+  m.state().clock = 0;
+  m.code().loadAPI();
+  m.code().initFromSource("function _update() end");
+
+  for (int i = 0; i < 45; ++i)
+    m.tick();
+
+  m.code().initFromSource("x = t()");
+  lua_getglobal(m.code().state(), "x");
+  REQUIRE(lua_tonumber(m.code().state(), -1) == Approx(1.5f));
+  lua_pop(m.code().state(), 1);
+}
+
+TEST_CASE("arena shrinks blocks in place")
+{
+  Arena arena;
+  REQUIRE(arena.init(1 << 16));
+
+  void* block = Arena::allocate(&arena, nullptr, 0, 1000);
+  const size_t extent = arena.extent();
+
+  /* even with no room left the smaller block is accounted with the class Lua frees it with */
+  arena.setLimit(arena.used());
+  REQUIRE(Arena::allocate(&arena, block, 1000, 40) == block);
+  REQUIRE(arena.used() == 48);
+
+  arena.setLimit(SIZE_MAX);
+  REQUIRE(Arena::allocate(&arena, nullptr, 0, 512) != nullptr);
+  REQUIRE(arena.extent() == extent);
+
+  Arena::allocate(&arena, block, 40, 0);
+  REQUIRE(arena.used() == 512);
+}
+
+TEST_CASE("entry points follow reassigned globals")
+{
+  Machine m;
+  m.code().loadAPI();
+  m.code().initFromSource(
+    "n = 0 function a() n += 1 end function b() n += 100 end "
+    "_draw = a function _update() if n == 2 then _draw = b end end"
+  );
+
+  REQUIRE(m.code().hasDraw());
+
+  for (int i = 0; i < 4; ++i)
+  {
+    m.code().update();
+    m.code().draw();
+  }
+
+  lua_getglobal(m.code().state(), "n");
+  REQUIRE(lua_tonumber(m.code().state(), -1) == 202);
+  lua_pop(m.code().state(), 1);
+
+  m.code().initFromSource("_draw = nil");
+  REQUIRE(!m.code().hasDraw());
+}
+
+TEST_CASE("entry points survive a cart metatable on _G")
+{
+  Machine m;
+  m.code().loadAPI();
+  m.code().initFromSource(
+    "setmetatable(_G, { __index = function(t, k) error('undefined '..k) end }) "
+    "n = 0 function _update() n += 1 end function _draw() n += 10 end "
+    "seen = 0 for k, v in pairs(_G) do if k == '_draw' or k == '_update' then seen += 1 end end "
+    "raw = rawget(_G, '_draw') == _draw"
+  );
+
+  REQUIRE(m.code().hasUpdate());
+  REQUIRE(m.code().hasDraw());
+  REQUIRE(!m.code().hasInit());
+
+  m.code().init();
+  m.code().update();
+  m.code().draw();
+
+  lua_State* L = m.code().state();
+  lua_getglobal(L, "n");
+  REQUIRE(lua_tonumber(L, -1) == 11);
+  lua_getglobal(L, "seen");
+  REQUIRE(lua_tonumber(L, -1) == 2);
+  lua_getglobal(L, "raw");
+  REQUIRE(lua_toboolean(L, -1));
+  lua_pop(L, 3);
+}
+
+TEST_CASE("frame collector reclaims garbage after _draw")
+{
+  Machine m;
+
+  /* automatic collection is kept out of the way so that only stepping after _draw runs */
+  lua::GcSettings gc = lua::Code::defaultGcSettings();
+  gc.pause = 1000;
+  m.code().setGcSettings(gc);
+  m.code().initFromSource("function _draw() for i = 1, 1000 do local t = { i, tostr(i) } end end");
+
+  for (int i = 0; i < 200; ++i)
+  {
+    m.code().update();
+    m.code().draw();
+  }
+
+  REQUIRE(m.code().heap().used() < (1 << 20));
+}
+
+TEST_CASE("memory limit raises a lua error")
+{
+  Machine m;
+  m.code().setMemoryLimit(512 << 10);
+  m.code().loadAPI();
+  m.code().initFromSource(
+    "t = {} "
+    "function fill() for i = 1, 30000 do add(t, tostr(i) .. 'padding') end end "
+    "function _test() local ok, e = pcall(fill) return e end"
+  );
+
+  m.code().callFunction("_test", 1);
+  REQUIRE(std::string(lua_tostring(m.code().state(), -1)) == "not enough memory");
+  lua_pop(m.code().state(), 1);
+
+  REQUIRE(m.code().heap().peak() <= (512 << 10));
+
+  SECTION("stat(0) reports current and peak usage in KB")
+  {
+    /* bindings act on the global machine so it is pointed at this one while the cart runs */
+    Machine* global = machine;
+    machine = &m;
+    m.code().initFromSource("t = nil collectgarbage() function _test() local used, peak = stat(0) return used < peak and peak <= 512 end");
+    m.code().callFunction("_test", 1);
+    machine = global;
+    REQUIRE(lua_toboolean(m.code().state(), -1));
+  }
+}
+
+TEST_CASE("save state restores memory and lua heap")
+{
+  Machine m;
+  m.code().loadAPI();
+  m.code().initFromSource(
+    "t = {} t.self = t "
+    "co = cocreate(function() local k = 0 while true do k += 1 n = k yield() end end) "
+    "function step() coresume(co) pset(n, n, n % 16) end"
+  );
+
+  std::vector<uint8_t> snapshot(m.stateSize());
+  StateWriter writer(snapshot.data(), snapshot.size());
+  m.saveState(writer);
+  REQUIRE(writer.good());
+
+  for (int i = 0; i < 10; ++i)
+    m.code().callFunction("step");
+  std::vector<uint8_t> expected(m.memory().base(), m.memory().base() + address::SCREEN_DATA + BYTES_PER_SCREEN);
+
+  SECTION("replaying after restore gives the same result")
+  {
+    StateReader reader(snapshot.data(), snapshot.size());
+    REQUIRE(m.loadState(reader));
+    REQUIRE(m.memory().isScreenDirty());
+
+    for (int i = 0; i < 10; ++i)
+      m.code().callFunction("step");
+
+    lua_getglobal(m.code().state(), "n");
+    REQUIRE(lua_tonumber(m.code().state(), -1) == 10);
+    lua_pop(m.code().state(), 1);
+
+    REQUIRE(std::equal(expected.begin(), expected.end(), m.memory().base()));
+  }
+
+  SECTION("truncated snapshots are rejected")
+  {
+    StateReader reader(snapshot.data(), snapshot.size() - 1);
+    REQUIRE(!m.loadState(reader));
+  }
+
+  SECTION("snapshots of another instance are rejected")
+  {
+    Machine other;
+    other.code().loadAPI();
+
+    StateReader reader(snapshot.data(), snapshot.size());
+    REQUIRE(!other.loadState(reader));
+  }
+
+  SECTION("snapshots of another cart are rejected")
+  {
+    m.code().initFromSource("function step() end");
+
+    StateReader reader(snapshot.data(), snapshot.size());
+    REQUIRE(!m.loadState(reader));
+  }
+
+#if SOUND_ENABLED
+  SECTION("a bad sound section leaves the machine untouched")
+  {
+    /* sample rate is the last value written */
+    std::memset(&snapshot[snapshot.size() - sizeof(int32_t)], 0, sizeof(int32_t));
+
+    StateReader reader(snapshot.data(), snapshot.size());
+    REQUIRE(!m.loadState(reader));
+
+    lua_getglobal(m.code().state(), "n");
+    REQUIRE(lua_tonumber(m.code().state(), -1) == 10);
+    lua_pop(m.code().state(), 1);
+
+    REQUIRE(std::equal(expected.begin(), expected.end(), m.memory().base()));
+  }
+#endif
+}
+
+TEST_CASE("pxa decoder")
+{
+  std::vector<uint8_t> data;
+  size_t bit = 0;
+
+  /* bits are packed from the least significant one */
+  auto write = [&data, &bit](uint32_t value, uint32_t bits) {
+    for (uint32_t i = 0; i < bits; ++i, ++bit)
+    {
+      if (bit % 8 == 0)
+        data.push_back(0);
+      data.back() |= uint8_t(((value >> i) & 1) << (bit % 8));
+    }
+  };
+
+  std::string decoded;
+
+  SECTION("literals and overlapping references")
+  {
+    /* 'a' is at index 97 of the move-to-front list: unary 2 then 97 - 48 in 6 bits */
+    write(1, 1); write(0b011, 3); write(97 - 48, 6);
+    /* 'b' stays at index 98, only the values before 'a' moved */
+    write(1, 1); write(0b011, 3); write(98 - 48, 6);
+    /* 'a' is now at index 1 */
+    write(1, 1); write(0, 1); write(1, 4);
+    /* offset 2 with 5 bits, length 3 + 7 + 1 */
+    write(0, 1); write(0b11, 2); write(1, 5); write(7, 3); write(1, 3);
+
+    REQUIRE(io::pxa::decompress(data.data(), data.size(), decoded, 14));
+    REQUIRE(decoded == "ababababababab");
+  }
+
+  SECTION("raw bytes bypass the move-to-front list")
+  {
+    write(0, 1); write(0b01, 2); write(0, 10);
+    write('h', 8); write('i', 8); write(0, 8);
+    write(1, 1); write(0b011, 3); write('h' - 48, 6);
+
+    REQUIRE(io::pxa::decompress(data.data(), data.size(), decoded, 3));
+    REQUIRE(decoded == "hih");
+  }
+
+  SECTION("references before the output are rejected")
+  {
+    write(1, 1); write(0, 1); write(3, 4);
+    write(0, 1); write(0b11, 2); write(4, 5); write(0, 3);
+
+    REQUIRE(!io::pxa::decompress(data.data(), data.size(), decoded, 8));
+    REQUIRE(decoded == std::string(1, '\x03'));
+  }
+
+  SECTION("literals past the move-to-front list are rejected")
+  {
+    write(1, 1); write(0, 1); write(3, 4);
+    /* unary 4 covers 240 to 495, only the first 16 of them are in the list */
+    write(1, 1); write(0b01111, 5); write(256 - 240, 8);
+
+    REQUIRE(!io::pxa::decompress(data.data(), data.size(), decoded, 8));
+    REQUIRE(decoded == std::string(1, '\x03'));
+  }
+}
+
+TEST_CASE("compressors roundtrip through the decoders")
+{
+  std::mt19937 rng(19);
+  std::uniform_int_distribution<int> byte(0, 255), token(0, 5);
+  const char* tokens[] = { "function ", "end\n", "spr(i, x, y)\n", "local t = {}\n", "ABC", "x += 1\n" };
+
+  std::string text, binary;
+  for (size_t i = 0; i < 20000; ++i)
+  {
+    text += tokens[token(rng)];
+    binary += char(byte(rng));
+  }
+
+  for (const std::string& source : { std::string(), std::string("a"), std::string(40000, 'z'), text, binary })
+  {
+    std::vector<uint8_t> compressed;
+    std::string decoded;
+
+    io::pxa::compress(source.data(), source.size(), compressed);
+    REQUIRE(io::pxa::decompress(compressed.data(), compressed.size(), decoded, source.size()));
+    REQUIRE(decoded == source);
+
+    compressed.clear();
+    io::legacy::compress(source.data(), source.size(), compressed);
+    REQUIRE(io::legacy::decompress(compressed.data(), compressed.size(), decoded, source.size()));
+    REQUIRE(decoded == source);
+  }
+
+  SECTION("cartridges hide the same bytes PNG carts are read from")
+  {
+    std::vector<uint8_t> rom(address::CART_DATA_LENGTH);
+    for (uint8_t& value : rom)
+      value = uint8_t(byte(rng));
+
+    for (auto format : { io::Stegano::Format::LEGACY, io::Stegano::Format::PXA })
+    {
+      std::vector<uint8_t> cart, rgba;
+      REQUIRE(io::Stegano::encode(rom.data(), "x = 1", format, cart));
+      io::Stegano::embed(cart, rgba);
+
+      std::vector<uint32_t> pixels(rgba.size() / 4);
+      for (size_t i = 0; i < pixels.size(); ++i)
+        pixels[i] = rgba[4 * i] | (rgba[4 * i + 1] << 8) | (rgba[4 * i + 2] << 16) | (uint32_t(rgba[4 * i + 3]) << 24);
+
+      Machine m;
+      io::Stegano().load({ pixels.data(), nullptr, pixels.size() }, m);
+      REQUIRE(std::equal(rom.begin(), rom.end(), m.memory().base()));
+
+      /* PNG files are decoded row by row into the same bytes */
+      std::vector<uint8_t> png;
+      Platform::savePNG(png, rgba.data(), io::Stegano::IMAGE_WIDTH, io::Stegano::IMAGE_HEIGHT);
+
+      Machine direct;
+      REQUIRE(io::Stegano().load(png.data(), png.size(), direct));
+      REQUIRE(std::equal(rom.begin(), rom.end(), direct.memory().base()));
+    }
+
+    /* pictures of a different size or without a magic number aren't carts */
+    Machine m;
+    std::vector<uint8_t> picture(io::Stegano::IMAGE_WIDTH * io::Stegano::IMAGE_HEIGHT * 4, 0xff), png;
+    Platform::savePNG(png, picture.data(), io::Stegano::IMAGE_WIDTH, io::Stegano::IMAGE_HEIGHT);
+    REQUIRE(!io::Stegano().load(png.data(), png.size(), m));
+
+    Platform::savePNG(png, picture.data(), io::Stegano::IMAGE_HEIGHT, io::Stegano::IMAGE_WIDTH);
+    REQUIRE(!io::Stegano().load(png.data(), png.size(), m));
+
+    std::vector<uint8_t> cart;
+    REQUIRE(!io::Stegano::encode(rom.data(), binary, io::Stegano::Format::PXA, cart));
+  }
+}
+
+TEST_CASE("p8 loader parses sections in place")
+{
+  Machine m;
+  io::Loader loader;
+  m.code().loadAPI();
+
+  /* CRLF line endings and no terminator after the data */
+  const std::string cart =
+    "pico-8 cartridge // http://www.pico-8.com\r\n"
+    "__lua__\r\n"
+    "\r\n"
+    "function _test() local ok, e = pcall(function() error('line') end) return e end\r\n"
+    "__gfx__\r\n" + std::string("1f") + std::string(126, '0') + "\r\n"
+    "__map__\r\n" + std::string("a5") + std::string(254, '0') + "\r\n"
+    "__meta:title__\r\n"
+    "not code";
+
+  loader.loadRaw(cart.data(), cart.size(), m);
+
+  REQUIRE(m.memory().base()[address::SPRITE_SHEET] == 0xf1);
+  REQUIRE(*m.memory().spriteInTileMap(0, 0) == 0xa5);
+
+  /* empty lines are kept so that errors point at the right line */
+  m.code().callFunction("_test", 1);
+  const std::string error = lua_tostring(m.code().state(), -1);
+  REQUIRE(error.substr(error.size() - 8) == ":2: line");
+
+  SECTION("missing files load an empty cart")
+  {
+    Machine empty;
+    empty.code().loadAPI();
+    loader.loadFile((std::filesystem::temp_directory_path() / "retro8-missing.p8").generic_u8string(), empty);
+    REQUIRE(!empty.code().hasUpdate());
+  }
+}
+
+TEST_CASE("cached carts load like their source")
+{
+  /* top level code changes cartridge data, the cached image must hold it as it was before */
+  const std::string cart =
+    "pico-8 cartridge // http://www.pico-8.com\n"
+    "__lua__\n"
+    "first = sget(0, 0) sset(0, 0, 9) x = 0 function _test() x += 1 return x + first end\n"
+    "__gfx__\n" +
+    std::string("7") + std::string(127, '0') + "\n";
+
+  const std::string directory = std::filesystem::temp_directory_path().generic_u8string();
+  const io::Cache cache(directory);
+  const uint64_t key = io::Cache::keyFor(cart.data(), cart.size());
+
+  /* bindings act on the global machine */
+  m.code().loadAPI();
+
+  io::Loader loader;
+  m.code().keepBytecode(true);
+  loader.loadRaw(cart, m);
+  REQUIRE(!m.code().bytecode().empty());
+  REQUIRE(m.memory().base()[0] == 0x09);
+  REQUIRE(cache.store(key, m));
+  const std::string bytecode = m.code().bytecode();
+  m.code().keepBytecode(false);
+
+  std::memset(m.memory().base(), 0, address::CART_DATA_LENGTH);
+  REQUIRE(cache.load(key, m));
+  REQUIRE(m.memory().backup()[0] == 0x07);
+  REQUIRE(m.memory().base()[0] == 0x09);
+
+  m.code().callFunction("_test", 1);
+  REQUIRE(lua_tonumber(m.code().state(), -1) == 8);
+  lua_pop(m.code().state(), 1);
+
+  SECTION("other carts miss")
+  {
+    Machine other;
+    REQUIRE(!cache.load(key + 1, other));
+  }
+
+  SECTION("chunks of another build are rejected")
+  {
+    Machine other;
+    other.code().loadAPI();
+    REQUIRE(other.code().initFromBytecode(bytecode));
+
+    /* Lua version and then size of lua_Number */
+    std::string version = bytecode, number = bytecode;
+    version[4] ^= 1;
+    number[16] ^= 4;
+    REQUIRE(!other.code().initFromBytecode(version));
+    REQUIRE(!other.code().initFromBytecode(number));
+    REQUIRE(!other.code().initFromBytecode(bytecode.substr(0, 8)));
+  }
+}
+
+TEST_CASE("wavetable oscillators")
+{
+  sfx::DSP dsp(44100);
+  const uint32_t a4 = dsp.increment(33);
+
+  SECTION("pitches are tuned on A4")
+  {
+    REQUIRE(a4 == uint32_t(440.0 / 44100 * 4294967296.0 + 0.5));
+    REQUIRE(std::abs(int64_t(dsp.increment(45)) - 2 * int64_t(a4)) <= 1);
+  }
+
+  SECTION("a second of A4 has 440 periods and stays near the amplitude")
+  {
+    for (auto waveform : { sfx::Waveform::TRIANGLE, sfx::Waveform::TILTED_SAW, sfx::Waveform::SAW, sfx::Waveform::SQUARE, sfx::Waveform::PULSE })
+    {
+      std::vector<int16_t> samples(44100);
+      dsp.wave(waveform, 0, { a4, a4, 4096 << 16, 4096 << 16 }, samples.data(), samples.size());
+
+      int32_t periods = 0, peak = 0;
+      for (size_t i = 1; i < samples.size(); ++i)
+      {
+        periods += samples[i - 1] < 0 && samples[i] >= 0;
+        peak = std::max(peak, std::abs(int32_t(samples[i])));
+      }
+
+      REQUIRE(periods == 440);
+      REQUIRE(peak < 4096 * 5 / 4);
+    }
+  }
+
+  SECTION("tables near Nyquist keep only the fundamental")
+  {
+    const int16_t* table = sfx::wavetable::table(sfx::Waveform::SQUARE, uint32_t(1) << 30);
+
+    int32_t turns = 0;
+    for (size_t i = 1; i < sfx::wavetable::TABLE_LENGTH; ++i)
+      turns += (table[i] > table[i - 1]) != (table[i + 1] > table[i]);
+
+    REQUIRE(turns == 2);
+  }
+
+  SECTION("noise and phaser have no tables")
+  {
+    REQUIRE(!sfx::wavetable::periodic(sfx::Waveform::NOISE));
+    REQUIRE(!sfx::wavetable::periodic(sfx::Waveform::PHASER));
+  }
+}
+
+TEST_CASE("sfx effects follow golden renders")
+{
+  using sfx::Effect;
+
+  /* 4 saw notes rising by 4 semitones at speed 16, rendered in 60Hz chunks */
+  auto render = [](Effect effect, size_t length) {
+    Machine m;
+    sfx::Sound* sound = m.memory().sound(0);
+    sound->speed = 16;
+    for (size_t i = 0; i < sound->samples.size(); ++i)
+    {
+      sound->samples[i].value = 0;
+      sound->samples[i].setPitch(24 + (i % 4) * 4);
+      sound->samples[i].setVolume(i < 8 ? 5 : 0);
+      sound->samples[i].setWaveform(sfx::Waveform::SAW);
+      sound->samples[i].setEffect(effect);
+    }
+
+    m.sound().play(0, 0, 0, 8);
+    std::vector<int16_t> stereo(2 * length), samples(length);
+    for (size_t o = 0; o < length; o += 735)
+      m.sound().renderSounds(stereo.data() + 2 * o, std::min<size_t>(735, length - o));
+    for (size_t i = 0; i < length; ++i)
+      samples[i] = stereo[2 * i];
+    return samples;
+  };
+
+  /* rising zero crossings and mean level of each half note */
+  struct Golden { Effect effect; std::array<std::pair<int32_t, int32_t>, 8> halves; };
+  const Golden goldens[] = {
+    { Effect::NONE, { { { 17, 1279 }, { 18, 1255 }, { 22, 1276 }, { 21, 1279 }, { 28, 1258 }, { 27, 1267 }, { 35, 1267 }, { 35, 1255 } } } },
+    { Effect::SLIDE, { { { 17, 1279 }, { 18, 1255 }, { 18, 1287 }, { 21, 1258 }, { 23, 1275 }, { 26, 1263 }, { 30, 1254 }, { 33, 1268 } } } },
+    { Effect::VIBRATO, { { { 17, 1279 }, { 18, 1255 }, { 22, 1275 }, { 21, 1279 }, { 28, 1258 }, { 27, 1266 }, { 35, 1267 }, { 35, 1255 } } } },
+    { Effect::DROP, { { { 13, 1274 }, { 4, 1310 }, { 17, 1251 }, { 5, 1418 }, { 21, 1253 }, { 7, 1190 }, { 26, 1261 }, { 8, 1231 } } } },
+    { Effect::FADE_IN, { { { 17, 322 }, { 18, 941 }, { 22, 317 }, { 21, 959 }, { 28, 315 }, { 27, 950 }, { 35, 318 }, { 35, 942 } } } },
+    { Effect::FADE_OUT, { { { 17, 958 }, { 18, 314 }, { 22, 959 }, { 21, 319 }, { 28, 943 }, { 27, 317 }, { 35, 949 }, { 35, 314 } } } },
+    { Effect::ARPEGGIO_FAST, { { { 20, 1266 }, { 31, 1262 }, { 19, 1279 }, { 31, 1260 }, { 20, 1269 }, { 31, 1253 }, { 20, 1268 }, { 30, 1269 } } } },
+    { Effect::ARPEGGIO_SLOW, { { { 17, 1279 }, { 22, 1271 }, { 28, 1253 }, { 34, 1273 }, { 18, 1264 }, { 22, 1268 }, { 27, 1272 }, { 34, 1264 } } } },
+  };
+
+  const size_t half = (44100 / 128) * 17 / 2;
+
+  for (const Golden& golden : goldens)
+  {
+    const std::vector<int16_t> samples = render(golden.effect, half * 8);
+
+    for (size_t h = 0; h < golden.halves.size(); ++h)
+    {
+      int32_t crossings = 0, level = 0;
+      for (size_t i = h * half + 1; i < (h + 1) * half; ++i)
+      {
+        crossings += samples[i - 1] < 0 && samples[i] >= 0;
+        level += std::abs(int32_t(samples[i]));
+      }
+      level = int32_t(level / int32_t(half));
+
+      REQUIRE(std::abs(crossings - golden.halves[h].first) <= 1);
+      REQUIRE(std::abs(level - golden.halves[h].second) <= golden.halves[h].second / 32);
+    }
+  }
+
+  SECTION("vibrato bends the pitch of a note")
+  {
+    REQUIRE(render(Effect::VIBRATO, half * 2) != render(Effect::NONE, half * 2));
+  }
+}
+
+TEST_CASE("mixer pans channels and limits loud mixes")
+{
+  std::vector<int16_t> loud(sfx::Mixer::BLOCK_SIZE, 20000), quiet(sfx::Mixer::BLOCK_SIZE, -1000);
+  std::vector<int16_t> out(2 * sfx::Mixer::BLOCK_SIZE);
+
+  SECTION("gains place a channel in the stereo field")
+  {
+    sfx::Mixer mixer(44100);
+    const int16_t* channels[] = { quiet.data(), nullptr, nullptr, nullptr };
+    mixer.setGain(0, 1.0f, 0.0f);
+    mixer.mix(channels, out.data(), 13);
+
+    for (size_t i = 0; i < 13; ++i)
+    {
+      REQUIRE(out[2 * i] == -1000);
+      REQUIRE(out[2 * i + 1] == 0);
+    }
+
+    mixer.setMasterGain(0.5f);
+    mixer.mix(channels, out.data(), 13);
+    REQUIRE(out[24] == -500);
+  }
+
+  SECTION("loud sums are lowered instead of wrapping")
+  {
+    sfx::Mixer mixer(44100);
+    const int16_t* channels[] = { loud.data(), loud.data(), loud.data(), loud.data() };
+    mixer.mix(channels, out.data(), out.size() / 2);
+
+    REQUIRE(std::all_of(out.begin(), out.end(), [](int16_t v) { return v > 29000 && v <= sfx::Mixer::THRESHOLD; }));
+    REQUIRE(mixer.limiterGain() < 0.5f);
+
+    /* then the gain slowly goes back to unity */
+    const int16_t* single[] = { quiet.data(), nullptr, nullptr, nullptr };
+    mixer.mix(single, out.data(), out.size() / 2);
+    REQUIRE(out[0] > -1000);
+
+    for (size_t i = 0; i < 44100 / sfx::Mixer::BLOCK_SIZE; ++i)
+      mixer.mix(single, out.data(), out.size() / 2);
+    REQUIRE(mixer.limiterGain() == 1.0f);
+    REQUIRE(out[0] == -1000);
+  }
+}
+
+TEST_CASE("resampler keeps tones and removes aliases")
+{
+  /* one second of a stereo tone through the resampler, returns rising zero crossings and peak of the left side */
+  auto convert = [](int32_t from, int32_t to, double frequency) {
+    const double PI = 3.14159265358979323846;
+    sfx::Resampler resampler(from, to);
+    std::vector<int16_t> input, output(2 * to);
+    size_t position = 0;
+
+    for (size_t done = 0; done < size_t(to); done += 500)
+    {
+      const size_t frames = std::min<size_t>(500, to - done);
+      const size_t needed = resampler.needed(frames);
+      REQUIRE(needed <= resampler.maxNeeded(frames));
+
+      input.resize(2 * needed);
+      for (size_t i = 0; i < needed; ++i, ++position)
+        input[2 * i] = input[2 * i + 1] = int16_t(16384 * std::sin(2 * PI * frequency * position / from));
+
+      resampler.push(input.data(), needed);
+      resampler.pull(output.data() + 2 * done, frames);
+    }
+
+    /* peak leaves out the onset of the tone which isn't band limited */
+    int32_t crossings = 0, peak = 0;
+    for (size_t i = 1; i < size_t(to); ++i)
+    {
+      crossings += output[2 * (i - 1)] < 0 && output[2 * i] >= 0;
+      if (i > size_t(to) / 50)
+        peak = std::max(peak, std::abs(int32_t(output[2 * i])));
+      REQUIRE(output[2 * i] == output[2 * i + 1]);
+    }
+    return std::make_pair(crossings, peak);
+  };
+
+  SECTION("tones below the cutoff go through")
+  {
+    for (auto rates : { std::make_pair(22050, 48000), std::make_pair(11025, 44100), std::make_pair(44100, 32000), std::make_pair(48000, 11025) })
+    {
+      const auto result = convert(rates.first, rates.second, 1000.0);
+      REQUIRE(std::abs(result.first - 1000) <= 1);
+      REQUIRE(std::abs(result.second - 16384) < 16384 / 50);
+    }
+  }
+
+  SECTION("tones above the output Nyquist frequency are removed")
+  {
+    REQUIRE(convert(44100, 11025, 8000.0).second < 16384 / 100);
+    REQUIRE(convert(48000, 22050, 15000.0).second < 16384 / 100);
+  }
+
+  SECTION("apu notes last as long at every rate")
+  {
+    auto render = [](int32_t rate) {
+      Machine m;
+      sfx::Sound* sound = m.memory().sound(0);
+      sound->speed = 16;
+      for (size_t i = 0; i < sound->samples.size(); ++i)
+      {
+        sound->samples[i].value = 0;
+        sound->samples[i].setPitch(24);
+        sound->samples[i].setVolume(i < 8 ? 5 : 0);
+        sound->samples[i].setWaveform(sfx::Waveform::SQUARE);
+      }
+
+      m.sound().setSampleRate(rate, 44100);
+      m.sound().play(0, 0, 0, 8);
+
+      std::vector<int16_t> samples(2 * 44100);
+      for (size_t o = 0; o < 44100; o += 735)
+        m.sound().renderSounds(samples.data() + 2 * o, 735);
+
+      int32_t crossings = 0, last = 0;
+      for (size_t i = 1; i < 44100; ++i)
+      {
+        crossings += samples[2 * (i - 1)] < 0 && samples[2 * i] >= 0;
+        if (samples[2 * i])
+          last = int32_t(i);
+      }
+      return std::make_pair(crossings, last);
+    };
+
+    const auto native = render(44100);
+    for (int32_t rate : { 22050, 11025 })
+    {
+      const auto resampled = render(rate);
+      REQUIRE(std::abs(resampled.first - native.first) <= 2);
+      REQUIRE(std::abs(resampled.second - native.second) < 44100 / 100);
+    }
+  }
+}
+
+TEST_CASE("sfx commands land at their sample offset")
+{
+  Machine m;
+  sfx::Sound* sound = m.memory().sound(0);
+  sound->speed = 16;
+  for (size_t i = 0; i < sound->samples.size(); ++i)
+  {
+    sound->samples[i].value = 0;
+    sound->samples[i].setPitch(24);
+    sound->samples[i].setVolume(5);
+    sound->samples[i].setWaveform(sfx::Waveform::SQUARE);
+  }
+
+  /* issued one frame in, the block starting at frame 0 stays silent up to there */
+  std::vector<int16_t> samples(2 * 1470);
+  m.sound().setClock(1, 60);
+  m.sound().play(0, 0, 0, 32);
+  m.sound().renderSounds(samples.data(), 1470);
+
+  REQUIRE(std::all_of(samples.begin(), samples.begin() + 2 * 735, [](int16_t v) { return v == 0; }));
+  REQUIRE(std::any_of(samples.begin() + 2 * 735, samples.begin() + 2 * 745, [](int16_t v) { return v != 0; }));
+
+  SECTION("commands far from the rendered time apply at once")
+  {
+    m.sound().setClock(600, 60);
+    m.sound().play(0, 0, 0, 32);
+    m.sound().renderSounds(samples.data(), 735);
+
+    /* restarted square is at its low level on the first sample */
+    REQUIRE(samples[0] < 0);
+  }
+
+  SECTION("ring drops items when full")
+  {
+    Ring<int, 4> ring;
+    for (int i = 0; i < 4; ++i)
+      REQUIRE(ring.push(i));
+    REQUIRE(!ring.push(4));
+    REQUIRE(ring.size() == 4);
+
+    REQUIRE(*ring.peek() == 0);
+    ring.pop();
+    REQUIRE(ring.push(4));
+    REQUIRE(ring[3] == 4);
+  }
+}
+
 TEST_CASE("lua language modifications")
 {
   lua_State* L = luaL_newstate();
@@ -194,6 +1290,35 @@ TEST_CASE("lua language modifications")
   lua_close(L);
 }
 
+#if R8_FIXED_POINT
+TEST_CASE("fixed point numbers wrap like PICO-8")
+{
+  lua_State* L = luaL_newstate();
+
+  auto eval = [L](const std::string& code) {
+    REQUIRE(luaL_loadstring(L, ("return " + code).c_str()) == 0);
+    REQUIRE(lua_pcall(L, 0, 1, 0) == 0);
+    lua_Number value = lua_tonumber(L, -1);
+    lua_pop(L, 1);
+    return value;
+  };
+
+  REQUIRE(eval("32767 + 1") == int32_t(0x80000000));
+  REQUIRE(eval("0xffff") == -0x10000);
+  REQUIRE(eval("1 / 0") == 0x7fffffff);
+  REQUIRE(eval("1 / 3") == 0x5555);
+  REQUIRE(eval("-7 % 3") == 0x20000);
+  REQUIRE(eval("5.5 & 3.25") == 0x10000);
+  REQUIRE(eval("-8 >> 1") == -0x40000);
+
+  REQUIRE(luaL_loadstring(L, "return (1 / 3) .. ' ' .. 0x7fff.ffff .. ' ' .. -2.5") == 0);
+  REQUIRE(lua_pcall(L, 0, 1, 0) == 0);
+  REQUIRE(std::string(lua_tostring(L, -1)) == "0.3333 32767.9999 -2.5");
+
+  lua_close(L);
+}
+#endif
+
 /*TEST_CASE("cartridge testing")
 {
   retro8::io::Loader loader;
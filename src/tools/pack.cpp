@@ -0,0 +1,129 @@
+#include "common.h"
+
+#include "io/loader.h"
+#include "io/stegano.h"
+#include "vm/machine.h"
+
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+/*
+* converts .p8 carts to .p8.png ones:
+*
+*   retro8-pack [-l] [-i picture.png] cart.p8 [cart.p8.png]
+*
+*   -l            use the :c: compression of carts saved before PICO-8 0.2 instead of PXA
+*   -i picture    160x205 picture the cart is hidden in, a plain one is used otherwise
+*
+* the output defaults to the input path followed by .png
+*/
+
+namespace r8 = retro8;
+
+r8::Machine* machine;
+
+uint32_t Platform::getTicks() { return 0; }
+
+namespace
+{
+  bool readFile(const std::string& path, std::vector<uint8_t>& data)
+  {
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+      return false;
+
+    data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    return true;
+  }
+
+  void usage(const char* name)
+  {
+    std::fprintf(stderr, "usage: %s [-l] [-i picture.png] cart.p8 [cart.p8.png]\n", name);
+  }
+}
+
+int main(int argc, char* argv[])
+{
+  r8::io::Stegano::Format format = r8::io::Stegano::Format::PXA;
+  std::string picture;
+  std::vector<std::string> paths;
+
+  for (int i = 1; i < argc; ++i)
+  {
+    const std::string arg = argv[i];
+
+    if (arg == "-l")
+      format = r8::io::Stegano::Format::LEGACY;
+    else if (arg == "-i" && i + 1 < argc)
+      picture = argv[++i];
+    else if (arg[0] == '-' || paths.size() == 2)
+    {
+      usage(argv[0]);
+      return 1;
+    }
+    else
+      paths.push_back(arg);
+  }
+
+  if (paths.empty())
+  {
+    usage(argv[0]);
+    return 1;
+  }
+  else if (paths.size() == 1)
+    paths.push_back(paths[0] + ".png");
+
+  std::vector<uint8_t> source;
+  if (!readFile(paths[0], source))
+  {
+    std::fprintf(stderr, "unable to read %s\n", paths[0].c_str());
+    return 1;
+  }
+
+  /* only memory is filled, the cart code is never run */
+  r8::Machine* cart = new r8::Machine();
+  std::string code;
+  r8::io::Loader().parse(reinterpret_cast<const char*>(source.data()), source.size(), *cart, code);
+
+  std::vector<uint8_t> bytes;
+  const bool fits = r8::io::Stegano::encode(cart->memory().base(), code, format, bytes);
+  delete cart;
+
+  if (!fits)
+  {
+    std::fprintf(stderr, "code of %s doesn't fit in a cartridge once compressed\n", paths[0].c_str());
+    return 1;
+  }
+
+  std::vector<uint8_t> rgba;
+  if (!picture.empty())
+  {
+    std::vector<uint8_t> png;
+    unsigned long width, height;
+    if (!readFile(picture, png) || Platform::loadPNG(rgba, width, height, png.data(), png.size(), true) != 0 ||
+      width != r8::io::Stegano::IMAGE_WIDTH || height != r8::io::Stegano::IMAGE_HEIGHT)
+    {
+      std::fprintf(stderr, "%s is not a %zux%zu PNG picture\n", picture.c_str(), r8::io::Stegano::IMAGE_WIDTH, r8::io::Stegano::IMAGE_HEIGHT);
+      return 1;
+    }
+  }
+
+  r8::io::Stegano::embed(bytes, rgba);
+
+  std::vector<uint8_t> png;
+  Platform::savePNG(png, rgba.data(), r8::io::Stegano::IMAGE_WIDTH, r8::io::Stegano::IMAGE_HEIGHT);
+
+  std::ofstream output(paths[1], std::ios::binary);
+  output.write(reinterpret_cast<const char*>(png.data()), png.size());
+  if (!output)
+  {
+    std::fprintf(stderr, "unable to write %s\n", paths[1].c_str());
+    return 1;
+  }
+
+  std::printf("%s: %zu bytes of code\n", paths[1].c_str(), code.size());
+  return 0;
+}
@@ -2,6 +2,7 @@
 
 #include "io/loader.h"
 #include "io/stegano.h"
+#include "vm/raster.h"
 
 #include <future>
 
@@ -27,30 +28,31 @@ void SDLAudio::audio_callback(void* data, uint8_t* cbuffer, int length)
 {
   retro8::sfx::APU* apu = static_cast<retro8::sfx::APU*>(data);
   int16_t* buffer = reinterpret_cast<int16_t*>(cbuffer);
-  apu->renderSounds(buffer, length / sizeof(int16_t));
+  apu->renderSounds(buffer, length / (2 * sizeof(int16_t)));
   return;
 }
 
 void SDLAudio::init(retro8::sfx::APU* apu)
 {
   SDL_AudioSpec wantSpec;
-#if !defined(SF2000)
-  wantSpec.freq = 44100;
-#else
-  wantSpec.freq = 11025;
-#endif
+  wantSpec.freq = retro8::sfx::DEFAULT_SAMPLE_RATE;
   wantSpec.format = AUDIO_S16SYS;
-  wantSpec.channels = 1;
+  wantSpec.channels = 2;
   wantSpec.samples = 2048;
   wantSpec.userdata = apu;
   wantSpec.callback = audio_callback;
 
-  device = SDL_OpenAudioDevice(NULL, 0, &wantSpec, &spec, 0);
+  device = SDL_OpenAudioDevice(NULL, 0, &wantSpec, &spec, SDL_AUDIO_ALLOW_FREQUENCY_CHANGE);
 
   if (!device)
   {
     printf("Error while opening audio: %s", SDL_GetError());
   }
+  else
+  {
+    /* device starts paused, APU renders at its own rate and resamples to the one we got */
+    apu->setSampleRate(apu->sampleRate(), spec.freq);
+  }
 }
 
 void SDLAudio::resume()
@@ -75,7 +77,7 @@ namespace r8 = retro8;
 
 retro8::Machine *machine;
 
-GameView::GameView(ViewManager* manager) : manager(manager),
+GameView::GameView(ViewManager* manager) : manager(manager), _scale(1),
 _paused(false), _showFPS(false), _showCartridgeName(false)
 {
 }
@@ -83,6 +85,7 @@ _paused(false), _showFPS(false), _showCartridgeName(false)
 
 void GameView::update()
 {
+  machine->tick();
   machine->code().update();
   machine->code().draw();
 }
@@ -127,6 +130,7 @@ retro8::io::PngData loadPng(const std::string& path)
 }
 
 r8::gfx::ColorTable colorTable;
+r8::gfx::Rasterizer rasterizer;
 
 struct ColorMapper
 {
@@ -139,22 +143,30 @@ struct ColorMapper
   }
 };
 
-void GameView::rasterize()
+bool GameView::rasterize()
 {
-  auto* data = machine->memory().screenData();
-  auto* screenPalette = machine->memory().paletteAt(r8::gfx::SCREEN_PALETTE_INDEX);
-  uint32_t* output = _output.pixels();
+  auto& memory = machine->memory();
+  auto* screenPalette = memory.paletteAt(r8::gfx::SCREEN_PALETTE_INDEX);
 
-  for (size_t i = 0; i < r8::gfx::BYTES_PER_SCREEN; ++i)
-  {
-    const r8::gfx::color_byte_t* pixels = data + i;
-    const auto rc1 = colorTable.get(screenPalette->get((pixels)->low()));
-    const auto rc2 = colorTable.get(screenPalette->get((pixels)->high()));
+  if (!memory.isScreenDirty())
+    return false;
+
+  r8::gfx::color_lut_t<uint32_t> lut;
+  r8::gfx::buildColorLut(colorTable, *screenPalette, lut);
+
+  Surface& output = target();
+  const size_t scale = &output == &_scaled ? _scale : 1;
+  const size_t pitch = output.surface->pitch / sizeof(uint32_t);
 
-    *(output) = rc1;
-    *((output)+1) = rc2;
-    (output) += 2;
+  /* only scanlines modified since last frame are converted */
+  for (r8::coord_t y = 0; y < r8::gfx::SCREEN_HEIGHT; ++y)
+  {
+    if (memory.isScreenRowDirty(y))
+      rasterizer.rasterize(memory.screenData(0, y), output.pixels() + y * scale * pitch, r8::gfx::SCREEN_PITCH, lut, scale, pitch);
   }
+
+  memory.clearScreenDirty();
+  return true;
 }
 
 
@@ -181,6 +193,10 @@ void GameView::render()
 
     assert(_output);
 
+    _scale = r8::gfx::Rasterizer::fitScale(SCREEN_WIDTH, SCREEN_HEIGHT);
+    if (_scale > 1)
+      _scaled = manager->allocate(128 * _scale, 128 * _scale);
+
     _frameCounter = 0;
 
     machine->code().loadAPI();
@@ -241,10 +257,11 @@ void GameView::render()
     if (!_initFuture.valid() || _initFuture.wait_for(std::chrono::nanoseconds(0)) == std::future_status::ready)
     {
       update();
-      rasterize();
-    }
 
-    _output.update();
+      /* texture is uploaded only when some scanline changed */
+      if (rasterize())
+        target().update();
+    }
   }
 
   SDL_Rect dest;
@@ -253,10 +270,18 @@ void GameView::render()
     dest = { (SCREEN_WIDTH - 128) / 2, (SCREEN_HEIGHT - 128) / 2, 128, 128 };
   else if (_scaler == Scaler::SCALED_ASPECT_2x)
     dest = { (SCREEN_WIDTH - 256) / 2, (SCREEN_HEIGHT - 256) / 2, 256, 256 };
+  else if (_scaler == Scaler::INTEGER_FIT)
+  {
+    const int size = 128 * int(_scale);
+    dest.x = (SCREEN_WIDTH - size) / 2;
+    dest.y = (SCREEN_HEIGHT - size) / 2;
+    dest.w = size;
+    dest.h = size;
+  }
   else
     dest = { 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT };
 
-  manager->blitToScreen(_output, dest);
+  manager->blitToScreen(target(), dest);
 
   if (_showFPS)
   {
@@ -404,8 +429,8 @@ void GameView::handleKeyboardEvent(const SDL_Event& event)
   case KEY_NEXT_SCALER:
     if (event.type == SDL_KEYDOWN)
     {
-      if (_scaler < Scaler::LAST) _scaler = Scaler(_scaler + 1);
-      else _scaler = Scaler::FIRST;
+      if (_scaler < Scaler::LAST) setScaler(Scaler(_scaler + 1));
+      else setScaler(Scaler::FIRST);
   }
     break;
 
@@ -449,6 +474,8 @@ void GameView::resume()
 GameView::~GameView()
 {
   _output.release();
+  if (_scaled)
+    _scaled.release();
   //TODO: the _init future is not destroyed
   sdlAudio.close();
 }
@@ -19,6 +19,7 @@ namespace ui
   {
     UNSCALED = 0,
     SCALED_ASPECT_2x,
+    INTEGER_FIT,
     FULLSCREEN,
 
     FIRST = UNSCALED,
@@ -36,6 +37,9 @@ namespace ui
     retro8::input::InputManager _input;
 
     Surface _output;
+    /* screen upscaled in software by the biggest integer factor which fits the display */
+    Surface _scaled;
+    size_t _scale;
 
     std::string _path;
 
@@ -46,7 +50,8 @@ namespace ui
     bool _showFPS;
     bool _showCartridgeName;
 
-    void rasterize();
+    Surface& target() { return _scaler == Scaler::INTEGER_FIT && _scaled ? _scaled : _output; }
+    bool rasterize();
     void render();
     void update();
 
@@ -62,7 +67,7 @@ namespace ui
     void pause();
     void resume();
 
-    void setScaler(Scaler scaler) { _scaler = scaler; }
+    void setScaler(Scaler scaler) { _scaler = scaler; machine->memory().markScreenDirty(); }
     Scaler scaler() const { return _scaler; }
 
     void toggleFPS(bool active) { _showFPS = active; }
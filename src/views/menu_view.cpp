@@ -130,6 +130,7 @@ void MenuView::updateLabels()
   switch (scaler) {
   case Scaler::UNSCALED: scalerLabel += "1:1"; break;
   case Scaler::SCALED_ASPECT_2x: scalerLabel += "2:1"; break;
+  case Scaler::INTEGER_FIT: scalerLabel += "integer"; break;
   case Scaler::FULLSCREEN: scalerLabel += "fit screen"; break;
   }
 
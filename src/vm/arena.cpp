@@ -0,0 +1,162 @@
+#include "arena.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <new>
+
+using namespace retro8;
+
+namespace
+{
+  constexpr size_t ALIGNMENT = size_t(1) << Arena::MIN_BLOCK_SHIFT;
+}
+
+Arena::~Arena()
+{
+  delete[] _base;
+}
+
+bool Arena::init(size_t capacity)
+{
+  assert(!_base);
+  assert(capacity <= UINT32_MAX);
+
+  _base = new (std::nothrow) uint8_t[capacity];
+
+  if (!_base)
+    return false;
+
+  _capacity = capacity;
+
+  Header* h = header();
+  std::memset(h, 0, sizeof(Header));
+  h->top = (sizeof(Header) + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+
+  return true;
+}
+
+size_t Arena::classFor(size_t size)
+{
+  if (size <= SMALL_LIMIT)
+    return (size - 1) >> MIN_BLOCK_SHIFT;
+
+  size_t cls = SMALL_CLASS_COUNT;
+  for (size_t s = (size - 1) / (SMALL_LIMIT * 2); s; s >>= 1)
+    ++cls;
+  return cls;
+}
+
+void* Arena::alloc(size_t size, size_t freed)
+{
+  const size_t cls = classFor(size);
+
+  if (cls >= CLASS_COUNT)
+    return nullptr;
+
+  Header* h = header();
+  const size_t length = blockSize(cls);
+  uint8_t* block;
+
+  if (h->used - freed + length > _limit)
+    return nullptr;
+  else if (h->freeLists[cls])
+  {
+    block = _base + h->freeLists[cls];
+    std::memcpy(&h->freeLists[cls], block, sizeof(uint32_t));
+  }
+  else if (h->top + length <= _capacity)
+  {
+    block = _base + h->top;
+    h->top += length;
+  }
+  else
+    return nullptr;
+
+  h->used += length;
+  h->peak = std::max(h->peak, h->used);
+  return block;
+}
+
+void Arena::release(void* ptr, size_t size)
+{
+  Header* h = header();
+  const size_t cls = classFor(size);
+  const uint32_t offset = uint32_t(static_cast<uint8_t*>(ptr) - _base);
+
+  std::memcpy(ptr, &h->freeLists[cls], sizeof(uint32_t));
+  h->freeLists[cls] = offset;
+  h->used -= blockSize(cls);
+}
+
+void Arena::shrink(void* ptr, size_t osize, size_t nsize)
+{
+  /* the tail past the smaller class is released as blocks of existing classes, all sizes are
+     multiples of ALIGNMENT so it always splits exactly, and a later free of nsize matches */
+  const size_t length = blockSize(classFor(nsize));
+  uint8_t* tail = static_cast<uint8_t*>(ptr) + length;
+  size_t remaining = blockSize(classFor(osize)) - length;
+
+  while (remaining)
+  {
+    size_t piece = std::min(remaining, size_t(SMALL_LIMIT));
+    while (piece * 2 <= remaining)
+      piece *= 2;
+
+    release(tail, piece);
+    tail += piece;
+    remaining -= piece;
+  }
+}
+
+void* Arena::allocate(void* ud, void* ptr, size_t osize, size_t nsize)
+{
+  Arena* arena = static_cast<Arena*>(ud);
+
+  if (nsize == 0)
+  {
+    if (ptr)
+      arena->release(ptr, osize);
+    return nullptr;
+  }
+  /* when ptr is null osize encodes the type of the object */
+  else if (!ptr)
+    return arena->alloc(nsize);
+  else if (classFor(osize) == classFor(nsize))
+    return ptr;
+  /* Lua requires shrinking to never fail, the block is cut down where it is */
+  else if (nsize < osize)
+  {
+    arena->shrink(ptr, osize, nsize);
+    return ptr;
+  }
+
+  void* block = arena->alloc(nsize, blockSize(classFor(osize)));
+
+  if (!block)
+    return nullptr;
+
+  std::memcpy(block, ptr, std::min(osize, nsize));
+  arena->release(ptr, osize);
+  return block;
+}
+
+bool Arena::accepts(const void* data, size_t length) const
+{
+  if (!_base || length < sizeof(Header) || length > _capacity)
+    return false;
+
+  /* snapshot buffer might be unaligned */
+  size_t top;
+  std::memcpy(&top, static_cast<const uint8_t*>(data) + offsetof(Header, top), sizeof(top));
+  return top == length;
+}
+
+bool Arena::restore(const void* data, size_t length)
+{
+  if (!accepts(data, length))
+    return false;
+
+  std::memcpy(_base, data, length);
+  return true;
+}
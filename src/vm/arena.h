@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace retro8
+{
+  /* fixed size region backing the Lua heap: blocks are carved out of a single buffer and recycled
+     through per size class free lists, the bookkeeping lives at the start of the buffer itself so
+     the whole heap can be snapshotted and restored in place with a single copy */
+  class Arena
+  {
+  public:
+    static constexpr size_t MIN_BLOCK_SHIFT = 4;
+    /* strings, tables, closures and small arrays get a class every 16 bytes up to this size,
+       bigger blocks use power of two classes */
+    static constexpr size_t SMALL_CLASS_COUNT = 16;
+    static constexpr size_t SMALL_LIMIT = SMALL_CLASS_COUNT << MIN_BLOCK_SHIFT;
+    static constexpr size_t LARGE_CLASS_COUNT = 24;
+    static constexpr size_t CLASS_COUNT = SMALL_CLASS_COUNT + LARGE_CLASS_COUNT;
+
+  private:
+    struct Header
+    {
+      size_t top;
+      size_t used;
+      size_t peak;
+      /* offsets from base of the first free block of each class, 0 is empty */
+      uint32_t freeLists[CLASS_COUNT];
+    };
+
+    uint8_t* _base;
+    size_t _capacity;
+    size_t _limit;
+
+    Header* header() { return reinterpret_cast<Header*>(_base); }
+    const Header* header() const { return reinterpret_cast<const Header*>(_base); }
+
+    static size_t classFor(size_t size);
+    static size_t blockSize(size_t cls)
+    {
+      return cls < SMALL_CLASS_COUNT ? (cls + 1) << MIN_BLOCK_SHIFT : SMALL_LIMIT << (cls - SMALL_CLASS_COUNT + 1);
+    }
+
+    /* freed is the size of a block released right after, it doesn't count against the limit */
+    void* alloc(size_t size, size_t freed = 0);
+    void release(void* ptr, size_t size);
+    /* keeps the start of a block and gives back the rest, nsize must be in a smaller class */
+    void shrink(void* ptr, size_t osize, size_t nsize);
+
+  public:
+    Arena() : _base(nullptr), _capacity(0), _limit(SIZE_MAX) { }
+    ~Arena();
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    bool init(size_t capacity);
+    /* allocations fail once they would bring used() over limit, Lua then collects and raises
+       a memory error if that is not enough */
+    void setLimit(size_t limit) { _limit = limit; }
+    size_t limit() const { return _limit; }
+
+    /* lua_Alloc compatible entry point, ud must be the arena */
+    static void* allocate(void* ud, void* ptr, size_t osize, size_t nsize);
+
+    const uint8_t* base() const { return _base; }
+    size_t capacity() const { return _capacity; }
+    /* bytes that must be copied to snapshot the heap */
+    size_t extent() const { return _base ? header()->top : 0; }
+    /* bytes currently handed out to Lua, rounded to block sizes */
+    size_t used() const { return _base ? header()->used : 0; }
+    /* highest used() since init */
+    size_t peak() const { return _base ? header()->peak : 0; }
+
+    /* whether a snapshot taken from extent() bytes can be restored */
+    bool accepts(const void* data, size_t length) const;
+    bool restore(const void* data, size_t length);
+  };
+}
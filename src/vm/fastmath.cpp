@@ -0,0 +1,131 @@
+#include "fastmath.h"
+
+#include <cmath>
+
+using namespace retro8;
+
+namespace
+{
+  /* segments of the sine table over a quarter turn and of the arctangent table over [0, 1] */
+  constexpr int SINE_BITS = 9;
+  constexpr int ATAN_BITS = 8;
+  constexpr int QUARTER_BITS = 14;
+
+  /* entries are 2.30 so that interpolation keeps more precision than the 16.16 result */
+  constexpr int TABLE_BITS = 30;
+  constexpr int ROUND_SHIFT = TABLE_BITS - 16;
+
+  struct Tables
+  {
+    int32_t sine[(1 << SINE_BITS) + 1];
+    int32_t atan[(1 << ATAN_BITS) + 1];
+
+    Tables()
+    {
+      const double PI = 3.14159265358979323846, ONE = 1 << TABLE_BITS;
+
+      for (int i = 0; i <= (1 << SINE_BITS); ++i)
+        sine[i] = int32_t(std::floor(std::sin(i * PI / (2 << SINE_BITS)) * ONE + 0.5));
+
+      for (int i = 0; i <= (1 << ATAN_BITS); ++i)
+        atan[i] = int32_t(std::floor(std::atan(double(i) / (1 << ATAN_BITS)) / (2 * PI) * ONE + 0.5));
+    }
+  };
+
+  const Tables tables;
+
+  /* x has fractionBits below the table index, the result is rounded to 16.16 */
+  inline int32_t lookup(const int32_t* table, uint32_t x, int fractionBits)
+  {
+    const uint32_t i = x >> fractionBits, f = x & ((1u << fractionBits) - 1);
+
+    int32_t value = table[i];
+    if (f)
+      value += ((table[i + 1] - table[i]) * int32_t(f)) >> fractionBits;
+
+    return (value + (1 << (ROUND_SHIFT - 1))) >> ROUND_SHIFT;
+  }
+}
+
+fix16 fastmath::sine(fix16 turns)
+{
+  /* only the fraction matters, the upper two bits of it are the quadrant */
+  const uint32_t angle = uint32_t(turns.bits()) & 0xffff;
+  const uint32_t quadrant = angle >> QUARTER_BITS, offset = angle & ((1 << QUARTER_BITS) - 1);
+
+  const int32_t value = lookup(tables.sine, (quadrant & 1) ? (1 << QUARTER_BITS) - offset : offset, QUARTER_BITS - SINE_BITS);
+  return fix16::raw((quadrant & 2) ? -value : value);
+}
+
+fix16 fastmath::atan2(fix16 dx, fix16 dy)
+{
+  const int64_t x = dx.bits(), y = -int64_t(dy.bits());
+  const uint64_t ax = x < 0 ? -x : x, ay = y < 0 ? -y : y;
+
+  if (!ax && !ay)
+    return fix16::raw(fix16::ONE / 4);
+
+  /* first octant from the ratio of the smaller component to the larger one, then mirrored */
+  int32_t angle;
+  if (ay <= ax)
+    angle = lookup(tables.atan, uint32_t((ay << 16) / ax), 16 - ATAN_BITS);
+  else
+    angle = (1 << QUARTER_BITS) - lookup(tables.atan, uint32_t((ax << 16) / ay), 16 - ATAN_BITS);
+
+  if (x < 0)
+    angle = (2 << QUARTER_BITS) - angle;
+  if (y < 0)
+    angle = (4 << QUARTER_BITS) - angle;
+
+  return fix16::raw(angle & 0xffff);
+}
+
+fix16 fastmath::sqrt(fix16 value)
+{
+  if (value.bits() <= 0)
+    return fix16();
+
+  /* digit by digit on 32 bits, the integer part first and then the 8 remaining bits of the
+     16.16 root with the remainder shifted up */
+  uint32_t num = value.bits(), result = 0, bit = 1u << 30;
+  while (bit > num)
+    bit >>= 2;
+
+  for (int pass = 0; pass < 2; ++pass)
+  {
+    while (bit)
+    {
+      if (num >= result + bit)
+      {
+        num -= result + bit;
+        result = (result >> 1) + bit;
+      }
+      else
+        result >>= 1;
+      bit >>= 2;
+    }
+
+    if (pass == 0)
+    {
+      /* a remainder this large would overflow, so half of the next digit is accounted in advance */
+      if (num > 0xffff)
+      {
+        num -= result;
+        num = (num << 16) - 0x8000;
+        result = (result << 16) + 0x8000;
+      }
+      else
+      {
+        num <<= 16;
+        result <<= 16;
+      }
+
+      bit = 1 << 14;
+    }
+  }
+
+  if (num > result)
+    ++result;
+
+  return fix16::raw(int32_t(result));
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include "fix16.h"
+
+namespace retro8
+{
+  /* PICO-8 math kernels on 16.16 values with angles in turns, trigonometry interpolates a quarter wave sine
+     table and an arctangent table, square root is computed on integers. Used by the bindings unless
+     R8_LIBM_MATH is set */
+  namespace fastmath
+  {
+    /* sin(2 * pi * turns), PICO-8 sin() is inverted so it returns the negated value */
+    fix16 sine(fix16 turns);
+
+    inline fix16 sin(fix16 turns) { return -sine(turns); }
+    inline fix16 cos(fix16 turns) { return sine(turns + fix16::raw(fix16::ONE / 4)); }
+
+    /* direction of (dx, dy) in turns in [0, 1) with y pointing down, 0.25 when both are 0 */
+    fix16 atan2(fix16 dx, fix16 dy);
+
+    /* 0 for negative values */
+    fix16 sqrt(fix16 value);
+  }
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <type_traits>
+
+namespace retro8
+{
+  /* PICO-8 number, 16 integer bits and 16 fractional bits. With R8_FIXED_POINT Lua numbers hold these
+     bits directly and the bindings receive them as fix16, which converts to integers by flooring like
+     PICO-8 does for coordinates and colors */
+  class fix16
+  {
+  private:
+    int32_t _bits;
+
+    struct bits_tag { };
+    constexpr fix16(int32_t bits, bits_tag) : _bits(bits) { }
+
+  public:
+    static constexpr int32_t ONE = 1 << 16;
+
+    constexpr fix16() : _bits(0) { }
+
+    template<typename T, typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value, int>::type = 0>
+    explicit constexpr fix16(T value) : _bits(int32_t(uint32_t(value) << 16)) { }
+
+    template<typename T, typename std::enable_if<std::is_floating_point<T>::value, int>::type = 0>
+    explicit fix16(T value) : _bits(int32_t(uint32_t(int64_t(std::floor(double(value) * ONE + 0.5))))) { }
+
+    static constexpr fix16 raw(int32_t bits) { return fix16(bits, bits_tag()); }
+    constexpr int32_t bits() const { return _bits; }
+
+    constexpr operator int32_t() const { return _bits >> 16; }
+    explicit operator float() const { return _bits / float(ONE); }
+
+    fix16 operator-() const { return raw(int32_t(0u - uint32_t(_bits))); }
+    fix16 operator+(fix16 o) const { return raw(int32_t(uint32_t(_bits) + uint32_t(o._bits))); }
+    fix16 operator-(fix16 o) const { return raw(int32_t(uint32_t(_bits) - uint32_t(o._bits))); }
+
+    bool operator==(fix16 o) const { return _bits == o._bits; }
+    bool operator!=(fix16 o) const { return _bits != o._bits; }
+    bool operator<(fix16 o) const { return _bits < o._bits; }
+    bool operator<=(fix16 o) const { return _bits <= o._bits; }
+    bool operator>(fix16 o) const { return _bits > o._bits; }
+    bool operator>=(fix16 o) const { return _bits >= o._bits; }
+  };
+
+  inline fix16 floor(fix16 v) { return fix16::raw(int32_t(uint32_t(v.bits()) & ~uint32_t(fix16::ONE - 1))); }
+  inline fix16 ceil(fix16 v) { return -floor(-v); }
+  inline fix16 abs(fix16 v) { return v.bits() < 0 ? -v : v; }
+}
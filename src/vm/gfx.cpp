@@ -60,3 +60,17 @@ void Font::load(const uint8_t* data)
         }
     }
 }
+
+void pair_remap_t::build(const palette_t& palette)
+{
+  for (size_t i = 0; i < table.size(); ++i)
+  {
+    const color_byte_t pair = color_byte_t(color_t(i & 0x0f), color_t(i >> 4));
+    entry_t& entry = table[i];
+
+    entry.value.setBoth(palette.get(pair.low()), palette.get(pair.high()));
+    entry.transparency =
+      (palette.transparent(pair.low()) ? LOW_TRANSPARENT : 0) |
+      (palette.transparent(pair.high()) ? HIGH_TRANSPARENT : 0);
+  }
+}
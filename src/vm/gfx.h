@@ -164,6 +164,38 @@ namespace retro8
       void transparent(color_t i, bool f) { colors[i] = f ? (colors[i] | 0x10) : (colors[i] & 0x0f); }
     };
 
+    /* draw palette expanded to byte pairs: a source byte holding two pixels maps
+       to the remapped byte and a 2 bit mask of its transparent nibbles */
+    class pair_remap_t
+    {
+    public:
+      static constexpr uint8_t LOW_TRANSPARENT = 0x01;
+      static constexpr uint8_t HIGH_TRANSPARENT = 0x02;
+
+      struct entry_t
+      {
+        color_byte_t value;
+        uint8_t transparency;
+      };
+
+    private:
+      std::array<entry_t, 256> table;
+
+    public:
+      void build(const palette_t& palette);
+
+      inline const entry_t& operator[](color_byte_t pair) const { return table[pair.value]; }
+      inline color_t get(color_t c) const { return table[c % COLOR_COUNT].value.low(); }
+      inline bool transparent(color_t c) const { return (table[c % COLOR_COUNT].transparency & LOW_TRANSPARENT) != 0; }
+
+      /* nibbles of the destination byte which must be preserved for a given transparency mask */
+      static inline uint8_t preserveMask(uint8_t transparency)
+      {
+        static constexpr uint8_t masks[] = { 0x00, 0x0f, 0xf0, 0xff };
+        return masks[transparency];
+      }
+    };
+
     struct clip_rect_t
     {
       uint8_t x0;
@@ -0,0 +1,198 @@
+#pragma once
+
+#include "common.h"
+#include "fix16.h"
+
+#include "lua/lua.hpp"
+
+#include <cmath>
+#include <cstddef>
+#include <type_traits>
+
+/*
+* compile time generation of lua_CFunction thunks from plain C++ functions, arguments are decoded
+* according to the parameter types and the result is pushed back:
+*
+*   color_t pget(coord_t x, coord_t y);
+*   lua_register(L, "pget", LUA_BIND(pget));
+*
+* integral and enum arguments are floored like PICO-8 does, missing arguments decode to zero and
+* opt<T> tells missing or nil ones apart. A lua_State* first parameter receives the state without
+* consuming an argument and a pushed result is returned by functions that push values on their own
+*/
+namespace lua
+{
+  template<typename T>
+  struct opt
+  {
+    T value;
+    bool present;
+
+    T value_or(T fallback) const { return present ? value : fallback; }
+  };
+
+  struct pushed
+  {
+    int count;
+  };
+
+  namespace binding
+  {
+    template<typename T>
+    using is_integer = std::integral_constant<bool, std::is_integral<T>::value && !std::is_same<T, bool>::value>;
+
+    /* integer subtype values are returned directly, others are floored, fixed point numbers are
+       floored by lua_tointegerx itself */
+    inline lua_Integer toInteger(lua_State* L, int i)
+    {
+      int isnum;
+      const lua_Integer value = lua_tointegerx(L, i, &isnum);
+#if R8_FIXED_POINT
+      return value;
+#else
+      return isnum ? value : lua_Integer(std::floor(lua_tonumberx(L, i, nullptr)));
+#endif
+    }
+
+    template<typename T, typename Enable = void> struct arg;
+
+    template<typename T>
+    struct arg<T, typename std::enable_if<is_integer<T>::value>::type>
+    {
+      static T get(lua_State* L, int i) { return static_cast<T>(toInteger(L, i)); }
+    };
+
+    template<typename T>
+    struct arg<T, typename std::enable_if<std::is_enum<T>::value>::type>
+    {
+      static T get(lua_State* L, int i) { return static_cast<T>(static_cast<typename std::underlying_type<T>::type>(toInteger(L, i))); }
+    };
+
+    template<> struct arg<bool>
+    {
+      static bool get(lua_State* L, int i) { return lua_toboolean(L, i) != 0; }
+    };
+
+    template<> struct arg<float>
+    {
+#if R8_FIXED_POINT
+      static float get(lua_State* L, int i) { return float(retro8::fix16::raw(lua_tonumberx(L, i, nullptr))); }
+#else
+      static float get(lua_State* L, int i) { return float(lua_tonumberx(L, i, nullptr)); }
+#endif
+    };
+
+    template<> struct arg<retro8::fix16>
+    {
+#if R8_FIXED_POINT
+      static retro8::fix16 get(lua_State* L, int i) { return retro8::fix16::raw(lua_tonumberx(L, i, nullptr)); }
+#else
+      static retro8::fix16 get(lua_State* L, int i) { return retro8::fix16(lua_tonumberx(L, i, nullptr)); }
+#endif
+    };
+
+    template<> struct arg<const char*>
+    {
+      static const char* get(lua_State* L, int i) { return lua_tolstring(L, i, nullptr); }
+    };
+
+    template<typename T>
+    struct arg<opt<T>>
+    {
+      static opt<T> get(lua_State* L, int i)
+      {
+        return lua_isnoneornil(L, i) ? opt<T>{ T(), false } : opt<T>{ arg<T>::get(L, i), true };
+      }
+    };
+
+    template<typename T, typename Enable = void> struct result;
+
+    /* integers keep the integer subtype with floats, with fixed point everything is a 16.16 number */
+    template<typename T>
+    struct result<T, typename std::enable_if<is_integer<T>::value || std::is_enum<T>::value>::type>
+    {
+#if R8_FIXED_POINT
+      static int push(lua_State* L, T value) { lua_pushnumber(L, retro8::fix16(value).bits()); return 1; }
+#else
+      static int push(lua_State* L, T value) { lua_pushinteger(L, lua_Integer(value)); return 1; }
+#endif
+    };
+
+    template<> struct result<bool>
+    {
+      static int push(lua_State* L, bool value) { lua_pushboolean(L, value); return 1; }
+    };
+
+    template<> struct result<float>
+    {
+#if R8_FIXED_POINT
+      static int push(lua_State* L, float value) { lua_pushnumber(L, retro8::fix16(value).bits()); return 1; }
+#else
+      static int push(lua_State* L, float value) { lua_pushnumber(L, value); return 1; }
+#endif
+    };
+
+    template<> struct result<retro8::fix16>
+    {
+#if R8_FIXED_POINT
+      static int push(lua_State* L, retro8::fix16 value) { lua_pushnumber(L, value.bits()); return 1; }
+#else
+      static int push(lua_State* L, retro8::fix16 value) { lua_pushnumber(L, float(value)); return 1; }
+#endif
+    };
+
+    template<> struct result<const char*>
+    {
+      static int push(lua_State* L, const char* value) { lua_pushstring(L, value); return 1; }
+    };
+
+    template<> struct result<pushed>
+    {
+      static int push(lua_State*, pushed value) { return value.count; }
+    };
+
+    template<size_t... I> struct indices { };
+    template<size_t N, size_t... I> struct make_indices : make_indices<N - 1, N - 1, I...> { };
+    template<size_t... I> struct make_indices<0, I...> { using type = indices<I...>; };
+
+    template<typename R>
+    struct invoke
+    {
+      template<typename F, typename... A>
+      static int call(lua_State* L, F function, A... args) { return result<R>::push(L, function(args...)); }
+    };
+
+    template<>
+    struct invoke<void>
+    {
+      template<typename F, typename... A>
+      static int call(lua_State*, F function, A... args) { function(args...); return 0; }
+    };
+  }
+
+  /* pushes a value with the same conversion used for results */
+  template<typename T>
+  inline int push(lua_State* L, T value) { return binding::result<T>::push(L, value); }
+
+  template<typename Signature, Signature F> struct thunk;
+
+  template<typename R, typename... A, R(*F)(A...)>
+  struct thunk<R(*)(A...), F>
+  {
+    template<size_t... I>
+    static int call(lua_State* L, binding::indices<I...>) { return binding::invoke<R>::call(L, F, binding::arg<A>::get(L, int(I) + 1)...); }
+
+    static int function(lua_State* L) { return call(L, typename binding::make_indices<sizeof...(A)>::type()); }
+  };
+
+  template<typename R, typename... A, R(*F)(lua_State*, A...)>
+  struct thunk<R(*)(lua_State*, A...), F>
+  {
+    template<size_t... I>
+    static int call(lua_State* L, binding::indices<I...>) { return binding::invoke<R>::call(L, F, L, binding::arg<A>::get(L, int(I) + 1)...); }
+
+    static int function(lua_State* L) { return call(L, typename binding::make_indices<sizeof...(A)>::type()); }
+  };
+}
+
+#define LUA_BIND(f) (lua::thunk<decltype(&f), &f>::function)
@@ -3,11 +3,15 @@
 #include "machine.h"
 #include "lua/lua.hpp"
 #include "gen/lua_api.h"
+#include "savestate.h"
+#include "fastmath.h"
+#include "lua_binding.h"
 
 #include <functional>
 #include <iostream>
 #include <fstream>
 #include <cstring>
+#include <cstdlib>
 #include <cmath>
 
 #pragma warning(push)
@@ -16,275 +20,138 @@
 using namespace lua;
 using namespace retro8;
 
-using real_t = float;
-
-int pset(lua_State* L)
+namespace
 {
-  int args = lua_gettop(L);
-  //TODO: check validity of arguments
-
-  int x = lua_tonumber(L, 1);
-  int y = lua_tonumber(L, 2);
-  int c;
-
-  if (args == 3)
-    c = lua_tonumber(L, 3);
-  else
-    c = machine->memory().penColor()->low();
-
-  machine->pset(x, y, static_cast<color_t>(c));
-
-  return 0;
+  color_t penColor() { return machine->memory().penColor()->low(); }
 }
 
-int pget(lua_State* L)
+void pset(coord_t x, coord_t y, opt<color_t> c)
 {
-  int x = lua_tonumber(L, 1);
-  int y = lua_tonumber(L, 2);
-
-  lua_pushinteger(L, machine->pget(x, y));
-
-  return 1;
+  machine->pset(x, y, c.value_or(penColor()));
 }
 
-int color(lua_State* L)
+color_t pget(coord_t x, coord_t y)
 {
-  int c = lua_tonumber(L, 1);
-
-  machine->color(static_cast<color_t>(c));
-
-  return 0;
+  return machine->pget(x, y);
 }
 
-int line(lua_State* L)
+void color(color_t c)
 {
-  int x0 = lua_tonumber(L, 1);
-  int y0 = lua_tonumber(L, 2);
-  int x1 = lua_tonumber(L, 3);
-  int y1 = lua_tonumber(L, 4);
-
-  int c = lua_gettop(L) == 5 ? lua_tonumber(L, 5) : machine->memory().penColor()->low();
-
-  machine->line(x0, y0, x1, y1, static_cast<color_t>(c));
+  machine->color(c);
+}
 
-  return 0;
+void line(coord_t x0, coord_t y0, coord_t x1, coord_t y1, opt<color_t> c)
+{
+  machine->line(x0, y0, x1, y1, c.value_or(penColor()));
 }
 
-int fillp(lua_State* L)
+void fillp()
 {
   //TODO: implement
-  return 0;
 }
 
-int rect(lua_State* L)
+void rect(coord_t x0, coord_t y0, coord_t x1, coord_t y1, opt<color_t> c)
 {
-  int x0 = lua_tonumber(L, 1);
-  int y0 = lua_tonumber(L, 2);
-  int x1 = lua_tonumber(L, 3);
-  int y1 = lua_tonumber(L, 4);
-
-  int c = lua_gettop(L) == 5 ? lua_tonumber(L, 5) : machine->memory().penColor()->low();
-
-  machine->rect(x0, y0, x1, y1, static_cast<color_t>(c));
-
-  return 0;
+  machine->rect(x0, y0, x1, y1, c.value_or(penColor()));
 }
 
 // TODO: fill pattern on filled shaped
-int rectfill(lua_State* L)
+void rectfill(coord_t x0, coord_t y0, coord_t x1, coord_t y1, opt<color_t> c)
 {
-  int x0 = lua_tonumber(L, 1);
-  int y0 = lua_tonumber(L, 2);
-  int x1 = lua_tonumber(L, 3);
-  int y1 = lua_tonumber(L, 4);
-
-  int c = lua_gettop(L) >= 5 ? lua_tonumber(L, 5) : machine->memory().penColor()->low();
-
-  machine->rectfill(x0, y0, x1, y1, static_cast<color_t>(c));
-
-  return 0;
+  machine->rectfill(x0, y0, x1, y1, c.value_or(penColor()));
 }
 
-int circ(lua_State* L)
+void circ(coord_t x, coord_t y, opt<amount_t> r, opt<color_t> c)
 {
-  int x = lua_tonumber(L, 1);
-  int y = lua_tonumber(L, 2);
-  int r = lua_gettop(L) >= 3 ? lua_tonumber(L, 3) : 4;
-  int c = lua_gettop(L) >= 4 ? lua_tonumber(L, 4) : machine->memory().penColor()->low();
-
-  machine->circ(x, y, r, static_cast<color_t>(c));
-
-  return 0;
+  machine->circ(x, y, r.value_or(4), c.value_or(penColor()));
 }
 
-int circfill(lua_State* L)
+void circfill(coord_t x, coord_t y, opt<amount_t> r, opt<color_t> c)
 {
-  int x = lua_tonumber(L, 1);
-  int y = lua_tonumber(L, 2);
-  int r = lua_gettop(L) >= 3 ? lua_tonumber(L, 3) : 4;
-  int c = lua_gettop(L) >= 4 ? lua_tonumber(L, 4) : machine->memory().penColor()->low();
-
-  machine->circfill(x, y, r, color_t(c));
-
-  return 0;
+  machine->circfill(x, y, r.value_or(4), c.value_or(penColor()));
 }
 
-int cls(lua_State* L)
+void cls(color_t c)
 {
-  int c = lua_gettop(L) == 1 ? lua_tonumber(L, -1) : 0;
-
-  machine->cls(color_t(c));
-
-  return 0;
+  machine->cls(c);
 }
 
-int spr(lua_State* L)
+void spr(index_t idx, coord_t x, coord_t y, opt<float> w, opt<float> h, bool fx, bool fy)
 {
-  assert(lua_isnumber(L, 2) && lua_isnumber(L, 3));
-
-  int idx = lua_tonumber(L, 1);
-  int x = lua_tonumber(L, 2);
-  int y = lua_tonumber(L, 3);
-
-  if (lua_gettop(L) > 3)
-  {
-    assert(lua_gettop(L) >= 5);
-
-    real_t w = lua_tonumber(L, 4);
-    real_t h = lua_tonumber(L, 5);
-    bool fx = false, fy = false;
-
-    if (lua_gettop(L) >= 6)
-      fx = lua_toboolean(L, 6);
-
-    if (lua_gettop(L) >= 7)
-      fy = lua_toboolean(L, 7);
-
-    machine->spr(idx, x, y, w, h, fx, fy);
-  }
+  if (w.present || h.present || fx || fy)
+    machine->spr(idx, x, y, w.value_or(1.0f), h.value_or(1.0f), fx, fy);
   else
     /* optimized path */
     machine->spr(idx, x, y);
-
-  return 0;
 }
 
-int sget(lua_State* L)
+color_t sget(coord_t x, coord_t y)
 {
-  int x = lua_tonumber(L, 1);
-  int y = lua_tonumber(L, 2);
-
-  lua_pushnumber(L, machine->memory().spriteSheet(x, y)->get(x));
-
-  return 1;
+  return machine->memory().spriteSheet(x, y)->get(x);
 }
 
-int sset(lua_State* L)
+void sset(coord_t x, coord_t y, opt<color_t> c)
 {
-  int x = lua_tonumber(L, 1);
-  int y = lua_tonumber(L, 2);
-  color_t c = lua_gettop(L) >= 3 ? color_t((int)lua_tonumber(L, 3)) : machine->memory().penColor()->low();
-
-  machine->memory().spriteSheet(x, y)->set(x, c);
-
-  return 0;
+  machine->memory().spriteSheet(x, y)->set(x, c.value_or(penColor()));
 }
 
 
-int pal(lua_State* L)
+void pal(opt<color_t> c0, color_t c1, opt<palette_index_t> index)
 {
   /* no arguments, reset palette */
-  if (lua_gettop(L) == 0)
+  if (!c0.present)
   {
     machine->memory().paletteAt(gfx::DRAW_PALETTE_INDEX)->reset();
     machine->memory().paletteAt(gfx::SCREEN_PALETTE_INDEX)->reset();
+    machine->memory().markPaletteDirty(gfx::DRAW_PALETTE_INDEX);
+    machine->memory().markPaletteDirty(gfx::SCREEN_PALETTE_INDEX);
   }
   else
-  {
-    int c0 = lua_tonumber(L, 1);
-    int c1 = lua_tonumber(L, 2);
-    palette_index_t index = gfx::DRAW_PALETTE_INDEX;
-
-    if (lua_gettop(L) == 3)
-      index = lua_tonumber(L, 3);
-
-    machine->pal(static_cast<color_t>(c0), static_cast<color_t>(c1), index);
-  }
-  return 0;
+    machine->pal(c0.value, c1, index.value_or(gfx::DRAW_PALETTE_INDEX));
 }
 
-int palt(lua_State* L)
+void palt(opt<color_t> c, bool f)
 {
   /* no arguments, reset palette */
-  if (lua_gettop(L) == 0)
+  if (!c.present)
   {
     machine->memory().paletteAt(gfx::DRAW_PALETTE_INDEX)->resetTransparency();
     machine->memory().paletteAt(gfx::SCREEN_PALETTE_INDEX)->resetTransparency();
+    machine->memory().markPaletteDirty(gfx::DRAW_PALETTE_INDEX);
+    machine->memory().markPaletteDirty(gfx::SCREEN_PALETTE_INDEX);
   }
   else
   {
-    color_t c = color_t(int(lua_tonumber(L, 1)));
-    int f = lua_toboolean(L, 2);
-
-    machine->memory().paletteAt(gfx::DRAW_PALETTE_INDEX)->transparent(c, f);
+    machine->memory().paletteAt(gfx::DRAW_PALETTE_INDEX)->transparent(c.value, f);
+    machine->memory().markPaletteDirty(gfx::DRAW_PALETTE_INDEX);
   }
-  return 0;
 }
 
 namespace draw
 {
-  int clip(lua_State* L)
+  void clip(opt<uint8_t> x0, uint8_t y0, uint8_t w, uint8_t h)
   {
-    if (lua_gettop(L) == 0)
+    if (!x0.present)
       machine->memory().clipRect()->reset();
     else
-    {
-      uint8_t x0 = lua_tonumber(L, 1);
-      uint8_t y0 = lua_tonumber(L, 2);
-      uint8_t w = lua_tonumber(L, 3);
-      uint8_t h = lua_tonumber(L, 4);
-
-      machine->memory().clipRect()->set(x0, y0, std::min<int32_t>(x0 + w, gfx::SCREEN_WIDTH-1), std::min<int32_t>(y0 + h, gfx::SCREEN_HEIGHT-1));
-    }
-
-    return 0;
+      machine->memory().clipRect()->set(x0.value, y0, std::min<int32_t>(x0.value + w, gfx::SCREEN_WIDTH-1), std::min<int32_t>(y0 + h, gfx::SCREEN_HEIGHT-1));
   }
 }
 
 
 
-int camera(lua_State* L)
+void camera(int16_t cx, int16_t cy)
 {
-  int16_t cx = lua_gettop(L) >= 1 ? lua_tonumber(L, 1) : 0;
-  int16_t cy = lua_gettop(L) == 2 ? lua_tonumber(L, 2) : 0;
   machine->memory().camera()->set(cx, cy);
-
-  return 0;
 }
 
-int map(lua_State* L)
+void map(coord_t cx, coord_t cy, coord_t x, coord_t y, opt<amount_t> cw, opt<amount_t> ch, sprite_flags_t layer)
 {
-  coord_t cx = lua_tonumber(L, 1);
-  coord_t cy = lua_tonumber(L, 2);
-  coord_t x = lua_tonumber(L, 3);
-  coord_t y = lua_tonumber(L, 4);
-  amount_t cw = lua_gettop(L) >= 5 ? lua_tonumber(L, 5) : (gfx::SCREEN_WIDTH / gfx::SPRITE_WIDTH);
-  amount_t ch = lua_gettop(L) >= 6 ? lua_tonumber(L, 6) : (gfx::SCREEN_HEIGHT / gfx::SPRITE_HEIGHT);
-  sprite_flags_t layer = 0;
-
-  if (lua_gettop(L) == 7)
-    layer = lua_tonumber(L, 7);
-
-  machine->map(cx, cy, x, y, cw, ch, layer);
-
-  return 0;
+  machine->map(cx, cy, x, y, cw.value_or(gfx::SCREEN_WIDTH / gfx::SPRITE_WIDTH), ch.value_or(gfx::SCREEN_HEIGHT / gfx::SPRITE_HEIGHT), layer);
 }
 
-int mget(lua_State* L)
+sprite_index_t mget(int x, int y)
 {
-  int x = lua_tonumber(L, 1); //TODO: these are optional
-  int y = lua_tonumber(L, 2);
-
   sprite_index_t index = 0;
 
   if (x >= 0 && x <= gfx::TILE_MAP_WIDTH && y >= 0 && y < gfx::TILE_MAP_HEIGHT)
@@ -292,449 +159,301 @@ int mget(lua_State* L)
 
   //printf("mget(%d, %d) = %d\n", x, y, index);
 
-  lua_pushnumber(L, index);
-
-  return 1;
+  return index;
 }
 
-int mset(lua_State* L)
+void mset(int x, int y, sprite_index_t index)
 {
-  int x = lua_tonumber(L, 1);
-  int y = lua_tonumber(L, 2);
-  retro8::sprite_index_t index = lua_tonumber(L, 3);
-
   *machine->memory().spriteInTileMap(x, y) = index;
-
-  return 0;
 }
 
-int print(lua_State* L)
+void print(const char* text, opt<coord_t> x, opt<coord_t> y, opt<color_t> c)
 {
   //TODO: optimize and use const char*?
-  std::string text = lua_tostring(L, 1);
+  if (!text)
+    text = "";
 
-  if (lua_gettop(L) == 1)
+  if (x.present && y.present)
+    machine->print(text, x.value, y.value, c.value_or(penColor()));
+  else
   {
     auto* cursor = machine->memory().cursor();
-
-    retro8::coord_t x = cursor->x();
-    retro8::coord_t y = cursor->y();
-    retro8::color_t c = machine->memory().penColor()->low();
-    machine->print(text, x, y, c);
+    machine->print(text, cursor->x(), cursor->y(), penColor());
     cursor->set(cursor->x(), cursor->y() + TEXT_LINE_HEIGHT); //TODO: check height
   }
-  else if (lua_gettop(L) >= 3)
-  {
-    int x = lua_tonumber(L, 2);
-    int y = lua_tonumber(L, 3);
-    int c = lua_gettop(L) == 4 ? lua_tonumber(L, 4) : machine->memory().penColor()->low();
-
-    machine->print(text, x, y, static_cast<retro8::color_t>(c));
-  }
-  else
-    assert(false);
-
-
-  return 0;
 }
 
-int cursor(lua_State* L)
+void cursor(opt<coord_t> x, coord_t y, opt<color_t> c)
 {
-  if (lua_gettop(L) >= 2)
+  if (x.present)
   {
-    int x = lua_tonumber(L, 1);
-    int y = lua_tonumber(L, 2);
-    *machine->memory().cursor() = { (uint8_t)x, (uint8_t)y };
+    *machine->memory().cursor() = { (uint8_t)x.value, (uint8_t)y };
 
-    if (lua_gettop(L) == 3)
-    {
-      retro8::color_t color = static_cast<retro8::color_t>((int)lua_tonumber(L, 2));
-      machine->memory().penColor()->low(color);
-    }
+    if (c.present)
+      machine->memory().penColor()->low(c.value);
   }
   else
     *machine->memory().cursor() = { 0, 0 };
-
-  return 0;
 }
 
 namespace debug
 {
-  int debugprint(lua_State* L)
+  void debugprint(const char* text)
   {
-    std::string text = lua_tostring(L, 1);
-    std::cout << text << std::endl;
-
-    return 0;
+    std::cout << (text ? text : "") << std::endl;
   }
 
-  int breakpoint(lua_State* L)
+  void breakpoint()
   {
 #if _WIN32
     __debugbreak();
 #endif
-    return 0;
   }
 }
 
 
 namespace sprites
 {
-  int fget(lua_State* L)
+  pushed fget(lua_State* L, sprite_index_t index, opt<int> flag)
   {
-    retro8::sprite_index_t index = lua_tonumber(L, 1);
     retro8::sprite_flags_t flags = *machine->memory().spriteFlagsFor(index);
 
-    if (lua_gettop(L) == 2)
+    if (flag.present)
     {
-      int index = lua_tonumber(L, 2);
-      assert(index >= 0 && index <= 7);
-      lua_pushboolean(L, (flags >> index) & 0x1 ? true : false);
+      assert(flag.value >= 0 && flag.value <= 7);
+      return { push(L, (flags >> flag.value) & 0x1 ? true : false) };
     }
     else
-      lua_pushnumber(L, *machine->memory().spriteFlagsFor(index));
-
-    return 1;
+      return { push(L, flags) };
   }
 
-  int fset(lua_State* L)
+  void fset(sprite_index_t index, int flag, opt<bool> value)
   {
-    retro8::sprite_index_t index = lua_tonumber(L, 1);
     retro8::sprite_flags_t* flags = machine->memory().spriteFlagsFor(index);
 
-    if (lua_gettop(L) == 3)
+    if (value.present)
     {
-      int index = lua_tonumber(L, 2);
-      bool value = lua_toboolean(L, 3);
-      assert(index >= 0 && index <= 7);
+      assert(flag >= 0 && flag <= 7);
 
-      if (value)
-        *flags = *flags | (1 << index);
+      if (value.value)
+        *flags = *flags | (1 << flag);
       else
-        *flags = *flags & ~(1 << index);
+        *flags = *flags & ~(1 << flag);
     }
     else
-    {
-      retro8::sprite_flags_t value = lua_tonumber(L, 2);
-      *flags = value;
-    }
-
-    return 0;
+      *flags = retro8::sprite_flags_t(flag);
   }
 
-  int sspr(lua_State* L)
+  void sspr(coord_t sx, coord_t sy, coord_t sw, coord_t sh, coord_t dx, coord_t dy, opt<coord_t> dw, opt<coord_t> dh, bool flipX, bool flipY)
   {
-    coord_t sx = lua_tonumber(L, 1);
-    coord_t sy = lua_tonumber(L, 2);
-    coord_t sw = lua_tonumber(L, 3);
-    coord_t sh = lua_tonumber(L, 4);
-    coord_t dx = lua_tonumber(L, 5);
-    coord_t dy = lua_tonumber(L, 6);
-    coord_t dw = lua_to_or_default(L, number, 7, sw);
-    coord_t dh = lua_to_or_default(L, number, 8, sh);
-    bool flipX = lua_to_or_default(L, boolean, 8, false);
-    bool flipY = lua_to_or_default(L, boolean, 8, false);
-
-    machine->sspr(sx, sy, sw, sh, dx, dy, dw, dh, flipX, flipY);
-
-    return 0;
+    machine->sspr(sx, sy, sw, sh, dx, dy, dw.value_or(sw), dh.value_or(sh), flipX, flipY);
   }
 }
 
 namespace math
 {
+#if R8_FIXED_POINT
+  using real_t = retro8::fix16;
+  namespace real = retro8;
+#else
   using real_t = float;
+  namespace real = std;
+#endif
   static constexpr float PI = 3.14159265358979323846;
 
-  int cos(lua_State* L)
+#if R8_LIBM_MATH || !R8_FIXED_POINT
+  float libmAtan2(float dx, float dy)
   {
-    if (lua_isnumber(L, 1))
-    {
-      real_t angle = lua_tonumber(L, 1);
-      real_t value = std::cos(angle * 2 * PI);
-      lua_pushnumber(L, value);
-    }
-    else
-      lua_pushnumber(L, 0);
+    float value = std::atan2(dx, dy) / (2 * PI) - 0.25;
+    if (value < 0.0)
+      value += 1.0;
+    if (dx == 0 && dy == 0)
+      value = 0.25;
 
-    return 1;
+    return value;
   }
+#endif
 
-  int sin(lua_State* L)
+#if R8_LIBM_MATH
+  float cos(float angle)
   {
-    if (lua_isnumber(L, 1))
-    {
-      real_t angle = lua_tonumber(L, 1);
-      real_t value = std::sin(-angle * 2 * PI);
-      lua_pushnumber(L, value);
-    }
-    else
-      lua_pushnumber(L, 0);
-
-    return 1;
+    return std::cos(angle * 2 * PI);
   }
 
-  int atan2(lua_State* L)
+  float sin(float angle)
   {
-    assert(lua_isnumber(L, 1));
-    real_t dx = lua_tonumber(L, 1);
-    real_t dy = lua_tonumber(L, 2);
-    real_t value = std::atan2(dx, dy) / (2 * PI) - 0.25;
-    if (value < 0.0)
-      value += 1.0;
-
-    lua_pushnumber(L, value);
-
-    return 1;
+    return std::sin(-angle * 2 * PI);
   }
 
-  int srand(lua_State* L)
-  {
-    assert(lua_gettop(L) == 1);
-    assert(lua_isnumber(L, 1));
-
-    real_t seed = lua_tonumber(L, 1);
-    machine->state().rnd.seed(seed);
+  float atan2(float dx, float dy) { return libmAtan2(dx, dy); }
 
-    return 0;
+  float sqrt(float v)
+  {
+    return std::sqrt(v);
+  }
+#elif R8_FIXED_POINT
+  fix16 cos(fix16 angle) { return fastmath::cos(angle); }
+  fix16 sin(fix16 angle) { return fastmath::sin(angle); }
+  fix16 atan2(fix16 dx, fix16 dy) { return fastmath::atan2(dx, dy); }
+  fix16 sqrt(fix16 v) { return fastmath::sqrt(v); }
+#else
+  /* angles can go through 16.16 values since dropping whole turns doesn't change the result, other
+     arguments would wrap past 32767 so floats outside that range keep using libm */
+  float cos(float angle) { return float(fastmath::cos(fix16(angle))); }
+  float sin(float angle) { return float(fastmath::sin(fix16(angle))); }
+
+  float atan2(float dx, float dy)
+  {
+    if (std::abs(dx) < 32767.0f && std::abs(dy) < 32767.0f)
+      return float(fastmath::atan2(fix16(dx), fix16(dy)));
+    return libmAtan2(dx, dy);
   }
 
-#define FAIL_IF_NOT_NUMBER(i) do { if (!lua_isnumber(L, i)) { printf("Expected number but got %s\n", lua_typename(L, i)); assert(false); } } while (false)
+  /* 16.16 would also cut the precision of the result */
+  float sqrt(float v) { return v > 0.0f ? std::sqrt(v) : 0.0f; }
+#endif
 
-  int rnd(lua_State* L)
+  void srand(opt<int32_t> seed)
   {
-    real_t max = lua_gettop(L) >= 1 ? lua_tonumber(L, 1) : 1.0f;
-    lua_pushnumber(L, (machine->state().rnd() / (float)machine->state().rnd.max()) * max);
-
-    return 1;
+    /* without an explicit seed the frame clock is used so that runs stay reproducible */
+    machine->state().rnd.seed(seed.present ? uint32_t(seed.value) : machine->state().clock);
   }
 
-  int flr(lua_State* L)
+  real_t rnd(opt<real_t> limit)
   {
-    real_t value = lua_isnumber(L, 1) ? lua_tonumber(L, 1) : 0;
-    lua_pushnumber(L, std::floor(value));
-    return 1;
+    const real_t max = limit.value_or(real_t(1));
+#if R8_FIXED_POINT
+    /* scales the 32 random bits to [0, max) without leaving integers */
+    const uint64_t bits = machine->state().rnd();
+    return real_t::raw(int32_t((bits * uint32_t(max.bits())) >> 32));
+#else
+    return (machine->state().rnd() / (float)machine->state().rnd.max()) * max;
+#endif
   }
 
-  int ceil(lua_State* L)
+  real_t flr(real_t value)
   {
-    real_t value = lua_isnumber(L, 1) ? lua_tonumber(L, 1) : 0;
-    lua_pushnumber(L, std::ceil(value));
-    return 1;
+    return real::floor(value);
   }
 
-
-  int min(lua_State* L)
+  real_t ceil(real_t value)
   {
-    real_t v1 = lua_isnumber(L, 1) ? lua_tonumber(L, 1) : 0;
-    real_t v2 = 0;
-
-    if (lua_gettop(L) == 2 && lua_isnumber(L, 2))
-      v2 = lua_tonumber(L, 2);
+    return real::ceil(value);
+  }
 
-    lua_pushnumber(L, std::min(v1, v2));
 
-    return 1;
+  real_t min(real_t v1, real_t v2)
+  {
+    return std::min(v1, v2);
   }
 
-  int max(lua_State* L)
+  real_t max(real_t v1, real_t v2)
   {
-    real_t v1 = lua_isnumber(L, 1) ? lua_tonumber(L, 1) : 0;
-    real_t v2 = 0;
-
-    if (lua_gettop(L) == 2 && lua_isnumber(L, 2))
-    {
-      FAIL_IF_NOT_NUMBER(2);
-      v2 = lua_tonumber(L, 2);
-    }
-
-    lua_pushnumber(L, std::max(v1, v2));
-
-    return 1;
+    return std::max(v1, v2);
   }
 
-  int mid(lua_State* L)
+  real_t mid(real_t a, real_t b, real_t c)
   {
-    real_t a = lua_tonumber(L, 1);
-    real_t b = lua_tonumber(L, 2);
-    real_t c = lua_gettop(L) >= 3 ? lua_tonumber(L, 3) : 0;
-
     if ((a <= b && b <= c) || (c <= b && b <= a))
-      lua_pushnumber(L, b);
+      return b;
     else if ((b <= a && a <= c) || (c <= a && a <= b))
-      lua_pushnumber(L, a);
-    else
-      lua_pushnumber(L, c);
-
-    return 1;
-  }
-
-  int abs(lua_State* L)
-  {
-    if (lua_isnumber(L, 1))
-    {
-      real_t v = lua_tonumber(L, 1);
-      lua_pushnumber(L, std::abs(v));
-    }
+      return a;
     else
-      lua_pushnumber(L, 0);
-
-    return 1;
+      return c;
   }
 
-  int sgn(lua_State* L)
+  real_t abs(real_t v)
   {
-    assert(lua_isnumber(L, 1));
-
-    real_t v = lua_tonumber(L, 1);
-    lua_pushnumber(L, v > 0 ? 1.0 : -1.0);
-
-    return 1;
+    return real::abs(v);
   }
 
-  int sqrt(lua_State* L)
+  int32_t sgn(real_t v)
   {
-    assert(lua_isnumber(L, 1));
-
-    real_t v = lua_tonumber(L, 1);
-    lua_pushnumber(L, sqrtf(v));
-
-    return 1;
+    return v < real_t(0) ? -1 : 1;
   }
 }
 
-#define EXPECT_TYPE(tn, idx) do { if (!lua_is ## tn(L, idx)) std::cout << "expected " # tn << " but got " << lua_typename(L, idx) << std::endl; assert(false);} while (false)
-
 namespace bitwise
 {
+  /* PICO-8 bitwise functions work on the raw 16.16 bits in both number representations */
   using data_t = uint32_t;
   static constexpr size_t DATA_WIDTH = 32;
 
-  template<typename F>
-  int bitwise(lua_State* L)
-  {
-    if (lua_isnumber(L, 1) && lua_isnumber(L, 2))
-    {
-      data_t a = lua_tonumber(L, 1);
-      data_t b = lua_tonumber(L, 2);
-
-      lua_pushnumber(L, F()(a, b));
-    }
-    else
-      lua_pushnumber(L, 0);
-
+  inline data_t bits(fix16 value) { return data_t(value.bits()); }
+  inline fix16 number(data_t value) { return fix16::raw(int32_t(value)); }
 
-    return 1;
-  }
+  fix16 band(fix16 a, fix16 b) { return number(bits(a) & bits(b)); }
+  fix16 bor(fix16 a, fix16 b) { return number(bits(a) | bits(b)); }
+  fix16 bxor(fix16 a, fix16 b) { return number(bits(a) ^ bits(b)); }
+  fix16 bnot(fix16 a) { return number(~bits(a)); }
 
-  struct shift_left
-  {
-    data_t operator()(data_t v, data_t a) { return v << a; }
-  };
+  /* shift amounts are whole numbers, shifting everything out gives 0 or the sign for shr */
+  fix16 shl(fix16 v, data_t a) { return number(a < DATA_WIDTH ? bits(v) << a : 0); }
+  fix16 shr(fix16 v, data_t a) { return fix16::raw(a < DATA_WIDTH ? v.bits() >> a : (v.bits() < 0 ? -1 : 0)); }
 
-  struct shift_right
-  {
-    data_t operator()(data_t v, data_t a) { return v >> a; }
-  };
+  fix16 lshl(fix16 v, data_t a) { return shl(v, a); }
+  fix16 lshr(fix16 v, data_t a) { return number(a < DATA_WIDTH ? bits(v) >> a : 0); }
 
-  struct rotate_left
+  fix16 rotl(fix16 v, data_t a)
   {
-    data_t operator()(data_t v, data_t a) { return (v << a) | (v >> (DATA_WIDTH - a)); }
-  };
-
-  struct rotate_right
-  {
-    data_t operator()(data_t v, data_t a) { return (v >> a) | (v << (DATA_WIDTH - a)); }
-  };
-
-  inline int band(lua_State* L) { return bitwise<std::bit_and<data_t>>(L); }
-  inline int bor(lua_State* L) { return bitwise<std::bit_or<data_t>>(L); }
-  inline int bxor(lua_State* L) { return bitwise<std::bit_xor<data_t>>(L); }
-
-  //TODO FIXME: fixme check implementation of logical and arithmetic shifts here
-
-  inline int shl(lua_State* L) { return bitwise<shift_left>(L); }
-  inline int shr(lua_State* L) { return bitwise<shift_right>(L); }
-  
-  inline int lshl(lua_State* L) { return bitwise<shift_left>(L); }
-  inline int lshr(lua_State* L) { return bitwise<shift_right>(L); }
-  
-  inline int rotl(lua_State* L) { return bitwise<rotate_left>(L); }
-  inline int rotr(lua_State* L) { return bitwise<rotate_right>(L); }
-
+    a %= DATA_WIDTH;
+    return number(a ? (bits(v) << a) | (bits(v) >> (DATA_WIDTH - a)) : bits(v));
+  }
 
-  int bnot(lua_State* L)
+  fix16 rotr(fix16 v, data_t a)
   {
-    assert(lua_isnumber(L, 1));
-
-    data_t a = lua_tonumber(L, 1);
-
-    lua_pushnumber(L, std::bit_not<data_t>()(a));
-
-    return 1;
+    a %= DATA_WIDTH;
+    return number(a ? (bits(v) >> a) | (bits(v) << (DATA_WIDTH - a)) : bits(v));
   }
 }
 
 namespace sound
 {
-  int music(lua_State* L)
+  void music(sfx::music_index_t index, opt<int32_t> fadeMs, int32_t mask)
   {
 #if SOUND_ENABLED
-    sfx::music_index_t index = lua_tonumber(L, 1);
-    int32_t fadeMs = lua_to_or_default(L, number, 2, 1);
-    int32_t mask = lua_to_or_default(L, number, 3, 0);
-
-    machine->sound().music(index, fadeMs, mask);
+    machine->sound().music(index, fadeMs.value_or(1), mask);
 #endif
-
-    return 0;
   }
 
-  int sfx(lua_State* L)
+  void sfx(sfx::sound_index_t index, opt<sfx::channel_index_t> channel, int32_t start, opt<int32_t> end)
   {
 #if SOUND_ENABLED
-    sfx::sound_index_t index = lua_tonumber(L, 1);
-    sfx::channel_index_t channel = lua_to_or_default(L, number, 2, -1);
-    int32_t start = lua_to_or_default(L, number, 3, 0);
-    int32_t end = lua_to_or_default(L, number, 3, machine->memory().sound(index)->length());
-
-    machine->sound().play(index, channel, start, end);
+    machine->sound().play(index, channel.value_or(-1), start, end.value_or(machine->memory().sound(index)->length()));
 #endif
-
-    return 0;
   }
 }
 
 namespace string
 {
-  int sub(lua_State* L)
+  pushed sub(lua_State* L, const char* v, int32_t s, opt<int32_t> e)
   {
-    const std::string v = lua_tostring(L, 1);
-    size_t s = lua_tonumber(L, 2);
-    size_t e = lua_to_or_default(L, number, 3, -1);
+    const int32_t len = v ? int32_t(std::strlen(v)) : 0;
+    int32_t end = e.value_or(-1);
 
-    size_t len = v.length();
+    /* negative indices count from the end like string.sub */
     if (s < 0)
-      s = len - s + 1;
-    if (e < 0)
-      e = len - e + 1;
+      s = len + s + 1;
+    if (end < 0)
+      end = len + end + 1;
+    if (end > len)
+      end = len;
 
     // TODO: intended behavior? picotetris calls it with swapped indices
-    if (e < s || s > len)
+    if (end < s || s > len)
       lua_pushstring(L, "");
     else
     {
-      if (s == 0)
+      if (s <= 0)
         s = 1;
 
-      lua_pushstring(L, v.substr(s - 1, e - s + 1).c_str());
+      lua_pushlstring(L, v + s - 1, end - s + 1);
     }
 
-
-    return 1;
+    return { 1 };
   }
 
-  int tostr(lua_State* L)
+  pushed tostr(lua_State* L)
   {
     //TODO implement
 
@@ -745,155 +464,123 @@ namespace string
     case LUA_TBOOLEAN: lua_pushstring(L, lua_toboolean(L, 1) ? "true" : "false"); break;
     case LUA_TNUMBER:
     {
+#if R8_FIXED_POINT
+      /* Lua already formats fixed point numbers with at most 4 decimals */
+      lua_pushvalue(L, 1);
+      lua_tolstring(L, -1, nullptr);
+#else
       snprintf(buffer, 20, "% 4.4f", lua_tonumber(L, 1));
       lua_pushstring(L, buffer);
+#endif
       break;
     }
     case LUA_TSTRING: lua_pushstring(L, lua_tostring(L, 1)); break;
     default: lua_pushstring(L, "foo");
     }
 
-    return 1;
+    return { 1 };
   }
 
-  int tonum(lua_State* L)
+  int32_t tonum(const char* string)
   {
     //TODO implement
-    const char* string = lua_tostring(L, 1);
-
-    lua_pushnumber(L, 0);
-
-    return 1;
+    return 0;
   }
 }
 
 namespace platform
 {
-  int poke(lua_State* L)
+  void poke(address_t addr, uint8_t byte)
   {
-    address_t addr = lua_tonumber(L, 1);
-    uint8_t byte = lua_tonumber(L, 2);
-
     machine->memory().base()[addr] = byte;
-
-    return 0;
+    machine->memory().markDirty(addr, 1);
   }
 
-  int poke2(lua_State* L)
+  void poke2(address_t addr, uint32_t value)
   {
-    address_t addr = lua_tonumber(L, 1);
-    uint32_t value = lua_tonumber(L, 2);
-
     machine->memory().base()[addr] = value & 0xFF;
     machine->memory().base()[addr+1] = (value & 0xFF00) >> 8;
-
-    return 0;
+    machine->memory().markDirty(addr, 2);
   }
 
-  int poke4(lua_State* L)
+  /* 32 bit values are the raw 16.16 bits like in PICO-8 */
+  void poke4(address_t addr, fix16 number)
   {
-    address_t addr = lua_tonumber(L, 1);
-    uint32_t value = lua_tonumber(L, 2);
+    const uint32_t value = number.bits();
 
     machine->memory().base()[addr] = value & 0xFF;
     machine->memory().base()[addr + 1] = (value & 0xFF00) >> 8;
     machine->memory().base()[addr + 2] = (value & 0xFF0000) >> 16;
     machine->memory().base()[addr + 3] = (value & 0xFF000000) >> 24;
-
-    return 0;
+    machine->memory().markDirty(addr, 4);
   }
 
-  int peek(lua_State* L)
+  uint8_t peek(address_t addr)
   {
-    address_t addr = lua_tonumber(L, 1);
-    uint8_t value = machine->memory().base()[addr];
-
-    lua_pushnumber(L, value);
-
-    return 1;
+    return machine->memory().base()[addr];
   }
 
-  int peek2(lua_State* L)
+  int32_t peek2(address_t addr)
   {
-    address_t addr = lua_tonumber(L, 1);
     uint8_t low = machine->memory().base()[addr];
     uint8_t high = machine->memory().base()[addr+1];
 
-    lua_pushnumber(L, (low | high << 8));
-
-    return 1;
+    return low | high << 8;
   }
 
-  int peek4(lua_State* L)
+  fix16 peek4(address_t addr)
   {
-    address_t addr = lua_tonumber(L, 1);
     uint8_t b1 = machine->memory().base()[addr];
     uint8_t b2 = machine->memory().base()[addr + 1];
     uint8_t b3 = machine->memory().base()[addr + 2];
     uint8_t b4 = machine->memory().base()[addr + 3];
 
-    lua_pushnumber(L, b1 | (b2 << 8) | (b3 << 16) | (b4 << 24));
-
-    return 1;
+    return fix16::raw(b1 | (b2 << 8) | (b3 << 16) | (b4 << 24));
   }
 
-  int memset(lua_State* L)
+  void memset(address_t addr, uint8_t value, int32_t length)
   {
-    address_t addr = lua_tonumber(L, 1);
-    uint8_t value = lua_tonumber(L, 2);
-    int32_t length = lua_tonumber(L, 3);
-
     if (length > 0)
+    {
       std::memset(machine->memory().base() + addr, value, length);
-
-    return 0;
+      machine->memory().markDirty(addr, length);
+    }
   }
 
-  int memcpy(lua_State* L)
+  void memcpy(address_t dest, address_t src, int32_t length)
   {
-    address_t dest = lua_tonumber(L, 1);
-    address_t src = lua_tonumber(L, 2);
-    int32_t length = lua_tonumber(L, 3);
-
     //TODO: optimize overlap case?
     if ((src + length < dest) || (dest + length < src))
       std::memcpy(machine->memory().base() + dest, machine->memory().base() + src, length);
     else
     {
-      for (size_t i = 0; i < length; ++i)
+      for (int32_t i = 0; i < length; ++i)
         machine->memory().base()[dest + i] = machine->memory().base()[src + i];
     }
 
-    return 0;
+    machine->memory().markDirty(dest, length);
   }
 
-  int reload(lua_State* L)
+  void reload(address_t dest, address_t src, opt<int32_t> length)
   {
-    assert(lua_gettop(L) <= 3);
-    
-    address_t dest = lua_to_or_default(L, number, 1, 0);
-    address_t src = lua_to_or_default(L, number, 1, 0);
-    int32_t length = lua_to_or_default(L, number, 1, address::CART_DATA_LENGTH);
-    
-    std::memcpy(machine->memory().base() + dest, machine->memory().backup() + src, length);
+    const int32_t size = length.value_or(address::CART_DATA_LENGTH);
 
-    return 0;
+    std::memcpy(machine->memory().base() + dest, machine->memory().backup() + src, size);
+    machine->memory().markDirty(dest, size);
   }
 
-  int btn(lua_State* L)
+  using bt_t = retro8::button_t;
+  static constexpr std::array<bt_t, 6> buttons = { { bt_t::LEFT, bt_t::RIGHT, bt_t::UP, bt_t::DOWN, bt_t::ACTION1, bt_t::ACTION2 } };
+
+  pushed btn(lua_State* L, opt<size_t> bindex, index_t index)
   {
-    index_t index = lua_gettop(L) >= 2 ? lua_tonumber(L, 2) : 0;
     if (index >= PLAYER_COUNT) index = 0;
  
     /* we're asking for a specific button*/
-    if (lua_gettop(L) >= 1)
+    if (bindex.present)
     {
-      using bt_t = retro8::button_t;
-      static constexpr std::array<bt_t, 6> buttons = { bt_t::LEFT, bt_t::RIGHT, bt_t::UP, bt_t::DOWN, bt_t::ACTION1, bt_t::ACTION2 };
-      size_t bindex = lua_tonumber(L, 1);
-
-      if (bindex < buttons.size())
-        lua_pushboolean(L, machine->state().buttons[index].isSet(buttons[bindex]));
+      if (bindex.value < buttons.size())
+        lua_pushboolean(L, machine->state().buttons[index].isSet(buttons[bindex.value]));
       else
         lua_pushboolean(L, false);
 
@@ -901,114 +588,108 @@ namespace platform
     /* push whole bitmask*/
     else
     {
-      lua_pushnumber(L, machine->state().buttons[index].value);
+      push(L, machine->state().buttons[index].value);
     }
 
     //TODO: finish for player 2?
-    return 1;
+    return { 1 };
   }
 
-  int btnp(lua_State* L)
+  pushed btnp(lua_State* L, opt<size_t> bindex, index_t index)
   {
-    const index_t index = lua_gettop(L) >= 2 ? lua_tonumber(L, 2) : 0;
-
     //TODO: check behavior
+    if (index >= PLAYER_COUNT) index = 0;
 
     /* we're asking for a specific button*/
-    if (lua_gettop(L) >= 1)
+    if (bindex.present)
     {
-      using bt_t = retro8::button_t;
-      static constexpr std::array<bt_t, 6> buttons = { bt_t::LEFT, bt_t::RIGHT, bt_t::UP, bt_t::DOWN, bt_t::ACTION1, bt_t::ACTION2 };
-      size_t bindex = lua_tonumber(L, 1);
-      lua_pushboolean(L, machine->state().previousButtons[index].isSet(buttons[bindex]));
+      if (bindex.value < buttons.size())
+        lua_pushboolean(L, machine->state().previousButtons[index].isSet(buttons[bindex.value]));
+      else
+        lua_pushboolean(L, false);
     }
     /* push whole bitmask*/
     else
     {
-      lua_pushnumber(L, machine->state().previousButtons[index].value);
+      push(L, machine->state().previousButtons[index].value);
     }
 
     //TODO: finish for player?
-    return 1;
+    return { 1 };
   }
 
-  int stat(lua_State* L)
+  pushed stat(lua_State* L, int32_t index)
   {
     //TODO: implement
 
-    enum class Stat { FRAME_RATE = 7 };
-    Stat s = static_cast<Stat>((int)lua_tonumber(L, -1));
+    enum class Stat { MEMORY = 0, FRAME_RATE = 7, TARGET_FRAME_RATE = 8, PLATFORM_FRAME_RATE = 9, PROFILER = 200 };
+    Stat s = static_cast<Stat>(index);
 
 
     switch (s)
     {
-    case Stat::FRAME_RATE: lua_pushnumber(L, machine->code().require60fps() ? 60 : 30); break;
-    default: lua_pushnumber(L, 0);
+    /* KB of Lua heap in use, the peak is returned as a second value */
+    case Stat::MEMORY:
+      push(L, machine->code().heap().used() / 1024.0f);
+      push(L, machine->code().heap().peak() / 1024.0f);
+      return { 2 };
+    /* frame rate is the nominal one since the frame clock doesn't depend on wall time */
+    case Stat::FRAME_RATE:
+    case Stat::TARGET_FRAME_RATE:
+    case Stat::PLATFORM_FRAME_RATE:
+      push(L, machine->code().require60fps() ? 60 : 30); break;
+#if R8_PROFILER_ENABLED
+    case Stat::PROFILER: machine->code().profiler().push(L); break;
+#endif
+    default: push(L, 0);
 
     }
 
-    return 1;
+    return { 1 };
   }
 
-  int cartdata(lua_State* L)
+  void cartdata()
   {
     //TODO: implement
-    return 0;
   }
 
-  int dset(lua_State* L)
+  void dset(index_t idx, integral_t value)
   {
-    index_t idx = lua_tonumber(L, 1);
-    integral_t value = lua_tonumber(L, 2);
-
     *machine->memory().cartData(idx) = value;
-    return 0;
   }
 
-  int dget(lua_State* L)
+  integral_t dget(index_t idx)
   {
-    index_t idx = lua_tonumber(L, 1);
-
-    lua_pushnumber(L, *machine->memory().cartData(idx));
-
-    return 1;
+    return *machine->memory().cartData(idx);
   }
 
-  int flip(lua_State* L)
+  void flip()
   {
     //TODO: this call should syncronize to 30fps, at the moment it just
     // returns producing a lot of flips in non synchronized code (eg. _init() busy loop)
     //TODO: flip is handled by backend so we should find a way to set the callback that should be called
-
-    return 0;
   }
 
-  int extcmd(lua_State* L)
+  void extcmd()
   {
     //TODO: implement
-    return 0;
   }
 
-  int menuitem(lua_State* L)
+  void menuitem()
   {
     //TODO: implement
-    return 0;
   }
 
-  int time(lua_State* L)
+  float time()
   {
-    lua_pushnumber(L, Platform::getTicks() / 1000.0f);
-    return 1;
+    return machine->time();
   }
 
-  int printh(lua_State* L)
+  void printh(const char* text)
   {
     //TODO: finish implementing additional parameters
     
-    std::string text = lua_tostring(L, 1);
-    std::cout << text << std::endl;
-
-    return 0;
+    std::cout << (text ? text : "") << std::endl;
   }
 }
 
@@ -1016,105 +697,262 @@ namespace platform
 
 void lua::registerFunctions(lua_State* L)
 {
-  lua_register(L, "pset", pset);
-  lua_register(L, "pget", pget);
-  lua_register(L, "pal", pal);
-  lua_register(L, "palt", palt);
-  lua_register(L, "color", color);
-  lua_register(L, "line", line);
-  lua_register(L, "fillp", fillp);
-  lua_register(L, "rect", rect);
-  lua_register(L, "rectfill", rectfill);
-  lua_register(L, "circ", circ);
-  lua_register(L, "circfill", circfill);
-  lua_register(L, "clip", draw::clip);
-  lua_register(L, "cls", cls);
-  lua_register(L, "spr", spr);
-  lua_register(L, "camera", camera);
-  lua_register(L, "map", map);
-  lua_register(L, "mget", mget);
-  lua_register(L, "mset", mset);
-  lua_register(L, "sget", sget);
-  lua_register(L, "sset", sset);
-
-  lua_register(L, "print", print);
-  lua_register(L, "cursor", cursor);
-
-  lua_register(L, "fset", sprites::fset);
-  lua_register(L, "fget", sprites::fget);
-  lua_register(L, "sspr", sprites::sspr);
-
-  lua_register(L, "__debugprint", debug::debugprint);
-  lua_register(L, "__breakpoint", debug::breakpoint);
-
-  lua_register(L, "cos", math::cos);
-  lua_register(L, "sin", math::sin);
-  lua_register(L, "atan2", math::atan2);
-  lua_register(L, "srand", math::srand);
-  lua_register(L, "rnd", math::rnd);
-  lua_register(L, "flr", math::flr);
-  lua_register(L, "ceil", math::ceil);
-  lua_register(L, "min", math::min);
-  lua_register(L, "max", math::max);
-  lua_register(L, "mid", math::mid);
-  lua_register(L, "abs", math::abs);
-  lua_register(L, "sgn", math::sgn);
-  lua_register(L, "sqrt", math::sqrt);
-
-  lua_register(L, "band", bitwise::band);
-  lua_register(L, "bor", bitwise::bor);
-  lua_register(L, "bxor", bitwise::bxor);
-  lua_register(L, "bnot", bitwise::bnot);
-  lua_register(L, "shl", bitwise::shl);
-  lua_register(L, "shr", bitwise::shr);
-  lua_register(L, "lshl", bitwise::lshl);
-  lua_register(L, "lshr", bitwise::lshr);
-  lua_register(L, "rotl", bitwise::rotl);
-  lua_register(L, "rotr", bitwise::rotr);
-
-  lua_register(L, "music", ::sound::music);
-  lua_register(L, "sfx", ::sound::sfx);
-
-  lua_register(L, "sub", string::sub);
-  lua_register(L, "tostr", string::tostr);
-  lua_register(L, "tonum", string::tonum);
-
-  lua_register(L, "btn", platform::btn);
-  lua_register(L, "btnp", platform::btnp);
-  lua_register(L, "time", platform::time);
-  lua_register(L, "t", platform::time);
-  lua_register(L, "extcmd", platform::extcmd);
-  lua_register(L, "menuitem", platform::menuitem);
-  lua_register(L, "stat", platform::stat);
-  lua_register(L, "cartdata", platform::cartdata);
-  lua_register(L, "dset", platform::dset);
-  lua_register(L, "dget", platform::dget);
-  lua_register(L, "poke", platform::poke);
-  lua_register(L, "peek", platform::peek);
-  lua_register(L, "poke2", platform::poke2);
-  lua_register(L, "peek2", platform::peek2);
-  lua_register(L, "poke4", platform::poke4);
-  lua_register(L, "peek4", platform::peek4);
-  lua_register(L, "memset", platform::memset);
-  lua_register(L, "memcpy", platform::memcpy);
-  lua_register(L, "reload", platform::reload);
-  lua_register(L, "printh", platform::printh);
-
-  lua_register(L, "flip", platform::flip);
+  lua_register(L, "pset", LUA_BIND(pset));
+  lua_register(L, "pget", LUA_BIND(pget));
+  lua_register(L, "pal", LUA_BIND(pal));
+  lua_register(L, "palt", LUA_BIND(palt));
+  lua_register(L, "color", LUA_BIND(color));
+  lua_register(L, "line", LUA_BIND(line));
+  lua_register(L, "fillp", LUA_BIND(fillp));
+  lua_register(L, "rect", LUA_BIND(rect));
+  lua_register(L, "rectfill", LUA_BIND(rectfill));
+  lua_register(L, "circ", LUA_BIND(circ));
+  lua_register(L, "circfill", LUA_BIND(circfill));
+  lua_register(L, "clip", LUA_BIND(draw::clip));
+  lua_register(L, "cls", LUA_BIND(cls));
+  lua_register(L, "spr", LUA_BIND(spr));
+  lua_register(L, "camera", LUA_BIND(camera));
+  lua_register(L, "map", LUA_BIND(map));
+  lua_register(L, "mget", LUA_BIND(mget));
+  lua_register(L, "mset", LUA_BIND(mset));
+  lua_register(L, "sget", LUA_BIND(sget));
+  lua_register(L, "sset", LUA_BIND(sset));
+
+  lua_register(L, "print", LUA_BIND(print));
+  lua_register(L, "cursor", LUA_BIND(cursor));
+
+  lua_register(L, "fset", LUA_BIND(sprites::fset));
+  lua_register(L, "fget", LUA_BIND(sprites::fget));
+  lua_register(L, "sspr", LUA_BIND(sprites::sspr));
+
+  lua_register(L, "__debugprint", LUA_BIND(debug::debugprint));
+  lua_register(L, "__breakpoint", LUA_BIND(debug::breakpoint));
+
+  lua_register(L, "cos", LUA_BIND(math::cos));
+  lua_register(L, "sin", LUA_BIND(math::sin));
+  lua_register(L, "atan2", LUA_BIND(math::atan2));
+  lua_register(L, "srand", LUA_BIND(math::srand));
+  lua_register(L, "rnd", LUA_BIND(math::rnd));
+  lua_register(L, "flr", LUA_BIND(math::flr));
+  lua_register(L, "ceil", LUA_BIND(math::ceil));
+  lua_register(L, "min", LUA_BIND(math::min));
+  lua_register(L, "max", LUA_BIND(math::max));
+  lua_register(L, "mid", LUA_BIND(math::mid));
+  lua_register(L, "abs", LUA_BIND(math::abs));
+  lua_register(L, "sgn", LUA_BIND(math::sgn));
+  lua_register(L, "sqrt", LUA_BIND(math::sqrt));
+
+  lua_register(L, "band", LUA_BIND(bitwise::band));
+  lua_register(L, "bor", LUA_BIND(bitwise::bor));
+  lua_register(L, "bxor", LUA_BIND(bitwise::bxor));
+  lua_register(L, "bnot", LUA_BIND(bitwise::bnot));
+  lua_register(L, "shl", LUA_BIND(bitwise::shl));
+  lua_register(L, "shr", LUA_BIND(bitwise::shr));
+  lua_register(L, "lshl", LUA_BIND(bitwise::lshl));
+  lua_register(L, "lshr", LUA_BIND(bitwise::lshr));
+  lua_register(L, "rotl", LUA_BIND(bitwise::rotl));
+  lua_register(L, "rotr", LUA_BIND(bitwise::rotr));
+
+  lua_register(L, "music", LUA_BIND(::sound::music));
+  lua_register(L, "sfx", LUA_BIND(::sound::sfx));
+
+  lua_register(L, "sub", LUA_BIND(string::sub));
+  lua_register(L, "tostr", LUA_BIND(string::tostr));
+  lua_register(L, "tonum", LUA_BIND(string::tonum));
+
+  lua_register(L, "btn", LUA_BIND(platform::btn));
+  lua_register(L, "btnp", LUA_BIND(platform::btnp));
+  lua_register(L, "time", LUA_BIND(platform::time));
+  lua_register(L, "t", LUA_BIND(platform::time));
+  lua_register(L, "extcmd", LUA_BIND(platform::extcmd));
+  lua_register(L, "menuitem", LUA_BIND(platform::menuitem));
+  lua_register(L, "stat", LUA_BIND(platform::stat));
+  lua_register(L, "cartdata", LUA_BIND(platform::cartdata));
+  lua_register(L, "dset", LUA_BIND(platform::dset));
+  lua_register(L, "dget", LUA_BIND(platform::dget));
+  lua_register(L, "poke", LUA_BIND(platform::poke));
+  lua_register(L, "peek", LUA_BIND(platform::peek));
+  lua_register(L, "poke2", LUA_BIND(platform::poke2));
+  lua_register(L, "peek2", LUA_BIND(platform::peek2));
+  lua_register(L, "poke4", LUA_BIND(platform::poke4));
+  lua_register(L, "peek4", LUA_BIND(platform::peek4));
+  lua_register(L, "memset", LUA_BIND(platform::memset));
+  lua_register(L, "memcpy", LUA_BIND(platform::memcpy));
+  lua_register(L, "reload", LUA_BIND(platform::reload));
+  lua_register(L, "printh", LUA_BIND(platform::printh));
+
+  lua_register(L, "flip", LUA_BIND(platform::flip));
 }
 
 Code::~Code()
 {
+#if R8_PROFILER_ENABLED
+  const char* path = std::getenv("R8_PROFILE");
+  _profiler.dump(path ? path : "retro8-profile");
+#endif
+
   if (L)
     lua_close(L);
 }
 
-void Code::loadAPI()
+#if !defined(R8_LUA_HEAP_SIZE)
+  #if defined(SF2000)
+    #define R8_LUA_HEAP_SIZE (4 << 20)
+  #else
+    #define R8_LUA_HEAP_SIZE (16 << 20)
+  #endif
+#endif
+
+/* PICO-8 gives 2 MiB to carts but Lua objects are bigger on 64 bit targets and the API shares the
+   heap, so by default only the heap size caps memory */
+#if !defined(R8_LUA_MEMORY_LIMIT)
+  #define R8_LUA_MEMORY_LIMIT R8_LUA_HEAP_SIZE
+#endif
+
+namespace
 {
-  if (!L)
+  int panic(lua_State* L)
+  {
+    const char* message = lua_tostring(L, -1);
+    lua_writestringerror("PANIC: unprotected error in call to Lua API (%s)\n", message ? message : "error object is not a string");
+    return 0;
+  }
+}
+
+lua_State* Code::createState()
+{
+  if (!_heap.init(R8_LUA_HEAP_SIZE))
+    return nullptr;
+
+  if (_heap.limit() == SIZE_MAX)
+    _heap.setLimit(R8_LUA_MEMORY_LIMIT);
+
+  lua_State* state = lua_newstate(retro8::Arena::allocate, &_heap);
+  if (state)
   {
-    L = luaL_newstate();
+    lua_atpanic(state, panic);
+    L = state;
+    installEntries();
+    applyGcSettings();
   }
+  return state;
+}
+
+namespace
+{
+  const char* ENTRY_NAMES[] = { "_init", "_update", "_update60", "_draw" };
+
+  int traceback(lua_State* L)
+  {
+    const char* message = lua_tostring(L, 1);
+
+    if (message)
+      luaL_traceback(L, L, message, 1);
+    else if (!luaL_callmeta(L, 1, "__tostring"))
+      lua_pushfstring(L, "(error object is a %s value)", luaL_typename(L, 1));
+
+    return 1;
+  }
+}
+
+void Code::installEntries()
+{
+  /* names are interned once and kept alive in fixed registry slots so that looking an entry up is a raw
+     get with a string whose hash is already computed, no allocation and no metamethod of the cart */
+  for (size_t i = 0; i < ENTRY_COUNT; ++i)
+  {
+    lua_pushstring(L, ENTRY_NAMES[i]);
+    _entries[i] = luaL_ref(L, LUA_REGISTRYINDEX);
+  }
+
+  lua_pushcfunction(L, traceback);
+  _traceback = luaL_ref(L, LUA_REGISTRYINDEX);
+}
+
+bool Code::pushEntry(Entry entry) const
+{
+  lua_rawgeti(L, LUA_REGISTRYINDEX, LUA_RIDX_GLOBALS);
+  lua_rawgeti(L, LUA_REGISTRYINDEX, _entries[entry]);
+  lua_rawget(L, -2);
+  lua_remove(L, -2);
+
+  if (lua_isfunction(L, -1))
+    return true;
+
+  lua_pop(L, 1);
+  return false;
+}
+
+bool Code::defined(Entry entry) const
+{
+  if (!L || !pushEntry(entry))
+    return false;
+
+  lua_pop(L, 1);
+  return true;
+}
+
+void Code::callEntry(Entry entry)
+{
+  lua_rawgeti(L, LUA_REGISTRYINDEX, _traceback);
+
+  if (!pushEntry(entry))
+  {
+    lua_pop(L, 1);
+    return;
+  }
+
+  if (lua_pcall(L, 0, 0, -2))
+  {
+    printError(ENTRY_NAMES[entry]);
+    lua_pop(L, 1);
+  }
+
+  lua_pop(L, 1);
+}
+
+void Code::saveState(StateWriter& writer) const
+{
+  /* heap is restored in place so its address is part of the snapshot identity, registry
+     slots of the entry points are fixed so nothing else must be refreshed */
+  writer.write(uintptr_t(_heap.base()));
+  writer.write(uint64_t(_heap.extent()));
+  writer.write(_heap.base(), _heap.extent());
+}
+
+bool Code::checkState(StateReader& reader) const
+{
+  uintptr_t base = 0;
+  uint64_t extent = 0;
+
+  if (!reader.read(base) || !reader.read(extent))
+    return false;
+  else if (base != uintptr_t(_heap.base()) || extent > _heap.capacity())
+    return false;
+
+  const uint8_t* data = reader.fetch(size_t(extent));
+  return data && _heap.accepts(data, size_t(extent));
+}
+
+bool Code::loadState(StateReader& reader)
+{
+  StateReader check = reader;
+  if (!checkState(check))
+    return false;
+
+  uintptr_t base = 0;
+  uint64_t extent = 0;
+  reader.read(base);
+  reader.read(extent);
+  _heap.restore(reader.fetch(size_t(extent)), size_t(extent));
+
+  return true;
+}
+
+void Code::loadAPI()
+{
+  if (!L)
+    createState();
 
   luaL_openlibs(L);
 
@@ -1142,84 +980,190 @@ void Code::printError(const char* where)
       std::cout << message << std::endl;
     }
   }
+#if PLATFORM != PLATFORM_HEADLESS
   getchar();
+#endif
 }
 
-void Code::initFromSource(const std::string& code)
+void Code::prepareChunk()
 {
   if (!L)
-    L = luaL_newstate();
+    createState();
 
+#if R8_PROFILER_ENABLED
+  /* every function bound by registerFunctions gets wrapped */
+  const Profiler::function_set_t previous = Profiler::globalFunctions(L);
   registerFunctions(L);
+  _profiler.instrument(L, previous);
+#else
+  registerFunctions(L);
+#endif
+}
 
+namespace
+{
+  int appendBytecode(lua_State*, const void* data, size_t length, void* ud)
+  {
+    static_cast<std::string*>(ud)->append(static_cast<const char*>(data), length);
+    return 0;
+  }
 
+  /* FNV-1a of the loaded chunk, identifies the cart in snapshots */
+  uint64_t chunkHash(const std::string& chunk)
+  {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (char c : chunk)
+    {
+      hash ^= uint8_t(c);
+      hash *= 0x100000001b3ULL;
+    }
+    return hash;
+  }
+}
 
-  if (luaL_loadstring(L, code.c_str()))
-    printError("luaL_loadString");
-
-  int error = lua_pcall(L, 0, 0, 0);
-
-  if (error)
-    printError("lua_pcall on init");
-
+void Code::initFromSource(const std::string& code)
+{
+  prepareChunk();
+  _chunkId = chunkHash(code);
 
-  lua_getglobal(L, "_update");
-  if (lua_isfunction(L, -1))
+  if (luaL_loadstring(L, code.c_str()))
   {
-    _update = lua_topointer(L, -1);
+    printError("luaL_loadString");
     lua_pop(L, 1);
+    return;
   }
 
-  lua_getglobal(L, "_update60");
-
-  if (lua_isfunction(L, -1))
+  /* debug information is kept so that errors still report lines */
+  if (_keepBytecode)
   {
-    _update60 = lua_topointer(L, -1);
-    lua_pop(L, 1);
+    _bytecode.clear();
+    lua_dump(L, appendBytecode, &_bytecode, 0);
   }
 
-  lua_getglobal(L, "_draw");
+  runChunk();
+}
 
-  if (lua_isfunction(L, -1))
+bool Code::initFromBytecode(const std::string& bytecode)
+{
+  /* signature, versions, type sizes and sample integer and number that lundump.c checks: chunks of
+     another build are rejected here instead of relying on the loader to notice */
+  constexpr size_t HEADER_LENGTH = 4 + 1 + 1 + 6 + 5 + sizeof(lua_Integer) + sizeof(lua_Number);
+
+  std::string header;
+  luaL_loadstring(L, "");
+  lua_dump(L, appendBytecode, &header, 1);
+  lua_pop(L, 1);
+
+  if (bytecode.size() < HEADER_LENGTH || bytecode.compare(0, HEADER_LENGTH, header, 0, HEADER_LENGTH) != 0)
+    return false;
+
+  prepareChunk();
+  _chunkId = chunkHash(bytecode);
+
+  if (luaL_loadbufferx(L, bytecode.data(), bytecode.size(), "=bytecode", "b"))
   {
-    _draw = lua_topointer(L, -1);
+    printError("luaL_loadbufferx");
     lua_pop(L, 1);
+    return false;
   }
 
-  lua_getglobal(L, "_init");
+  runChunk();
+  return true;
+}
 
-  if (lua_isfunction(L, -1))
+void Code::runChunk()
+{
+  lua_rawgeti(L, LUA_REGISTRYINDEX, _traceback);
+  lua_insert(L, -2);
+
+  if (lua_pcall(L, 0, 0, -2))
   {
-    _init = lua_topointer(L, -1);
+    printError("lua_pcall on init");
     lua_pop(L, 1);
   }
+
+  lua_pop(L, 1);
 }
 
 void Code::callFunction(const char* name, int ret)
 {
+  const int base = lua_gettop(L);
+
+  lua_rawgeti(L, LUA_REGISTRYINDEX, _traceback);
   lua_getglobal(L, name);
-  int error = lua_pcall(L, 0, ret, 0);
 
-  if (error)
+  if (lua_pcall(L, 0, ret, base + 1))
+  {
     printError(name);
+    lua_settop(L, base);
+  }
+  else
+    lua_remove(L, base + 1);
 }
 
 void Code::update()
 {
-  if (_update60)
-    callFunction("_update60");
-  else if (_update)
-    callFunction("_update");
+  callEntry(defined(UPDATE60) ? UPDATE60 : UPDATE);
 }
 
 void Code::draw()
 {
-  if (_draw)
-    callFunction("_draw");
+  callEntry(DRAW);
+  collect();
+}
+
+void Code::setMemoryLimit(size_t limit)
+{
+  _heap.setLimit(limit ? limit : R8_LUA_MEMORY_LIMIT);
+}
+
+void Code::setGcSettings(const GcSettings& settings)
+{
+  _gc = settings;
+
+  if (L)
+    applyGcSettings();
+}
+
+void Code::applyGcSettings()
+{
+  lua_gc(L, LUA_GCSETPAUSE, _gc.pause);
+  lua_gc(L, LUA_GCSETSTEPMUL, _gc.stepmul);
+}
+
+void Code::collect()
+{
+  using clock = std::chrono::steady_clock;
+
+  _gcTime = std::chrono::nanoseconds(0);
+
+  if (_gc.mode != GcSettings::Mode::FRAME || !L)
+    return;
+
+  /* like the pause of the automatic collector a new cycle starts only once memory has grown enough,
+     but sooner so that automatic collection inside the cart code is rare */
+  static constexpr int FRAME_PAUSE = 150;
+  if (_gcLive && lua_gc(L, LUA_GCCOUNT, 0) * 100 < _gcLive * FRAME_PAUSE)
+    return;
+
+  /* basic steps until the budget is spent, a finished cycle ends the frame work too. About 0.6ms on a
+     desktop, the time is only measured for reporting */
+  const clock::time_point start = clock::now();
+  _gcLive = 0;
+
+  for (int i = 0; i < _gc.steps; ++i)
+  {
+    if (lua_gc(L, LUA_GCSTEP, 0))
+    {
+      _gcLive = std::max(lua_gc(L, LUA_GCCOUNT, 0), 1);
+      break;
+    }
+  }
+
+  _gcTime = clock::now() - start;
 }
 
 void Code::init()
 {
-  if (_init)
-    callFunction("_init");
+  callEntry(INIT);
 }
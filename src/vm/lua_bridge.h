@@ -1,13 +1,39 @@
 #pragma once
 
+#include "arena.h"
+#include "profiler.h"
+
+#include <array>
+#include <chrono>
 #include <string>
 
 struct lua_State;
 
+namespace retro8
+{
+  class StateWriter;
+  class StateReader;
+}
+
 namespace lua
 {
   void registerFunctions(lua_State* state);
 
+  /* how the Lua collector is driven: INCREMENTAL leaves pacing to Lua, FRAME also steps it in the
+     slack left after _draw so that cycles rarely run inside the cart code */
+  struct GcSettings
+  {
+    enum class Mode { INCREMENTAL, FRAME };
+
+    Mode mode;
+    /* most basic collector steps after _draw, counted in work instead of time so that the heap evolves
+       the same way whatever the speed of the host, which snapshots and run-ahead rely on */
+    int steps;
+    /* LUA_GCSETPAUSE and LUA_GCSETSTEPMUL values */
+    int pause;
+    int stepmul;
+  };
+
   class Code
   {
   public:
@@ -18,15 +44,45 @@ namespace lua
     };  
   
   private:
+    /* whole Lua heap lives here so that it can be snapshotted with a single copy */
+    retro8::Arena _heap;
     lua_State* L;
 
-    const void* _init;
-    const void* _update;
-    const void* _update60;
-    const void* _draw;
+#if R8_PROFILER_ENABLED
+    Profiler _profiler;
+#endif
+
+    enum Entry { INIT, UPDATE, UPDATE60, DRAW, ENTRY_COUNT };
+
+    /* registry slots holding the names of the entry points, they stay plain globals so that carts can
+       reassign them, iterate over them or install their own metatable on _G */
+    std::array<int, ENTRY_COUNT> _entries;
+    int _traceback;
+
+    GcSettings _gc;
+    std::chrono::nanoseconds _gcTime;
+    /* KB in use when the last cycle stepped after _draw finished, 0 while one is in progress */
+    int _gcLive;
+
+    /* compiled main chunk of the cart, only filled when asked so that it can be cached */
+    bool _keepBytecode;
+    std::string _bytecode;
+    /* hash of the chunk the cart was started from, part of the snapshot identity */
+    uint64_t _chunkId;
+
+    lua_State* createState();
+    void prepareChunk();
+    void runChunk();
+    void installEntries();
+    /* pushes the function stored in the global of entry, false and nothing pushed if it isn't one */
+    bool pushEntry(Entry entry) const;
+    bool defined(Entry entry) const;
+    void callEntry(Entry entry);
+    void applyGcSettings();
+    void collect();
 
   public:
-    Code() : L(nullptr), _init(nullptr), _update(nullptr), _update60(nullptr), _draw(nullptr) { }
+    Code() : L(nullptr), _traceback(0), _gc(defaultGcSettings()), _gcTime(0), _gcLive(0), _keepBytecode(false), _chunkId(0) { _entries.fill(0); }
     ~Code();
 
     void loadAPI();
@@ -34,17 +90,42 @@ namespace lua
 
     void printError(const char* where);
     void initFromSource(const std::string& code);
+    /* runs a chunk produced by lua_dump, false if this build can't load it */
+    bool initFromBytecode(const std::string& bytecode);
     void callFunction(const char* name, int ret = 0);
 
-    bool hasUpdate() const { return _update != nullptr || _update60 != nullptr; }
-    bool hasDraw() const { return _draw != nullptr; }
-    bool require60fps() const { return _update60 != nullptr; }
-    bool hasInit() const { return _init != nullptr; }
+    /* when enabled initFromSource dumps the compiled chunk before running it */
+    void keepBytecode(bool keep) { _keepBytecode = keep; if (!keep) std::string().swap(_bytecode); }
+    const std::string& bytecode() const { return _bytecode; }
+
+    bool hasUpdate() const { return defined(UPDATE) || defined(UPDATE60); }
+    bool hasDraw() const { return defined(DRAW); }
+    bool require60fps() const { return defined(UPDATE60); }
+    bool hasInit() const { return defined(INIT); }
 
     void init();
     void update();
+    /* calls _draw and then runs the collector when in GcSettings::Mode::FRAME */
     void draw();
 
+    static GcSettings defaultGcSettings() { return { GcSettings::Mode::FRAME, 500, 300, 200 }; }
+    void setGcSettings(const GcSettings& settings);
+    /* time spent by the collector after the last _draw */
+    std::chrono::nanoseconds gcTime() const { return _gcTime; }
+
+    const retro8::Arena& heap() const { return _heap; }
+    /* allocations over limit bytes fail with a Lua memory error, 0 restores the default */
+    void setMemoryLimit(size_t limit);
+#if R8_PROFILER_ENABLED
+    Profiler& profiler() { return _profiler; }
+#endif
+    uint64_t chunkId() const { return _chunkId; }
+
+    void saveState(retro8::StateWriter& writer) const;
+    /* consumes the same bytes as loadState without changing anything, false if loadState would fail */
+    bool checkState(retro8::StateReader& reader) const;
+    bool loadState(retro8::StateReader& reader);
+
 #if TEST_MODE
     lua_State* state() const { return L; }
 #endif
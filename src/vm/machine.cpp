@@ -1,6 +1,28 @@
 #include "machine.h"
 
+#include "lua/lua.hpp"
+
 #include <algorithm>
+#include <chrono>
+
+namespace
+{
+  constexpr uint32_t STATE_MAGIC = 0x53533852; /* R8SS */
+  constexpr uint32_t STATE_VERSION = 5;
+
+  /* layout of everything written raw, a snapshot from a build which differs in any of these is rejected */
+  constexpr uint64_t STATE_BUILD = uint64_t(LUA_VERSION_NUM) << 48 | uint64_t(sizeof(lua_Number)) << 40 |
+    uint64_t(sizeof(void*)) << 32 | uint64_t(sizeof(retro8::State)) << 16 | uint64_t(R8_FIXED_POINT) << 1 | uint64_t(SOUND_ENABLED);
+
+  /* random per instance so that snapshots of another machine, even one whose heap maps at the same
+     address, are never restored over this one */
+  uint64_t sessionNonce(const void* instance)
+  {
+    std::random_device device;
+    const uint64_t time = uint64_t(std::chrono::steady_clock::now().time_since_epoch().count());
+    return (uint64_t(device()) << 32 ^ device()) ^ time ^ uint64_t(uintptr_t(instance));
+  }
+}
 
 using namespace retro8;
 
@@ -10,13 +32,101 @@ void Machine::color(color_t color)
   penColor->low(color);
 }
 
+Machine::Machine()
+#if SOUND_ENABLED
+  : _sound(_memory)
+#endif
+{
+  _session = sessionNonce(this);
+}
+
+void Machine::writeState(StateWriter& writer)
+{
+  /* identity of the build, the instance and the cart the snapshot belongs to */
+  writer.write(STATE_BUILD);
+  writer.write(_session);
+  writer.write(_code.chunkId());
+
+  _code.saveState(writer);
+  writer.write(_state);
+  _memory.saveState(writer);
+#if SOUND_ENABLED
+  _sound.saveState(writer);
+#endif
+}
+
+size_t Machine::stateSize()
+{
+  StateWriter counter;
+  counter.write(STATE_MAGIC);
+  counter.write(STATE_VERSION);
+  counter.write(uint64_t(0));
+  writeState(counter);
+  return counter.position();
+}
+
+void Machine::saveState(StateWriter& writer)
+{
+  StateWriter counter;
+  writeState(counter);
+
+  writer.write(STATE_MAGIC);
+  writer.write(STATE_VERSION);
+  writer.write(uint64_t(counter.position()));
+  writeState(writer);
+}
+
+bool Machine::loadState(StateReader& reader)
+{
+  uint32_t magic = 0, version = 0;
+  uint64_t length = 0;
+
+  if (!reader.read(magic) || !reader.read(version) || !reader.read(length))
+    return false;
+  else if (magic != STATE_MAGIC || version != STATE_VERSION)
+    return false;
+
+  /* nothing is touched unless the whole snapshot is available */
+  const uint8_t* data = reader.fetch(size_t(length));
+  if (!data)
+    return false;
+
+  StateReader body(data, size_t(length));
+
+  uint64_t build = 0, session = 0, chunk = 0;
+  if (!body.read(build) || !body.read(session) || !body.read(chunk))
+    return false;
+  else if (build != STATE_BUILD || session != _session || chunk != _code.chunkId())
+    return false;
+
+  /* every section is validated before any is applied, so that a bad snapshot leaves the machine untouched */
+  StateReader check = body;
+  bool valid = _code.checkState(check) && check.fetch(sizeof(State)) && Memory::checkState(check);
+#if SOUND_ENABLED
+  valid = valid && _sound.checkState(check);
+#endif
+  if (!valid || check.position() != length)
+    return false;
+
+  _code.loadState(body);
+  body.read(_state);
+  _memory.loadState(body);
+#if SOUND_ENABLED
+  _sound.loadState(body);
+  _sound.setClock(_state.clock, State::CLOCK_RATE);
+#endif
+
+  return true;
+}
+
 void Machine::cls(color_t color)
 {
-  color = _memory.paletteAt(gfx::DRAW_PALETTE_INDEX)->get(color);
+  color = _memory.drawRemap().get(color);
   gfx::color_byte_t value = gfx::color_byte_t(color, color);
 
   auto* data = _memory.screenData();
   memset(data, value.value, gfx::BYTES_PER_SCREEN);
+  _memory.markScreenDirty();
 
   _memory.clipRect()->reset();
   *_memory.cursor() = { 0, 0 };
@@ -28,10 +138,11 @@ void Machine::pset(coord_t x, coord_t y, color_t color)
   x -= memory().camera()->x();
   y -= memory().camera()->y();
 
-  if (x >= clip->x0 && x < clip->x1 && y >= clip->y0 && y < clip->y1)
+  if (x >= clip->x0 && x < clip->x1 && y >= clip->y0 && y < clip->y1 && x < coord_t(gfx::SCREEN_WIDTH) && y < coord_t(gfx::SCREEN_HEIGHT))
   {
-    color = _memory.paletteAt(gfx::DRAW_PALETTE_INDEX)->get(color_t(color % gfx::COLOR_COUNT));
+    color = _memory.drawRemap().get(color);
     _memory.screenData(x, y)->set(x, color);
+    _memory.markScreenRowDirty(y);
   }
 }
 
@@ -121,11 +232,17 @@ void Machine::rectfill(coord_t x0, coord_t y0, coord_t x1, coord_t y1, color_t c
   y0 = std::max(y0, coord_t(clip->y0));
   y1 = std::min(y1, coord_t(clip->y1));
 
-  color = _memory.paletteAt(gfx::DRAW_PALETTE_INDEX)->get(color_t(color % gfx::COLOR_COUNT));
+  /* fully clipped rectangles don't dirty any row */
+  if (x0 > x1 || y0 > y1)
+    return;
+
+  color = _memory.drawRemap().get(color);
 
   for (coord_t y = y0; y <= y1; ++y)
     for (coord_t x = x0; x <= x1; ++x)
       _memory.screenData(x, y)->set(x, color);
+
+  _memory.markScreenRowsDirty(y0, y1);
 #else
   for (coord_t y = y0; y <= y1; ++y)
     for (coord_t x = x0; x <= x1; ++x)
@@ -199,50 +316,83 @@ void Machine::circfill(coord_t xc, coord_t yc, amount_t r, color_t color)
   }
 }
 
-void Machine::spr(index_t idx, coord_t x, coord_t y)
+void Machine::blitSprite(const gfx::color_byte_t* base, coord_t x, coord_t y, coord_t w, coord_t h, bool flipX, bool flipY)
 {
-  const gfx::sprite_t* sprite = _memory.spriteAt(idx);
-  const gfx::palette_t* palette = _memory.paletteAt(gfx::DRAW_PALETTE_INDEX);
+  /* camera and clip are applied once to the whole rectangle instead of per pixel as pset does */
+  const gfx::clip_rect_t* clip = _memory.clipRect();
+  const gfx::pair_remap_t& remap = _memory.drawRemap();
+
+  x -= _memory.camera()->x();
+  y -= _memory.camera()->y();
+
+  const coord_t x0 = std::max(x, coord_t(clip->x0));
+  const coord_t y0 = std::max(y, coord_t(clip->y0));
+  const coord_t x1 = std::min({ x + w, coord_t(clip->x1), coord_t(gfx::SCREEN_WIDTH) });
+  const coord_t y1 = std::min({ y + h, coord_t(clip->y1), coord_t(gfx::SCREEN_HEIGHT) });
 
-  for (coord_t ty = 0; ty < gfx::SPRITE_HEIGHT; ++ty)
-    for (coord_t tx = 0; tx < gfx::SPRITE_WIDTH; ++tx)
+  if (x0 >= x1 || y0 >= y1)
+    return;
+
+  _memory.markScreenRowsDirty(y0, y1 - 1);
+
+  /* when sprite and screen nibbles share the same parity whole bytes can be processed at once */
+  const bool aligned = !flipX && (x & 1) == 0;
+  const coord_t ax0 = aligned ? x0 + (x0 & 1) : x1;
+  const coord_t ax1 = aligned ? std::max(ax0, x1 & ~1) : x1;
+
+  for (coord_t dy = y0; dy < y1; ++dy)
+  {
+    const coord_t sy = flipY ? (h - dy + y - 1) : (dy - y);
+    const gfx::color_byte_t* src = base + sy * gfx::SPRITE_SHEET_PITCH;
+    gfx::color_byte_t* dest = _memory.screenData(0, dy);
+
+    auto plot = [&](coord_t dx) {
+      const coord_t sx = flipX ? (w - dx + x - 1) : (dx - x);
+      const color_t color = src[sx / gfx::PIXEL_TO_BYTE_RATIO].get(sx);
+
+      if (!remap.transparent(color))
+        dest[dx / gfx::PIXEL_TO_BYTE_RATIO].set(dx, remap.get(color));
+    };
+
+    coord_t dx = x0;
+
+    for (; dx < ax0; ++dx)
+      plot(dx);
+
+    for (; dx < ax1; dx += gfx::PIXEL_TO_BYTE_RATIO)
     {
-      color_t color = sprite->get(tx, ty);
-      if (!palette->transparent(color))
-        pset(x + tx, y + ty, color);
+      /* both pixels are remapped with a single lookup, transparent nibbles keep destination value */
+      const gfx::pair_remap_t::entry_t& entry = remap[src[(dx - x) / gfx::PIXEL_TO_BYTE_RATIO]];
+      gfx::color_byte_t& out = dest[dx / gfx::PIXEL_TO_BYTE_RATIO];
+      const uint8_t preserve = gfx::pair_remap_t::preserveMask(entry.transparency);
+
+      out.value = (out.value & preserve) | (entry.value.value & ~preserve);
     }
+
+    for (; dx < x1; ++dx)
+      plot(dx);
+  }
 }
 
-void Machine::spr(index_t idx, coord_t bx, coord_t by, float sw, float sh, bool flipX, bool flipY)
+void Machine::spr(index_t idx, coord_t x, coord_t y)
 {
-  const gfx::palette_t* palette = _memory.paletteAt(gfx::DRAW_PALETTE_INDEX);
+  const gfx::color_byte_t* base = reinterpret_cast<const gfx::color_byte_t*>(_memory.spriteAt(idx));
+  blitSprite(base, x, y, gfx::SPRITE_WIDTH, gfx::SPRITE_HEIGHT, false, false);
+}
 
+void Machine::spr(index_t idx, coord_t bx, coord_t by, float sw, float sh, bool flipX, bool flipY)
+{
   coord_t w = sw * gfx::SPRITE_WIDTH;
   coord_t h = sh * gfx::SPRITE_HEIGHT;
 
   /* we bypass spriteAt since we can use directly the address */
   const gfx::color_byte_t* base = reinterpret_cast<const gfx::color_byte_t*>(_memory.spriteAt(idx));
-
-  for (coord_t y = 0; y < h; ++y)
-  {
-    for (coord_t x = 0; x < w; ++x)
-    {
-      coord_t fx = flipX ? (w - x - 1) : x;
-      coord_t fy = flipY ? (h - y - 1) : y;
-
-      //TODO: optimize by fetching only once if we need to read next pixel?
-      const gfx::color_byte_t pair = *(base + y * gfx::SPRITE_SHEET_PITCH + x / gfx::PIXEL_TO_BYTE_RATIO);
-      const color_t color = pair.get(x);
-
-      if (!palette->transparent(color))
-        pset(bx + fx, by + fy, color);
-    }
-  }
+  blitSprite(base, bx, by, w, h, flipX, flipY);
 }
 
 void Machine::sspr(coord_t sx, coord_t sy, coord_t sw, coord_t sh, coord_t dx, coord_t dy, coord_t dw, coord_t dh, bool flipX, bool flipY)
 {
-  const gfx::palette_t* palette = _memory.paletteAt(gfx::DRAW_PALETTE_INDEX);
+  const gfx::pair_remap_t& remap = _memory.drawRemap();
 
   float fx = sx, fy = sy;
   float xr = sw / float(dw);
@@ -258,7 +408,7 @@ void Machine::sspr(coord_t sx, coord_t sy, coord_t sw, coord_t sh, coord_t dx, c
       auto pair = _memory.spriteSheet(cx, cy);
       auto color = pair->get(cx);
 
-      if (!palette->transparent(color))
+      if (!remap.transparent(color))
         pset(dx + x, dy + y, color);
 
       fx += xr;
@@ -340,6 +490,7 @@ void Machine::pal(color_t c0, color_t c1, palette_index_t index)
 {
   gfx::palette_t* palette = _memory.paletteAt(index);
   palette->set(c0, c1);
+  _memory.markPaletteDirty(index);
 }
 
 
@@ -15,7 +15,12 @@ namespace retro8
   class State
   {
   public:
+    static constexpr uint32_t CLOCK_RATE = 60;
+
     std::mt19937 rnd;
+    /* deterministic clock in 1/60th of second advanced once per executed frame, independent from wall time
+       so that replays, rewind and run-ahead behave the same */
+    uint32_t clock = 0;
     point_t lastLineEnd;
     std::array<bit_mask<button_t>, PLAYER_COUNT> buttons;
     std::array<bit_mask<button_t>, PLAYER_COUNT> previousButtons;
@@ -31,19 +36,18 @@ namespace retro8
 #endif
     gfx::Font _font;
     lua::Code _code;
+    /* random for each instance, snapshots only load in the machine which took them */
+    uint64_t _session;
 
   private:
     void circHelper(coord_t xc, coord_t yc, coord_t x, coord_t y, color_t col);
     void circFillHelper(coord_t xc, coord_t yc, coord_t x, coord_t y, color_t col);
+    void blitSprite(const gfx::color_byte_t* base, coord_t x, coord_t y, coord_t w, coord_t h, bool flipX, bool flipY);
+    void writeState(StateWriter& writer);
 
 
   public:
-    Machine()
-#if SOUND_ENABLED
-      : _sound(_memory)
-#endif
-    {
-    }
+    Machine();
 
     Machine(const Machine&) = delete;
     Machine& operator=(const Machine&) = delete;
@@ -70,6 +74,22 @@ namespace retro8
 
     void print(const std::string& string, coord_t x, coord_t y, color_t color);
 
+    /* snapshot of the whole machine, the Lua heap is restored in place so it's only valid for the same instance */
+    size_t stateSize();
+    void saveState(StateWriter& writer);
+    bool loadState(StateReader& reader);
+
+    /* must be called once before each _update/_draw pair */
+    void tick()
+    {
+      _state.clock += _code.require60fps() ? 1 : State::CLOCK_RATE / 30;
+#if SOUND_ENABLED
+      _sound.setClock(_state.clock, State::CLOCK_RATE);
+#endif
+    }
+
+    float time() const { return _state.clock / float(State::CLOCK_RATE); }
+
     State& state() { return _state; }
     Memory& memory() { return _memory; }
     gfx::Font& font() { return _font; }
@@ -5,8 +5,11 @@
 #include "gfx.h"
 #include "sound.h"
 #include "lua_bridge.h"
+#include "savestate.h"
 
+#include <algorithm>
 #include <array>
+#include <bitset>
 #include <random>
 #include <cstring>
 
@@ -46,9 +49,14 @@ namespace retro8
 
     static constexpr size_t ROWS_PER_TILE_MAP_HALF = 32;
 
+    gfx::pair_remap_t _drawRemap;
+    bool _drawRemapDirty;
+
+    /* scanlines of screen memory modified since last rasterization */
+    std::bitset<gfx::SCREEN_HEIGHT> _dirtyRows;
 
   public:
-    Memory()
+    Memory() : _drawRemapDirty(true)
     {
       memset(memory, 0, 1024 * 32);
       memset(_backup, 0, sizeof(_backup));
@@ -56,6 +64,7 @@ namespace retro8
       paletteAt(gfx::SCREEN_PALETTE_INDEX)->reset();
       clipRect()->reset();
       cursor()->reset();
+      markScreenDirty();
     }
 
     void backupCartridge()
@@ -66,6 +75,73 @@ namespace retro8
     const uint8_t* backup() const { return _backup; }
     uint8_t* base() { return memory; }
 
+    /* must be invoked after writing to raw memory through base() so that cached state can be refreshed */
+    void markDirty(address_t addr, size_t length)
+    {
+      const address_t end = addr + address_t(length);
+
+      if (addr < address::PALETTES + address_t(BYTES_PER_PALETTE) && end > address::PALETTES)
+        _drawRemapDirty = true;
+
+      /* screen palette affects every rasterized pixel */
+      if (addr < address::PALETTES + address_t(2 * BYTES_PER_PALETTE) && end > address::PALETTES + address_t(BYTES_PER_PALETTE))
+        markScreenDirty();
+
+      if (addr < address::SCREEN_DATA + address_t(gfx::BYTES_PER_SCREEN) && end > address::SCREEN_DATA)
+      {
+        const coord_t first = std::max(addr - address::SCREEN_DATA, 0) / coord_t(gfx::SCREEN_PITCH);
+        const coord_t last = std::min(end - address::SCREEN_DATA, address_t(gfx::BYTES_PER_SCREEN)) - 1;
+        markScreenRowsDirty(first, last / coord_t(gfx::SCREEN_PITCH));
+      }
+    }
+
+    void saveState(StateWriter& writer) const
+    {
+      writer.write(memory, sizeof(memory));
+      writer.write(_backup, sizeof(_backup));
+    }
+
+    static bool checkState(StateReader& reader)
+    {
+      return reader.fetch(sizeof(memory) + sizeof(_backup)) != nullptr;
+    }
+
+    bool loadState(StateReader& reader)
+    {
+      if (!reader.read(memory, sizeof(memory)) || !reader.read(_backup, sizeof(_backup)))
+        return false;
+
+      markDirty(0, sizeof(memory));
+      return true;
+    }
+
+    void markPaletteDirty(palette_index_t index) { markDirty(address::PALETTES + index * BYTES_PER_PALETTE, BYTES_PER_PALETTE); }
+
+    void markScreenDirty() { _dirtyRows.set(); }
+    void markScreenRowDirty(coord_t y) { _dirtyRows[y] = true; }
+    void markScreenRowsDirty(coord_t y0, coord_t y1)
+    {
+      y0 = std::max(y0, 0);
+      y1 = std::min(y1, coord_t(gfx::SCREEN_HEIGHT) - 1);
+
+      for (coord_t y = y0; y <= y1; ++y)
+        _dirtyRows[y] = true;
+    }
+    bool isScreenDirty() const { return _dirtyRows.any(); }
+    bool isScreenRowDirty(coord_t y) const { return _dirtyRows.test(y); }
+    void clearScreenDirty() { _dirtyRows.reset(); }
+
+    const gfx::pair_remap_t& drawRemap()
+    {
+      if (_drawRemapDirty)
+      {
+        _drawRemap.build(*paletteAt(gfx::DRAW_PALETTE_INDEX));
+        _drawRemapDirty = false;
+      }
+
+      return _drawRemap;
+    }
+
     gfx::color_byte_t* penColor() { return as<gfx::color_byte_t>(address::PEN_COLOR); }
     gfx::cursor_t* cursor() { return as<gfx::cursor_t>(address::CURSOR); }
     gfx::camera_t* camera() { return as<gfx::camera_t>(address::CAMERA); }
@@ -0,0 +1,188 @@
+#include "mixer.h"
+
+#if SOUND_ENABLED
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE2__)
+  #define R8_MIXER_SSE2 1
+  #include <emmintrin.h>
+#elif defined(__ARM_NEON) && !defined(__ARM_BIG_ENDIAN)
+  #define R8_MIXER_NEON 1
+  #include <arm_neon.h>
+#endif
+
+using namespace retro8;
+using namespace retro8::sfx;
+
+namespace
+{
+  /* time the limiter takes to go back to unity gain from silence */
+  constexpr float RELEASE_SECONDS = 0.2f;
+
+  inline int16_t saturate(float value)
+  {
+    return int16_t(std::max(-32768.0f, std::min(32767.0f, value)));
+  }
+
+  void accumulate(const int16_t* src, float left, float right, float* sumLeft, float* sumRight, size_t samples)
+  {
+    size_t i = 0;
+
+#if R8_MIXER_SSE2
+    const __m128 gl = _mm_set1_ps(left), gr = _mm_set1_ps(right);
+    for (; i + 8 <= samples; i += 8)
+    {
+      /* sign extends by unpacking each value in the high half and shifting it back */
+      const __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+      const __m128 lo = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(s, s), 16));
+      const __m128 hi = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(s, s), 16));
+
+      _mm_store_ps(sumLeft + i, _mm_add_ps(_mm_load_ps(sumLeft + i), _mm_mul_ps(lo, gl)));
+      _mm_store_ps(sumLeft + i + 4, _mm_add_ps(_mm_load_ps(sumLeft + i + 4), _mm_mul_ps(hi, gl)));
+      _mm_store_ps(sumRight + i, _mm_add_ps(_mm_load_ps(sumRight + i), _mm_mul_ps(lo, gr)));
+      _mm_store_ps(sumRight + i + 4, _mm_add_ps(_mm_load_ps(sumRight + i + 4), _mm_mul_ps(hi, gr)));
+    }
+#elif R8_MIXER_NEON
+    for (; i + 8 <= samples; i += 8)
+    {
+      const int16x8_t s = vld1q_s16(src + i);
+      const float32x4_t lo = vcvtq_f32_s32(vmovl_s16(vget_low_s16(s)));
+      const float32x4_t hi = vcvtq_f32_s32(vmovl_s16(vget_high_s16(s)));
+
+      vst1q_f32(sumLeft + i, vmlaq_n_f32(vld1q_f32(sumLeft + i), lo, left));
+      vst1q_f32(sumLeft + i + 4, vmlaq_n_f32(vld1q_f32(sumLeft + i + 4), hi, left));
+      vst1q_f32(sumRight + i, vmlaq_n_f32(vld1q_f32(sumRight + i), lo, right));
+      vst1q_f32(sumRight + i + 4, vmlaq_n_f32(vld1q_f32(sumRight + i + 4), hi, right));
+    }
+#endif
+
+    for (; i < samples; ++i)
+    {
+      sumLeft[i] += src[i] * left;
+      sumRight[i] += src[i] * right;
+    }
+  }
+
+  float peak(const float* sumLeft, const float* sumRight, size_t samples)
+  {
+    size_t i = 0;
+    float result = 0.0f;
+
+#if R8_MIXER_SSE2
+    const __m128 magnitude = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+    __m128 m = _mm_setzero_ps();
+    for (; i + 4 <= samples; i += 4)
+    {
+      m = _mm_max_ps(m, _mm_and_ps(_mm_load_ps(sumLeft + i), magnitude));
+      m = _mm_max_ps(m, _mm_and_ps(_mm_load_ps(sumRight + i), magnitude));
+    }
+    m = _mm_max_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(1, 0, 3, 2)));
+    m = _mm_max_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(2, 3, 0, 1)));
+    result = _mm_cvtss_f32(m);
+#elif R8_MIXER_NEON
+    float32x4_t m = vdupq_n_f32(0.0f);
+    for (; i + 4 <= samples; i += 4)
+      m = vmaxq_f32(m, vmaxq_f32(vabsq_f32(vld1q_f32(sumLeft + i)), vabsq_f32(vld1q_f32(sumRight + i))));
+    const float32x2_t h = vpmax_f32(vget_low_f32(m), vget_high_f32(m));
+    result = vget_lane_f32(vpmax_f32(h, h), 0);
+#endif
+
+    for (; i < samples; ++i)
+      result = std::max(result, std::max(std::abs(sumLeft[i]), std::abs(sumRight[i])));
+
+    return result;
+  }
+
+  /* scales the sums by a gain which moves by step each sample and interleaves them as saturated 16 bit values */
+  void output(const float* sumLeft, const float* sumRight, float gain, float step, int16_t* dest, size_t samples)
+  {
+    size_t i = 0;
+
+#if R8_MIXER_SSE2
+    __m128 g = _mm_add_ps(_mm_set1_ps(gain), _mm_mul_ps(_mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f), _mm_set1_ps(step)));
+    const __m128 g4 = _mm_set1_ps(step * 4);
+    for (; i + 8 <= samples; i += 8)
+    {
+      const __m128 l0 = _mm_mul_ps(_mm_load_ps(sumLeft + i), g), r0 = _mm_mul_ps(_mm_load_ps(sumRight + i), g);
+      g = _mm_add_ps(g, g4);
+      const __m128 l1 = _mm_mul_ps(_mm_load_ps(sumLeft + i + 4), g), r1 = _mm_mul_ps(_mm_load_ps(sumRight + i + 4), g);
+      g = _mm_add_ps(g, g4);
+
+      const __m128i l = _mm_packs_epi32(_mm_cvttps_epi32(l0), _mm_cvttps_epi32(l1));
+      const __m128i r = _mm_packs_epi32(_mm_cvttps_epi32(r0), _mm_cvttps_epi32(r1));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(dest + 2 * i), _mm_unpacklo_epi16(l, r));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(dest + 2 * i + 8), _mm_unpackhi_epi16(l, r));
+    }
+#elif R8_MIXER_NEON
+    const float steps[4] = { 0.0f, 1.0f, 2.0f, 3.0f };
+    float32x4_t g = vmlaq_n_f32(vdupq_n_f32(gain), vld1q_f32(steps), step);
+    const float32x4_t g4 = vdupq_n_f32(step * 4);
+    for (; i + 8 <= samples; i += 8)
+    {
+      const float32x4_t l0 = vmulq_f32(vld1q_f32(sumLeft + i), g), r0 = vmulq_f32(vld1q_f32(sumRight + i), g);
+      g = vaddq_f32(g, g4);
+      const float32x4_t l1 = vmulq_f32(vld1q_f32(sumLeft + i + 4), g), r1 = vmulq_f32(vld1q_f32(sumRight + i + 4), g);
+      g = vaddq_f32(g, g4);
+
+      int16x8x2_t lr;
+      lr.val[0] = vcombine_s16(vqmovn_s32(vcvtq_s32_f32(l0)), vqmovn_s32(vcvtq_s32_f32(l1)));
+      lr.val[1] = vcombine_s16(vqmovn_s32(vcvtq_s32_f32(r0)), vqmovn_s32(vcvtq_s32_f32(r1)));
+      vst2q_s16(dest + 2 * i, lr);
+    }
+#endif
+
+    for (; i < samples; ++i)
+    {
+      const float g = gain + step * i;
+      dest[2 * i] = saturate(sumLeft[i] * g);
+      dest[2 * i + 1] = saturate(sumRight[i] * g);
+    }
+  }
+}
+
+Mixer::Mixer(int32_t rate) : _master(1.0f), _limiter(1.0f)
+{
+  _left.fill(1.0f);
+  _right.fill(1.0f);
+  setSampleRate(rate);
+}
+
+void Mixer::setSampleRate(int32_t rate)
+{
+  _release = 1.0f / (RELEASE_SECONDS * rate);
+}
+
+void Mixer::setGain(size_t channel, float left, float right)
+{
+  assert(channel < CHANNEL_COUNT);
+  _left[channel] = left;
+  _right[channel] = right;
+}
+
+void Mixer::mix(const int16_t* const* channels, int16_t* dest, size_t samples)
+{
+  assert(samples <= BLOCK_SIZE);
+
+  std::memset(_sumLeft, 0, sizeof(float) * samples);
+  std::memset(_sumRight, 0, sizeof(float) * samples);
+
+  for (size_t i = 0; i < CHANNEL_COUNT; ++i)
+    if (channels[i])
+      accumulate(channels[i], _left[i] * _master, _right[i] * _master, _sumLeft, _sumRight, samples);
+
+  /* gain drops right away to keep the loudest sample of the block under the threshold and then grows
+     back slowly, never above what the block allows */
+  const float level = peak(_sumLeft, _sumRight, samples);
+  const float target = level > THRESHOLD ? THRESHOLD / level : 1.0f;
+  const float start = std::min(_limiter, target);
+  const float end = std::min(target, start + _release * samples);
+
+  output(_sumLeft, _sumRight, start, samples ? (end - start) / samples : 0.0f, dest, samples);
+  _limiter = end;
+}
+
+#endif
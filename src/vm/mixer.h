@@ -0,0 +1,54 @@
+#pragma once
+
+#include "common.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#if SOUND_ENABLED
+
+namespace retro8
+{
+  namespace sfx
+  {
+    /* sums mono channels into interleaved stereo. Each channel has a left and a right gain, the sum goes
+       through a master gain and then a limiter which lowers the level smoothly when the mix goes above
+       THRESHOLD instead of letting it clip, so busy music doesn't distort */
+    class Mixer
+    {
+    public:
+      static constexpr size_t CHANNEL_COUNT = 4;
+      /* most samples mixed by a single call, large enough for a whole 60Hz frame so that rendering
+         doesn't split notes more often than before */
+      static constexpr size_t BLOCK_SIZE = 1024;
+      static constexpr float THRESHOLD = 30000.0f;
+
+    private:
+      std::array<float, CHANNEL_COUNT> _left, _right;
+      float _master;
+
+      /* current gain of the limiter and how much it recovers per sample once the mix is quieter */
+      float _limiter, _release;
+
+      alignas(16) float _sumLeft[BLOCK_SIZE];
+      alignas(16) float _sumRight[BLOCK_SIZE];
+
+    public:
+      Mixer(int32_t rate);
+
+      void setSampleRate(int32_t rate);
+
+      void setGain(size_t channel, float left, float right);
+      void setMasterGain(float gain) { _master = gain; }
+
+      float limiterGain() const { return _limiter; }
+
+      /* channels holds CHANNEL_COUNT buffers of samples each, silent ones can be nullptr. dest receives
+         2 * samples values, samples must not exceed BLOCK_SIZE */
+      void mix(const int16_t* const* channels, int16_t* dest, size_t samples);
+    };
+  }
+}
+
+#endif
@@ -0,0 +1,166 @@
+#include "profiler.h"
+
+#if R8_PROFILER_ENABLED
+
+#include "lua/lua.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <vector>
+
+using namespace lua;
+
+namespace
+{
+  /* every lua_State of the same machine shares the profiler through this registry key */
+  const char PROFILER_KEY = 0;
+}
+
+int Profiler::profiled(lua_State* L)
+{
+  Entry* entry = static_cast<Entry*>(lua_touserdata(L, lua_upvalueindex(1)));
+
+  const auto start = std::chrono::steady_clock::now();
+  const int results = entry->function(L);
+  entry->time += std::chrono::steady_clock::now() - start;
+  ++entry->calls;
+
+  return results;
+}
+
+void Profiler::hook(lua_State* L, lua_Debug* ar)
+{
+  lua_rawgetp(L, LUA_REGISTRYINDEX, &PROFILER_KEY);
+  Profiler* profiler = static_cast<Profiler*>(lua_touserdata(L, -1));
+  lua_pop(L, 1);
+
+  if (!profiler)
+    return;
+
+  std::vector<std::string> frames;
+  lua_Debug info;
+
+  for (int level = 0; level < MAX_STACK_DEPTH && lua_getstack(L, level, &info); ++level)
+  {
+    lua_getinfo(L, "Sln", &info);
+
+    /* entry points are called through pcall so they have no name, the definition line identifies them */
+    std::string frame;
+    if (info.name)
+      frame = info.name;
+    else if (info.what[0] == 'm')
+      frame = "main";
+    else
+      frame = "function@" + std::to_string(info.linedefined);
+
+    /* leaf keeps the current line so that hot lines are visible */
+    if (level == 0 && info.currentline >= 0)
+      frame += ":" + std::to_string(info.currentline);
+    frames.push_back(frame);
+  }
+
+  std::string stack;
+  for (auto it = frames.rbegin(); it != frames.rend(); ++it)
+  {
+    if (!stack.empty())
+      stack += ';';
+    stack += *it;
+  }
+
+  ++profiler->_stacks[stack];
+}
+
+Profiler::function_set_t Profiler::globalFunctions(lua_State* L)
+{
+  function_set_t functions;
+
+  lua_pushglobaltable(L);
+  lua_pushnil(L);
+  while (lua_next(L, -2))
+  {
+    if (lua_iscfunction(L, -1))
+      functions.insert(lua_tocfunction(L, -1));
+    lua_pop(L, 1);
+  }
+  lua_pop(L, 1);
+
+  return functions;
+}
+
+void Profiler::instrument(lua_State* L, const function_set_t& previous)
+{
+  std::vector<std::pair<std::string, function_t>> functions;
+
+  lua_pushglobaltable(L);
+  lua_pushnil(L);
+  while (lua_next(L, -2))
+  {
+    if (lua_type(L, -2) == LUA_TSTRING && lua_iscfunction(L, -1))
+    {
+      function_t function = lua_tocfunction(L, -1);
+      if (function != profiled && previous.find(function) == previous.end())
+        functions.emplace_back(lua_tostring(L, -2), function);
+    }
+    lua_pop(L, 1);
+  }
+  lua_pop(L, 1);
+
+  for (const auto& function : functions)
+  {
+    auto it = std::find_if(_entries.begin(), _entries.end(), [&function](const Entry& entry) { return entry.name == function.first; });
+
+    if (it == _entries.end())
+    {
+      _entries.push_back({ function.first, function.second, 0, std::chrono::nanoseconds(0) });
+      it = _entries.end() - 1;
+    }
+    else
+      it->function = function.second;
+
+    lua_pushlightuserdata(L, &*it);
+    lua_pushcclosure(L, profiled, 1);
+    lua_setglobal(L, function.first.c_str());
+  }
+
+  lua_pushlightuserdata(L, this);
+  lua_rawsetp(L, LUA_REGISTRYINDEX, &PROFILER_KEY);
+  lua_sethook(L, hook, LUA_MASKCOUNT, SAMPLE_INSTRUCTIONS);
+}
+
+void Profiler::push(lua_State* L) const
+{
+  lua_createtable(L, 0, int(_entries.size()));
+
+  for (const Entry& entry : _entries)
+  {
+    lua_createtable(L, 0, 2);
+    lua_pushinteger(L, lua_Integer(entry.calls));
+    lua_setfield(L, -2, "calls");
+    lua_pushnumber(L, lua_uac2number(std::chrono::duration<double>(entry.time).count()));
+    lua_setfield(L, -2, "time");
+    lua_setfield(L, -2, entry.name.c_str());
+  }
+}
+
+void Profiler::dump(const std::string& path) const
+{
+  std::ofstream folded(path + ".folded");
+  for (const auto& stack : _stacks)
+    folded << stack.first << ' ' << stack.second << '\n';
+
+  std::vector<const Entry*> entries;
+  for (const Entry& entry : _entries)
+    if (entry.calls)
+      entries.push_back(&entry);
+  std::sort(entries.begin(), entries.end(), [](const Entry* a, const Entry* b) { return a->time > b->time; });
+
+  std::ofstream calls(path + ".calls.csv");
+  calls << "function,calls,total_ms,average_us\n";
+  for (const Entry* entry : entries)
+  {
+    const double ms = std::chrono::duration<double, std::milli>(entry->time).count();
+    calls << entry->name << ',' << entry->calls << ',' << ms << ',' << (ms * 1000.0 / entry->calls) << '\n';
+  }
+}
+
+#endif
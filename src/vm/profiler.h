@@ -0,0 +1,59 @@
+#pragma once
+
+#include "common.h"
+
+#if R8_PROFILER_ENABLED
+
+#include <chrono>
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+struct lua_State;
+struct lua_Debug;
+
+namespace lua
+{
+  /* wraps bound API functions with call counters and timers and samples Lua call stacks
+     through a count hook, only compiled when R8_PROFILER_ENABLED is set */
+  class Profiler
+  {
+  public:
+    using function_t = int(*)(lua_State*);
+    using function_set_t = std::unordered_set<function_t>;
+
+    static constexpr int SAMPLE_INSTRUCTIONS = 1000;
+    static constexpr int MAX_STACK_DEPTH = 64;
+
+    struct Entry
+    {
+      std::string name;
+      function_t function;
+      uint64_t calls;
+      std::chrono::nanoseconds time;
+    };
+
+  private:
+    /* deque so that entries never move, closures keep a pointer to them */
+    std::deque<Entry> _entries;
+    std::unordered_map<std::string, uint64_t> _stacks;
+
+    static int profiled(lua_State* L);
+    static void hook(lua_State* L, lua_Debug* ar);
+
+  public:
+    /* C functions currently bound as globals */
+    static function_set_t globalFunctions(lua_State* L);
+    /* wraps every global C function which is not part of previous */
+    void instrument(lua_State* L, const function_set_t& previous);
+
+    /* pushes a table with calls and time in seconds for each API function */
+    void push(lua_State* L) const;
+
+    /* writes sampled stacks as folded stacks in path.folded and API timings in path.calls.csv */
+    void dump(const std::string& path) const;
+  };
+}
+
+#endif
@@ -0,0 +1,394 @@
+#include "raster.h"
+
+#include <algorithm>
+#include <cstring>
+#include <initializer_list>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && !defined(__DJGPP__)
+  #define R8_RASTER_X86 1
+  #define R8_TARGET(x) __attribute__((target(x)))
+  #include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) && !defined(__ARM_BIG_ENDIAN)
+  #define R8_RASTER_NEON 1
+  #include <arm_neon.h>
+#endif
+
+using namespace retro8;
+using namespace retro8::gfx;
+
+static_assert(sizeof(color_byte_t) == 1, "color_byte_t must be 1 byte");
+
+namespace
+{
+  template<typename T>
+  void rasterizeScalar(const color_byte_t* src, T* dest, size_t bytes, const T* lut)
+  {
+    for (size_t i = 0; i < bytes; ++i, dest += 2)
+    {
+      dest[0] = lut[src[i].low()];
+      dest[1] = lut[src[i].high()];
+    }
+  }
+
+  /* splits each color of the lut into byte planes so that every plane can be used as a 16 entry shuffle table */
+  template<typename T>
+  void splitPlanes(const T* lut, uint8_t planes[][COLOR_COUNT])
+  {
+    for (size_t i = 0; i < COLOR_COUNT; ++i)
+      for (size_t k = 0; k < sizeof(T); ++k)
+        planes[k][i] = (lut[i] >> (8 * k)) & 0xff;
+  }
+
+  template<size_t S, typename T>
+  void expandRow(const color_byte_t* src, T* dest, size_t bytes, const T* lut)
+  {
+    for (size_t i = 0; i < bytes; ++i)
+    {
+      const T low = lut[src[i].low()], high = lut[src[i].high()];
+
+      for (size_t k = 0; k < S; ++k)
+        *dest++ = low;
+      for (size_t k = 0; k < S; ++k)
+        *dest++ = high;
+    }
+  }
+
+  template<typename T>
+  void expandRow(const color_byte_t* src, T* dest, size_t bytes, const T* lut, size_t scale)
+  {
+    for (size_t i = 0; i < bytes; ++i)
+    {
+      dest = std::fill_n(dest, scale, lut[src[i].low()]);
+      dest = std::fill_n(dest, scale, lut[src[i].high()]);
+    }
+  }
+
+  template<typename T, typename R>
+  void rasterizeScaled(R row, const color_byte_t* src, T* dest, size_t bytes, const T* lut, size_t scale, size_t pitch)
+  {
+    switch (scale)
+    {
+    case 0: return;
+    case 1: row(src, dest, bytes, lut); return;
+    case 2: expandRow<2>(src, dest, bytes, lut); break;
+    case 3: expandRow<3>(src, dest, bytes, lut); break;
+    case 4: expandRow<4>(src, dest, bytes, lut); break;
+    default: expandRow(src, dest, bytes, lut, scale); break;
+    }
+
+    /* duplicated scanlines are plain copies of the first one */
+    const size_t width = bytes * 2 * scale;
+    for (size_t r = 1; r < scale; ++r)
+      std::memcpy(dest + r * pitch, dest, width * sizeof(T));
+  }
+
+#if R8_RASTER_X86
+
+  /* returns pixel indices as low nibbles first: 0..15 in first value, 16..31 in second */
+  R8_TARGET("ssse3") inline void unpackNibbles(__m128i in, __m128i& first, __m128i& second)
+  {
+    const __m128i mask = _mm_set1_epi8(0x0f);
+    const __m128i lo = _mm_and_si128(in, mask);
+    const __m128i hi = _mm_and_si128(_mm_srli_epi16(in, 4), mask);
+
+    first = _mm_unpacklo_epi8(lo, hi);
+    second = _mm_unpackhi_epi8(lo, hi);
+  }
+
+  R8_TARGET("ssse3") inline void store32(__m128i idx, const __m128i* planes, uint32_t* dest)
+  {
+    const __m128i b0 = _mm_shuffle_epi8(planes[0], idx);
+    const __m128i b1 = _mm_shuffle_epi8(planes[1], idx);
+    const __m128i b2 = _mm_shuffle_epi8(planes[2], idx);
+    const __m128i b3 = _mm_shuffle_epi8(planes[3], idx);
+
+    const __m128i b01l = _mm_unpacklo_epi8(b0, b1), b01h = _mm_unpackhi_epi8(b0, b1);
+    const __m128i b23l = _mm_unpacklo_epi8(b2, b3), b23h = _mm_unpackhi_epi8(b2, b3);
+
+    __m128i* out = reinterpret_cast<__m128i*>(dest);
+    _mm_storeu_si128(out + 0, _mm_unpacklo_epi16(b01l, b23l));
+    _mm_storeu_si128(out + 1, _mm_unpackhi_epi16(b01l, b23l));
+    _mm_storeu_si128(out + 2, _mm_unpacklo_epi16(b01h, b23h));
+    _mm_storeu_si128(out + 3, _mm_unpackhi_epi16(b01h, b23h));
+  }
+
+  R8_TARGET("ssse3") inline void store16(__m128i idx, const __m128i* planes, uint16_t* dest)
+  {
+    const __m128i b0 = _mm_shuffle_epi8(planes[0], idx);
+    const __m128i b1 = _mm_shuffle_epi8(planes[1], idx);
+
+    __m128i* out = reinterpret_cast<__m128i*>(dest);
+    _mm_storeu_si128(out + 0, _mm_unpacklo_epi8(b0, b1));
+    _mm_storeu_si128(out + 1, _mm_unpackhi_epi8(b0, b1));
+  }
+
+  R8_TARGET("ssse3") void rasterize32SSSE3(const color_byte_t* src, uint32_t* dest, size_t bytes, const uint32_t* lut)
+  {
+    uint8_t tables[4][COLOR_COUNT];
+    splitPlanes(lut, tables);
+
+    __m128i planes[4];
+    for (size_t k = 0; k < 4; ++k)
+      planes[k] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(tables[k]));
+
+    size_t i = 0;
+    for (; i + 16 <= bytes; i += 16, dest += 32)
+    {
+      __m128i first, second;
+      unpackNibbles(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i)), first, second);
+      store32(first, planes, dest);
+      store32(second, planes, dest + 16);
+    }
+
+    rasterizeScalar(src + i, dest, bytes - i, lut);
+  }
+
+  R8_TARGET("ssse3") void rasterize16SSSE3(const color_byte_t* src, uint16_t* dest, size_t bytes, const uint16_t* lut)
+  {
+    uint8_t tables[2][COLOR_COUNT];
+    splitPlanes(lut, tables);
+
+    __m128i planes[2];
+    for (size_t k = 0; k < 2; ++k)
+      planes[k] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(tables[k]));
+
+    size_t i = 0;
+    for (; i + 16 <= bytes; i += 16, dest += 32)
+    {
+      __m128i first, second;
+      unpackNibbles(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i)), first, second);
+      store16(first, planes, dest);
+      store16(second, planes, dest + 16);
+    }
+
+    rasterizeScalar(src + i, dest, bytes - i, lut);
+  }
+
+  /* AVX2 shuffles and unpacks work on each 128 bit lane separately: with 32 input bytes the
+     first index vector holds pixels 0..15 and 32..47, the second one 16..31 and 48..63 */
+  R8_TARGET("avx2") inline void unpackNibbles(__m256i in, __m256i& first, __m256i& second)
+  {
+    const __m256i mask = _mm256_set1_epi8(0x0f);
+    const __m256i lo = _mm256_and_si256(in, mask);
+    const __m256i hi = _mm256_and_si256(_mm256_srli_epi16(in, 4), mask);
+
+    first = _mm256_unpacklo_epi8(lo, hi);
+    second = _mm256_unpackhi_epi8(lo, hi);
+  }
+
+  R8_TARGET("avx2") inline void store32(__m256i idx, const __m256i* planes, uint32_t* dest)
+  {
+    const __m256i b0 = _mm256_shuffle_epi8(planes[0], idx);
+    const __m256i b1 = _mm256_shuffle_epi8(planes[1], idx);
+    const __m256i b2 = _mm256_shuffle_epi8(planes[2], idx);
+    const __m256i b3 = _mm256_shuffle_epi8(planes[3], idx);
+
+    const __m256i b01l = _mm256_unpacklo_epi8(b0, b1), b01h = _mm256_unpackhi_epi8(b0, b1);
+    const __m256i b23l = _mm256_unpacklo_epi8(b2, b3), b23h = _mm256_unpackhi_epi8(b2, b3);
+
+    const __m256i q0 = _mm256_unpacklo_epi16(b01l, b23l), q1 = _mm256_unpackhi_epi16(b01l, b23l);
+    const __m256i q2 = _mm256_unpacklo_epi16(b01h, b23h), q3 = _mm256_unpackhi_epi16(b01h, b23h);
+
+    __m256i* out = reinterpret_cast<__m256i*>(dest);
+    _mm256_storeu_si256(out + 0, _mm256_permute2x128_si256(q0, q1, 0x20));
+    _mm256_storeu_si256(out + 1, _mm256_permute2x128_si256(q2, q3, 0x20));
+    _mm256_storeu_si256(out + 4, _mm256_permute2x128_si256(q0, q1, 0x31));
+    _mm256_storeu_si256(out + 5, _mm256_permute2x128_si256(q2, q3, 0x31));
+  }
+
+  R8_TARGET("avx2") inline void store16(__m256i idx, const __m256i* planes, uint16_t* dest)
+  {
+    const __m256i b0 = _mm256_shuffle_epi8(planes[0], idx);
+    const __m256i b1 = _mm256_shuffle_epi8(planes[1], idx);
+
+    const __m256i w0 = _mm256_unpacklo_epi8(b0, b1), w1 = _mm256_unpackhi_epi8(b0, b1);
+
+    __m256i* out = reinterpret_cast<__m256i*>(dest);
+    _mm256_storeu_si256(out + 0, _mm256_permute2x128_si256(w0, w1, 0x20));
+    _mm256_storeu_si256(out + 2, _mm256_permute2x128_si256(w0, w1, 0x31));
+  }
+
+  R8_TARGET("avx2") void rasterize32AVX2(const color_byte_t* src, uint32_t* dest, size_t bytes, const uint32_t* lut)
+  {
+    uint8_t tables[4][COLOR_COUNT];
+    splitPlanes(lut, tables);
+
+    __m256i planes[4];
+    for (size_t k = 0; k < 4; ++k)
+      planes[k] = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(tables[k])));
+
+    size_t i = 0;
+    for (; i + 32 <= bytes; i += 32, dest += 64)
+    {
+      __m256i first, second;
+      unpackNibbles(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i)), first, second);
+      store32(first, planes, dest);
+      store32(second, planes, dest + 16);
+    }
+
+    rasterizeScalar(src + i, dest, bytes - i, lut);
+  }
+
+  R8_TARGET("avx2") void rasterize16AVX2(const color_byte_t* src, uint16_t* dest, size_t bytes, const uint16_t* lut)
+  {
+    uint8_t tables[2][COLOR_COUNT];
+    splitPlanes(lut, tables);
+
+    __m256i planes[2];
+    for (size_t k = 0; k < 2; ++k)
+      planes[k] = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(tables[k])));
+
+    size_t i = 0;
+    for (; i + 32 <= bytes; i += 32, dest += 64)
+    {
+      __m256i first, second;
+      unpackNibbles(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i)), first, second);
+      store16(first, planes, dest);
+      store16(second, planes, dest + 16);
+    }
+
+    rasterizeScalar(src + i, dest, bytes - i, lut);
+  }
+
+#endif
+
+#if R8_RASTER_NEON
+
+  inline uint8x16_t lookup(uint8x16_t table, uint8x16_t idx)
+  {
+#if defined(__aarch64__)
+    return vqtbl1q_u8(table, idx);
+#else
+    const uint8x8x2_t t = { { vget_low_u8(table), vget_high_u8(table) } };
+    return vcombine_u8(vtbl2_u8(t, vget_low_u8(idx)), vtbl2_u8(t, vget_high_u8(idx)));
+#endif
+  }
+
+  /* returns pixel indices as low nibbles first: 0..15 in val[0], 16..31 in val[1] */
+  inline uint8x16x2_t unpackNibbles(const color_byte_t* src)
+  {
+    const uint8x16_t in = vld1q_u8(reinterpret_cast<const uint8_t*>(src));
+    return vzipq_u8(vandq_u8(in, vdupq_n_u8(0x0f)), vshrq_n_u8(in, 4));
+  }
+
+  void rasterize32NEON(const color_byte_t* src, uint32_t* dest, size_t bytes, const uint32_t* lut)
+  {
+    uint8_t tables[4][COLOR_COUNT];
+    splitPlanes(lut, tables);
+
+    uint8x16_t planes[4];
+    for (size_t k = 0; k < 4; ++k)
+      planes[k] = vld1q_u8(tables[k]);
+
+    size_t i = 0;
+    for (; i + 16 <= bytes; i += 16, dest += 32)
+    {
+      const uint8x16x2_t idx = unpackNibbles(src + i);
+
+      for (size_t h = 0; h < 2; ++h)
+      {
+        const uint8x16x4_t pixels = { { lookup(planes[0], idx.val[h]), lookup(planes[1], idx.val[h]), lookup(planes[2], idx.val[h]), lookup(planes[3], idx.val[h]) } };
+        vst4q_u8(reinterpret_cast<uint8_t*>(dest + 16 * h), pixels);
+      }
+    }
+
+    rasterizeScalar(src + i, dest, bytes - i, lut);
+  }
+
+  void rasterize16NEON(const color_byte_t* src, uint16_t* dest, size_t bytes, const uint16_t* lut)
+  {
+    uint8_t tables[2][COLOR_COUNT];
+    splitPlanes(lut, tables);
+
+    const uint8x16_t lowPlane = vld1q_u8(tables[0]);
+    const uint8x16_t highPlane = vld1q_u8(tables[1]);
+
+    size_t i = 0;
+    for (; i + 16 <= bytes; i += 16, dest += 32)
+    {
+      const uint8x16x2_t idx = unpackNibbles(src + i);
+
+      for (size_t h = 0; h < 2; ++h)
+      {
+        const uint8x16x2_t pixels = { { lookup(lowPlane, idx.val[h]), lookup(highPlane, idx.val[h]) } };
+        vst2q_u8(reinterpret_cast<uint8_t*>(dest + 16 * h), pixels);
+      }
+    }
+
+    rasterizeScalar(src + i, dest, bytes - i, lut);
+  }
+
+#endif
+}
+
+Rasterizer::Rasterizer() : Rasterizer(bestBackend()) { }
+
+Rasterizer::Rasterizer(Backend backend) : _backend(backend), _row32(rasterizeScalar<uint32_t>), _row16(rasterizeScalar<uint16_t>)
+{
+  assert(isSupported(backend));
+
+  switch (backend)
+  {
+#if R8_RASTER_X86
+  case Backend::SSSE3: _row32 = rasterize32SSSE3; _row16 = rasterize16SSSE3; break;
+  case Backend::AVX2: _row32 = rasterize32AVX2; _row16 = rasterize16AVX2; break;
+#endif
+#if R8_RASTER_NEON
+  case Backend::NEON: _row32 = rasterize32NEON; _row16 = rasterize16NEON; break;
+#endif
+  default: _backend = Backend::SCALAR; break;
+  }
+}
+
+void Rasterizer::rasterize(const color_byte_t* src, uint32_t* dest, size_t bytes, const color_lut_t<uint32_t>& lut, size_t scale, size_t pitch) const
+{
+  rasterizeScaled(_row32, src, dest, bytes, lut.data(), scale, pitch);
+}
+
+void Rasterizer::rasterize(const color_byte_t* src, uint16_t* dest, size_t bytes, const color_lut_t<uint16_t>& lut, size_t scale, size_t pitch) const
+{
+  rasterizeScaled(_row16, src, dest, bytes, lut.data(), scale, pitch);
+}
+
+size_t Rasterizer::fitScale(size_t width, size_t height)
+{
+  return std::max<size_t>(1, std::min(width / SCREEN_WIDTH, height / SCREEN_HEIGHT));
+}
+
+bool Rasterizer::isSupported(Backend backend)
+{
+  switch (backend)
+  {
+  case Backend::SCALAR: return true;
+#if R8_RASTER_X86
+  case Backend::SSSE3: __builtin_cpu_init(); return __builtin_cpu_supports("ssse3");
+  case Backend::AVX2: __builtin_cpu_init(); return __builtin_cpu_supports("avx2");
+#endif
+#if R8_RASTER_NEON
+  case Backend::NEON: return true;
+#endif
+  default: return false;
+  }
+}
+
+Rasterizer::Backend Rasterizer::bestBackend()
+{
+  for (Backend backend : { Backend::AVX2, Backend::SSSE3, Backend::NEON })
+    if (isSupported(backend))
+      return backend;
+
+  return Backend::SCALAR;
+}
+
+const char* Rasterizer::name(Backend backend)
+{
+  switch (backend)
+  {
+  case Backend::SSSE3: return "SSSE3";
+  case Backend::AVX2: return "AVX2";
+  case Backend::NEON: return "NEON";
+  default: return "scalar";
+  }
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "gfx.h"
+
+#include <array>
+#include <cstdint>
+
+namespace retro8
+{
+  namespace gfx
+  {
+    /* final output color for each of the 16 screen indices, screen palette is already applied */
+    template<typename T> using color_lut_t = std::array<T, COLOR_COUNT>;
+
+    template<typename T>
+    void buildColorLut(const ColorTable& table, const palette_t& screenPalette, color_lut_t<T>& lut)
+    {
+      for (size_t i = 0; i < COLOR_COUNT; ++i)
+        lut[i] = static_cast<T>(table.get(screenPalette.get(color_t(i))));
+    }
+
+    /* converts rows of 4bpp screen memory into 32 or 16 bit pixels, the implementation
+       is chosen at runtime according to what the cpu supports */
+    class Rasterizer
+    {
+    public:
+      enum class Backend { SCALAR, SSSE3, AVX2, NEON };
+
+      using row32_t = void(*)(const color_byte_t* src, uint32_t* dest, size_t bytes, const uint32_t* lut);
+      using row16_t = void(*)(const color_byte_t* src, uint16_t* dest, size_t bytes, const uint16_t* lut);
+
+    private:
+      Backend _backend;
+      row32_t _row32;
+      row16_t _row16;
+
+    public:
+      Rasterizer();
+      Rasterizer(Backend backend);
+
+      static bool isSupported(Backend backend);
+      static Backend bestBackend();
+      static const char* name(Backend backend);
+
+      Backend backend() const { return _backend; }
+
+      void rasterize(const color_byte_t* src, uint32_t* dest, size_t bytes, const color_lut_t<uint32_t>& lut) const { _row32(src, dest, bytes, lut.data()); }
+      void rasterize(const color_byte_t* src, uint16_t* dest, size_t bytes, const color_lut_t<uint16_t>& lut) const { _row16(src, dest, bytes, lut.data()); }
+
+      /* nearest neighbour upscaled variant: writes scale output rows spaced by pitch pixels,
+         each pixel is written once and the additional rows are copied from the first one */
+      void rasterize(const color_byte_t* src, uint32_t* dest, size_t bytes, const color_lut_t<uint32_t>& lut, size_t scale, size_t pitch) const;
+      void rasterize(const color_byte_t* src, uint16_t* dest, size_t bytes, const color_lut_t<uint16_t>& lut, size_t scale, size_t pitch) const;
+
+      /* biggest integer scale factor at which the screen fits inside the given area */
+      static size_t fitScale(size_t width, size_t height);
+    };
+  }
+}
@@ -0,0 +1,225 @@
+#include "resampler.h"
+
+#if SOUND_ENABLED
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE2__)
+  #define R8_RESAMPLER_SSE2 1
+  #include <emmintrin.h>
+#elif defined(__ARM_NEON) && !defined(__ARM_BIG_ENDIAN)
+  #define R8_RESAMPLER_NEON 1
+  #include <arm_neon.h>
+#endif
+
+using namespace retro8;
+using namespace retro8::sfx;
+
+namespace
+{
+  /* Kaiser window shape, sidelobes end up around -80dB */
+  constexpr double KAISER_BETA = 8.0;
+  /* cutoff as a fraction of the lower of the two rates, the rest is the transition band */
+  constexpr double CUTOFF = 0.9;
+
+  /* frames kept allocated so that pushing a block doesn't need to grow the history */
+  constexpr size_t RESERVED_FRAMES = 4096;
+
+  /* modified Bessel function of the first kind, order 0 */
+  double bessel0(double x)
+  {
+    double sum = 1.0, term = 1.0;
+    for (int k = 1; k < 32; ++k)
+    {
+      term *= (x / (2 * k)) * (x / (2 * k));
+      sum += term;
+    }
+    return sum;
+  }
+
+  inline int16_t saturate(float value)
+  {
+    return int16_t(std::max(-32768.0f, std::min(32767.0f, value)));
+  }
+
+  /* taps interpolated between two phases applied to interleaved stereo frames */
+  void convolve(const float* filter, const float* delta, float mix, const float* src, size_t taps, float& left, float& right)
+  {
+    size_t t = 0;
+    left = right = 0.0f;
+
+#if R8_RESAMPLER_SSE2
+    const __m128 m = _mm_set1_ps(mix);
+    __m128 low = _mm_setzero_ps(), high = _mm_setzero_ps();
+    for (; t + 4 <= taps; t += 4)
+    {
+      /* each coefficient is doubled to line up with the left and right values of its frame */
+      const __m128 c = _mm_add_ps(_mm_loadu_ps(filter + t), _mm_mul_ps(_mm_loadu_ps(delta + t), m));
+      low = _mm_add_ps(low, _mm_mul_ps(_mm_unpacklo_ps(c, c), _mm_loadu_ps(src + 2 * t)));
+      high = _mm_add_ps(high, _mm_mul_ps(_mm_unpackhi_ps(c, c), _mm_loadu_ps(src + 2 * t + 4)));
+    }
+    __m128 sum = _mm_add_ps(low, high);
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    left = _mm_cvtss_f32(sum);
+    right = _mm_cvtss_f32(_mm_shuffle_ps(sum, sum, _MM_SHUFFLE(1, 1, 1, 1)));
+#elif R8_RESAMPLER_NEON
+    float32x4_t low = vdupq_n_f32(0.0f), high = vdupq_n_f32(0.0f);
+    for (; t + 4 <= taps; t += 4)
+    {
+      const float32x4_t c = vmlaq_n_f32(vld1q_f32(filter + t), vld1q_f32(delta + t), mix);
+      const float32x4x2_t doubled = vzipq_f32(c, c);
+      low = vmlaq_f32(low, doubled.val[0], vld1q_f32(src + 2 * t));
+      high = vmlaq_f32(high, doubled.val[1], vld1q_f32(src + 2 * t + 4));
+    }
+    const float32x4_t sum = vaddq_f32(low, high);
+    const float32x2_t pair = vadd_f32(vget_low_f32(sum), vget_high_f32(sum));
+    left = vget_lane_f32(pair, 0);
+    right = vget_lane_f32(pair, 1);
+#endif
+
+    for (; t < taps; ++t)
+    {
+      const float c = filter[t] + delta[t] * mix;
+      left += c * src[2 * t];
+      right += c * src[2 * t + 1];
+    }
+  }
+}
+
+Resampler::Resampler(int32_t inputRate, int32_t outputRate) : _inputRate(inputRate), _outputRate(outputRate),
+  _step((uint64_t(inputRate) << 32) / uint64_t(outputRate)), _position(0), _frames(0), _silence(0)
+{
+  const double PI = 3.14159265358979323846;
+
+  /* going down the filter is stretched by the ratio, both in cutoff and in length */
+  const double scale = std::min(1.0, double(outputRate) / inputRate);
+  const double cutoff = 0.5 * CUTOFF * scale;
+  /* even on each side so that vectors of 4 taps cover the filter */
+  const size_t half = (size_t(std::ceil(HALF_TAPS / scale)) + 1) & ~size_t(1);
+  _taps = 2 * half;
+
+  std::vector<double> phases((PHASES + 1) * _taps);
+  for (size_t p = 0; p <= PHASES; ++p)
+  {
+    /* tap half - 1 is the frame just before the position, p / PHASES of a frame before it */
+    const double fraction = double(p) / PHASES;
+    double* taps = &phases[p * _taps];
+    double sum = 0.0;
+
+    for (size_t t = 0; t < _taps; ++t)
+    {
+      const double x = double(t) - (half - 1) - fraction;
+      const double r = x / half;
+      const double window = bessel0(KAISER_BETA * std::sqrt(std::max(0.0, 1.0 - r * r))) / bessel0(KAISER_BETA);
+      const double sinc = x == 0.0 ? 1.0 : std::sin(2 * PI * cutoff * x) / (2 * PI * cutoff * x);
+
+      taps[t] = 2 * cutoff * sinc * window;
+      sum += taps[t];
+    }
+
+    /* unity gain at DC for every phase */
+    for (size_t t = 0; t < _taps; ++t)
+      taps[t] /= sum;
+  }
+
+  _filters.resize(PHASES * _taps);
+  _deltas.resize(PHASES * _taps);
+  for (size_t i = 0; i < PHASES * _taps; ++i)
+  {
+    _filters[i] = float(phases[i]);
+    _deltas[i] = float(phases[i + _taps] - phases[i]);
+  }
+
+  _history.reserve(2 * (RESERVED_FRAMES + _taps));
+  reset();
+}
+
+void Resampler::reset()
+{
+  /* output frame 0 falls on input frame 0 once half - 1 frames of silence are in front */
+  _frames = _taps / 2 - 1;
+  _history.assign(2 * _frames, 0.0f);
+  _silence = _frames;
+  _position = 0;
+}
+
+size_t Resampler::needed(size_t frames) const
+{
+  if (!frames)
+    return 0;
+
+  const size_t required = size_t((_position + (frames - 1) * _step) >> 32) + _taps;
+  return required > _frames ? required - _frames : 0;
+}
+
+size_t Resampler::maxNeeded(size_t frames) const
+{
+  return frames ? size_t((0xffffffffULL + (frames - 1) * _step) >> 32) + _taps : 0;
+}
+
+void Resampler::push(const int16_t* src, size_t frames)
+{
+  _history.resize(2 * (_frames + frames));
+
+  float* dest = &_history[2 * _frames];
+  size_t last = 0;
+  for (size_t i = 0; i < 2 * frames; ++i)
+  {
+    dest[i] = src[i];
+    if (src[i])
+      last = i / 2 + 1;
+  }
+
+  _silence = last ? frames - last : _silence + frames;
+  _frames += frames;
+}
+
+void Resampler::pull(int16_t* dest, size_t frames)
+{
+  constexpr int MIX_BITS = 32 - PHASE_BITS;
+  constexpr float MIX_SCALE = 1.0f / (1 << MIX_BITS);
+
+  if (_silence >= _frames)
+  {
+    std::memset(dest, 0, sizeof(int16_t) * 2 * frames);
+    _position += frames * _step;
+  }
+  else
+  {
+    for (size_t j = 0; j < frames; ++j)
+    {
+      const size_t index = size_t(_position >> 32);
+      const uint32_t fraction = uint32_t(_position);
+
+      const size_t phase = fraction >> MIX_BITS;
+      const float mix = (fraction & ((1u << MIX_BITS) - 1)) * MIX_SCALE;
+
+      const float* filter = &_filters[phase * _taps];
+      const float* delta = &_deltas[phase * _taps];
+      const float* src = &_history[2 * index];
+
+      float left, right;
+      convolve(filter, delta, mix, src, _taps, left, right);
+
+      dest[2 * j] = saturate(left);
+      dest[2 * j + 1] = saturate(right);
+
+      _position += _step;
+    }
+  }
+
+  /* frames before the position won't be used anymore */
+  const size_t consumed = std::min(size_t(_position >> 32), _frames);
+  if (consumed)
+  {
+    std::memmove(_history.data(), _history.data() + 2 * consumed, sizeof(float) * 2 * (_frames - consumed));
+    _frames -= consumed;
+    _silence = std::min(_silence, _frames);
+    _history.resize(2 * _frames);
+    _position -= uint64_t(consumed) << 32;
+  }
+}
+
+#endif
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "common.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#if SOUND_ENABLED
+
+namespace retro8
+{
+  namespace sfx
+  {
+    /* converts interleaved stereo from the rate the APU renders at to the rate of the output device with
+       a polyphase windowed sinc filter. The filter has PHASES sets of taps for fractional positions
+       between two input frames and interpolates between the nearest two. When converting down the cutoff
+       goes below the output Nyquist frequency and the filter gets longer so that nothing aliases */
+    class Resampler
+    {
+    public:
+      static constexpr int PHASE_BITS = 8;
+      static constexpr size_t PHASES = size_t(1) << PHASE_BITS;
+      /* taps on each side of the position when not converting down */
+      static constexpr size_t HALF_TAPS = 16;
+
+    private:
+      int32_t _inputRate, _outputRate;
+      size_t _taps;
+      /* taps of each phase and their difference with the next phase */
+      std::vector<float> _filters, _deltas;
+
+      /* input frames per output frame and position of the next output frame in the history, both 32.32 */
+      uint64_t _step, _position;
+
+      /* buffered stereo input frames, the oldest ones are dropped as the position goes past them */
+      std::vector<float> _history;
+      size_t _frames;
+      /* silent frames at the end of the history, output is silent too when they cover all of it */
+      size_t _silence;
+
+    public:
+      Resampler(int32_t inputRate, int32_t outputRate);
+
+      int32_t inputRate() const { return _inputRate; }
+      int32_t outputRate() const { return _outputRate; }
+
+      /* input frames to push before frames output frames can be pulled, and an upper bound of that */
+      size_t needed(size_t frames) const;
+      size_t maxNeeded(size_t frames) const;
+
+      void push(const int16_t* src, size_t frames);
+      /* writes frames stereo frames to dest, needed(frames) input frames must have been pushed */
+      void pull(int16_t* dest, size_t frames);
+
+      /* drops buffered input, output restarts from silence */
+      void reset();
+    };
+  }
+}
+
+#endif
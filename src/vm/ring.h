@@ -0,0 +1,64 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace retro8
+{
+  /* fixed capacity queue between exactly one producer thread and one consumer thread. Indices only
+     grow and wrap around, each side writes its own with release order and reads the other one with
+     acquire order so no lock is needed and nothing is allocated after construction */
+  template<typename T, size_t N>
+  class Ring
+  {
+    static_assert(N && (N & (N - 1)) == 0, "capacity must be a power of 2");
+
+  private:
+    std::array<T, N> _items;
+    std::atomic<uint32_t> _head; // next to read, written by consumer
+    std::atomic<uint32_t> _tail; // next to write, written by producer
+
+  public:
+    Ring() : _head(0), _tail(0) { }
+
+    static constexpr size_t capacity() { return N; }
+
+    /* producer side, false when full */
+    bool push(const T& item)
+    {
+      const uint32_t tail = _tail.load(std::memory_order_relaxed);
+      if (tail - _head.load(std::memory_order_acquire) == N)
+        return false;
+
+      _items[tail & (N - 1)] = item;
+      _tail.store(tail + 1, std::memory_order_release);
+      return true;
+    }
+
+    /* consumer side, oldest item without removing it or nullptr when empty */
+    const T* peek() const
+    {
+      const uint32_t head = _head.load(std::memory_order_relaxed);
+      return head == _tail.load(std::memory_order_acquire) ? nullptr : &_items[head & (N - 1)];
+    }
+
+    /* consumer side, drops the item returned by peek() */
+    void pop()
+    {
+      _head.store(_head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    /* pending items, only exact when neither side is running */
+    size_t size() const { return _tail.load(std::memory_order_acquire) - _head.load(std::memory_order_acquire); }
+    const T& operator[](size_t i) const { return _items[(_head.load(std::memory_order_relaxed) + i) & (N - 1)]; }
+
+    /* empties the ring, neither side must be running */
+    void clear()
+    {
+      _head.store(0, std::memory_order_relaxed);
+      _tail.store(0, std::memory_order_relaxed);
+    }
+  };
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace retro8
+{
+  /* bounds checked cursor used to write machine snapshots, with a null buffer it only counts
+     the bytes so that the same code path computes the required size */
+  class StateWriter
+  {
+  private:
+    uint8_t* _data;
+    size_t _size;
+    size_t _position;
+    bool _overflow;
+
+  public:
+    StateWriter(void* data, size_t size) : _data(static_cast<uint8_t*>(data)), _size(size), _position(0), _overflow(false) { }
+    StateWriter() : StateWriter(nullptr, SIZE_MAX) { }
+
+    void write(const void* src, size_t length)
+    {
+      if (_overflow || length > _size - _position)
+      {
+        _overflow = true;
+        return;
+      }
+
+      if (_data)
+        std::memcpy(_data + _position, src, length);
+      _position += length;
+    }
+
+    template<typename T> void write(const T& value) { write(&value, sizeof(T)); }
+
+    size_t position() const { return _position; }
+    bool good() const { return !_overflow; }
+  };
+
+  class StateReader
+  {
+  private:
+    const uint8_t* _data;
+    size_t _size;
+    size_t _position;
+    bool _overflow;
+
+  public:
+    StateReader(const void* data, size_t size) : _data(static_cast<const uint8_t*>(data)), _size(size), _position(0), _overflow(false) { }
+
+    /* returns a pointer to the next length bytes, which are not aligned, or nullptr */
+    const uint8_t* fetch(size_t length)
+    {
+      if (_overflow || length > _size - _position)
+      {
+        _overflow = true;
+        return nullptr;
+      }
+
+      const uint8_t* data = _data + _position;
+      _position += length;
+      return data;
+    }
+
+    bool read(void* dest, size_t length)
+    {
+      const uint8_t* data = fetch(length);
+      if (data)
+        std::memcpy(dest, data, length);
+      return data != nullptr;
+    }
+
+    template<typename T> bool read(T& value) { return read(&value, sizeof(T)); }
+
+    size_t position() const { return _position; }
+    bool good() const { return !_overflow; }
+  };
+}
@@ -1,7 +1,11 @@
 #include "sound.h"
 
 #include "memory.h"
+#include "savestate.h"
+#include "wavetable.h"
 
+#include <algorithm>
+#include <cmath>
 #include <random>
 #include <cassert>
 
@@ -10,107 +14,27 @@
 using namespace retro8;
 using namespace retro8::sfx;
 
-inline void DSP::squareWave(uint32_t frequency, int16_t amplitude, int16_t offset, int32_t position, int16_t* dest, size_t samples)
+DSP::DSP(int32_t rate) : rate(rate)
 {
-  const size_t periodLength = float(rate) / frequency;
-  const size_t halfPeriod = periodLength / 2;
-
-  for (size_t i = 0; i < samples; ++i)
+  /* PICO-8 pitch 33 is A4, equal temperament from there */
+  for (size_t pitch = 0; pitch < increments.size(); ++pitch)
   {
-    const auto sampleInPeriod = position % periodLength;
-    dest[i] += offset + sampleInPeriod < halfPeriod ? -amplitude : amplitude;
-    ++position;
+    const double frequency = 440.0 * std::pow(2.0, (int32_t(pitch) - 33) / 12.0);
+    increments[pitch] = uint32_t(std::floor(frequency / rate * 4294967296.0 + 0.5));
   }
 }
 
-inline void DSP::pulseWave(uint32_t frequency, int16_t amplitude, int16_t offset, float dutyCycle, int32_t position, int16_t* dest, size_t samples)
+uint32_t DSP::wave(Waveform waveform, uint32_t phase, const Ramp& ramp, int16_t* dest, size_t samples)
 {
-  const size_t periodLength = float(rate) / frequency;
-  const size_t dutyOnLength = dutyCycle * periodLength;
-
-  for (size_t i = 0; i < samples; ++i)
-  {
-    const auto sampleInPeriod = position % periodLength;
-    dest[i] += offset + sampleInPeriod < dutyOnLength ? amplitude : -amplitude;
-    ++position;
-  }
-}
+  if (!wavetable::periodic(waveform))
+    return phase;
 
-inline void DSP::triangleWave(uint32_t frequency, int16_t amplitude, int16_t offset, int32_t position, int16_t* dest, size_t samples)
-{
-  const size_t periodLength = float(rate) / frequency;
-
-  for (size_t i = 0; i < samples; ++i)
-  {
-    const size_t repetitions = position / periodLength;
-    const float p = position / float(periodLength) - repetitions;
-
-    if (p < 0.50f)
-      dest[i] += offset + amplitude - amplitude * 2 * (p / 0.5f);
-    else
-      dest[i] += offset - amplitude + amplitude * 2 * ((p - 0.5f) / 0.5f);
-
-    ++position;
-  }
+  /* the highest pitch of the ramp decides which harmonics are safe */
+  const uint32_t increment = std::max(ramp.increment, ramp.incrementEnd);
+  return wavetable::render(wavetable::table(waveform, increment), phase, ramp, dest, samples);
 }
 
-inline void DSP::sawtoothWave(uint32_t frequency, int16_t amplitude, int16_t offset, int32_t position, int16_t* dest, size_t samples)
-{
-  const size_t periodLength = float(rate) / frequency;
-
-  for (size_t i = 0; i < samples; ++i)
-  {
-    const size_t repetitions = position / periodLength;
-    const float p = position / float(periodLength) - repetitions;
-    dest[i] += offset - amplitude + amplitude * 2 * p;
-    ++position;
-  }
-}
-
-inline void DSP::tiltedSawtoothWave(uint32_t frequency, int16_t amplitude, int16_t offset, float dutyCycle, int32_t position, int16_t* dest, size_t samples)
-{
-  const size_t periodLength = float(rate) / frequency;
-
-  for (size_t i = 0; i < samples; ++i)
-  {
-    const size_t repetitions = position / periodLength;
-    const float p = position / float(periodLength) - repetitions;
-
-    if (p < dutyCycle)
-      dest[i] += offset - amplitude + amplitude * 2 * (p / dutyCycle);
-    else
-    {
-      const float op = (p - dutyCycle) / (1.0f - dutyCycle);
-      dest[i] += offset + amplitude - amplitude * 2 * op;
-    }
-
-    ++position;
-  }
-}
-
-inline void DSP::organWave(uint32_t frequency, int16_t amplitude, int16_t offset, float coefficient, int32_t position, int16_t* dest, size_t samples)
-{
-  const size_t periodLength = float(rate) / frequency;
-
-  for (size_t i = 0; i < samples; ++i)
-  {
-    const size_t repetitions = position / periodLength;
-    const float p = position / float(periodLength) - repetitions;
-
-    if (p < 0.25f) // drop +a -a
-      dest[i] += offset + amplitude - amplitude * 2 * (p / 0.25f);
-    else if (p < 0.50f) // raise -a +c
-      dest[i] += offset - amplitude + amplitude * (1.0f + coefficient) * (p - 0.25) / 0.25;
-    else if (p < 0.75) // drop +c -a
-      dest[i] += offset + amplitude * coefficient - amplitude * (1.0f + coefficient) * (p - 0.50) / 0.25f;
-    else
-      dest[i] += offset - amplitude + amplitude * 2 * (p - 0.75f) / 0.25f;
-
-    ++position;
-  }
-}
-
-inline void DSP::noise(uint32_t frequency, int16_t amplitude, int32_t position, int16_t* dest, size_t samples)
+void DSP::noise(const Ramp& ramp, int16_t* dest, size_t samples)
 {
   static uint32_t lfsr_state = 0x12345678;
   static const uint8_t poly = 0x34; // second-smallest maximal-period polynomial.
@@ -121,7 +45,7 @@ inline void DSP::noise(uint32_t frequency, int16_t amplitude, int32_t position,
   static const int table_mask = table_size - 1;
   static uint8_t polytable[table_size];
 
-  if (!amplitude)
+  if (!ramp.amplitude && !ramp.amplitudeEnd)
     return;
 
   if (polytable[1] == 0) {
@@ -140,36 +64,20 @@ inline void DSP::noise(uint32_t frequency, int16_t amplitude, int32_t position,
     }
   }
 
+  const int32_t amplitudeStep = samples ? (ramp.amplitudeEnd - ramp.amplitude) / int32_t(samples) : 0;
+  int32_t amplitude = ramp.amplitude;
+
   for (size_t i = 0; i < samples; ++i)
   {
-    dest[i] += lfsr_state % amplitude - (amplitude / 2);
+    const uint32_t range = uint32_t(amplitude >> 16);
+    if (range)
+      dest[i] += int16_t(int32_t(lfsr_state % range) - int32_t(range / 2));
+    amplitude += amplitudeStep;
+
     lfsr_state = (lfsr_state >> batch) | (polytable[(lfsr_state >> significant_bits) & table_mask] << (32 - batch));
     lfsr_state = (lfsr_state >> batch) | (polytable[(lfsr_state >> significant_bits) & table_mask] << (32 - batch));
     lfsr_state = (lfsr_state >> batch) | (polytable[(lfsr_state >> significant_bits) & table_mask] << (32 - batch));
     lfsr_state = (lfsr_state >> batch) | (polytable[(lfsr_state >> significant_bits) & table_mask] << (32 - batch));
-    ++position;
-  }
-}
-
-void DSP::fadeIn(int16_t amplitude, int16_t* dest, size_t samples)
-{
-  const float incr = 1.0f / samples;
-
-  for (size_t i = 0; i < samples; ++i)
-  {
-    const float v = dest[i] / amplitude;
-    dest[i] = v * incr * i * amplitude;
-  }
-}
-
-void DSP::fadeOut(int16_t amplitude, int16_t* dest, size_t samples)
-{
-  const float incr = 1.0f / samples;
-
-  for (size_t i = 0; i < samples; ++i)
-  {
-    const float v = dest[i] / amplitude;
-    dest[i] = v * incr * (samples - i - 1) * amplitude;
   }
 }
 
@@ -177,9 +85,6 @@ void DSP::fadeOut(int16_t amplitude, int16_t* dest, size_t samples)
 
 constexpr std::array<float, 12> Note::frequencies;
 
-constexpr float PULSE_WAVE_DEFAULT_DUTY = 1 / 3.0f;
-constexpr float ORGAN_DEFAULT_COEFFICIENT = 0.5f;
-
 size_t position = 0;
 int16_t* rendered = nullptr;
 
@@ -192,111 +97,144 @@ void APU::init()
   for (auto& channel : channels) channel.sound = nullptr;
 }
 
+namespace
+{
+  /* keeps the note and the offset within it of a channel playing when the length of ticks changes */
+  void rescale(SoundState& channel, const DSP& from, const DSP& to)
+  {
+    if (channel.sound)
+    {
+      const uint64_t before = from.samplePerTick(channel.sound), after = to.samplePerTick(channel.sound);
+      channel.position = uint32_t(channel.position / before * after + channel.position % before * after / before);
+    }
+  }
+}
+
+void APU::setSampleRate(int32_t rate, int32_t outputRate)
+{
+  /* ticks are rate / 128 samples long */
+  assert(rate >= 128 && outputRate > 0);
+
+  if (rate == sampleRate() && outputRate == this->outputRate())
+    return;
+
+  if (rate != dsp.sampleRate())
+  {
+    const DSP previous = dsp;
+    dsp = DSP(rate);
+    mixer.setSampleRate(rate);
+
+    for (auto& channel : channels)
+      rescale(channel, previous, dsp);
+    for (auto& channel : mstate.channels)
+      rescale(channel, previous, dsp);
+
+    _time = uint32_t(uint64_t(_time) * rate / previous.sampleRate());
+    _renderTime = uint32_t(uint64_t(_renderTime) * rate / previous.sampleRate());
+  }
+
+  if (rate != outputRate)
+  {
+    _resampler.reset(new Resampler(rate, outputRate));
+    _resamplerInput.resize(2 * _resampler->maxNeeded(Mixer::BLOCK_SIZE));
+  }
+  else
+  {
+    _resampler.reset();
+    _resamplerInput.clear();
+  }
+}
+
 void APU::play(sound_index_t index, channel_index_t channel, uint32_t start, uint32_t end)
 {
-  queueMutex.lock();
-  queue.emplace_back(index, channel, start, end);
-  queueMutex.unlock();
+  Command command(index, channel, start, end);
+  command.time = _time;
+  queue.push(command);
 }
 
 void APU::music(music_index_t index, int32_t fadeMs, int32_t mask)
 {
-  queueMutex.lock();
-  queue.emplace_back(index, fadeMs, mask);
-  queueMutex.unlock();
+  Command command(index, fadeMs, mask);
+  command.time = _time;
+  queue.push(command);
 }
 
-void APU::handleCommands()
+void APU::handleCommand(Command& c)
 {
-  if (queueMutex.try_lock())
+  if (!c.isMusic)
   {
-    for (Command& c : queue)
-    {
-      if (!c.isMusic)
-      {
-        auto& s = c.sound;
+    auto& s = c.sound;
 
-        /* stop sound on channel*/
-        if (s.index == -1)
-        {
-          if (s.channel >= 0 && s.channel <= channels.size())
-            channels[s.channel].sound = nullptr;
-          continue;
-        }
-        /* stop sound from looping */
-        else if (s.index == -2)
-        {
-          continue;
-        }
-        /* stop sound on all channels that are playing it*/
-        else if (s.channel == -2)
+    /* stop sound on channel*/
+    if (s.index == -1)
+    {
+      if (s.channel >= 0 && s.channel <= channels.size())
+        channels[s.channel].sound = nullptr;
+      return;
+    }
+    /* stop sound from looping */
+    else if (s.index == -2)
+    {
+      return;
+    }
+    /* stop sound on all channels that are playing it*/
+    else if (s.channel == -2)
+    {
+      for (auto& chan : channels)
+        if (chan.soundIndex == s.index)
+          chan.sound = nullptr;
+      return;
+    }
+    /* find first available channel*/
+    else if (s.channel == -1)
+      for (size_t i = 0; i < channels.size(); ++i)
+        if (!channels[i].sound)
         {
-          for (auto& chan : channels)
-            if (chan.soundIndex == s.index)
-              chan.sound = nullptr;
-          continue;
+          s.channel = i;
+          break;
         }
-        /* find first available channel*/
-        else if (s.channel == -1)
-          for (size_t i = 0; i < channels.size(); ++i)
-            if (!channels[i].sound)
-            {
-              s.channel = i;
-              break;
-            }
 
 
-        if (s.channel >= 0 && s.channel < channels.size() && s.index >= 0 && s.index <= SOUND_COUNT)
-        {
-          /* overtaking channel */
-          auto& channel = channels[s.channel];
-
-          channel.soundIndex = s.index;
-          channel.sound = memory.sound(s.index);
-          channel.end = s.end;
-          channel.sample = s.start;
-
-#if !defined(SF2000)
-          size_t samplePerTick = (44100 / 128) * (channel.sound->speed + 1);
-#else
-          size_t samplePerTick = (11025 / 128) * (channel.sound->speed + 1);
-#endif
-          channel.position = s.start*samplePerTick;
-        }
-      }
-      else
-      {
-        const auto& m = c.music;
+    if (s.channel >= 0 && s.channel < channels.size() && s.index >= 0 && s.index <= SOUND_COUNT)
+    {
+      /* overtaking channel */
+      auto& channel = channels[s.channel];
 
-        if (m.index == -1)
-          mstate.music = nullptr;
-        else
+      channel.soundIndex = s.index;
+      channel.sound = memory.sound(s.index);
+      channel.end = s.end;
+      channel.sample = s.start;
+
+      const size_t samplePerTick = dsp.samplePerTick(channel.sound);
+      channel.position = s.start*samplePerTick;
+    }
+  }
+  else
+  {
+    const auto& m = c.music;
+
+    if (m.index == -1)
+      mstate.music = nullptr;
+    else
+    {
+      mstate.pattern = m.index;
+      mstate.music = memory.music(m.index);
+      mstate.channelMask = m.mask;
+
+      for (size_t i = 0; i < CHANNEL_COUNT; ++i)
+      {
+        if (mstate.music->isChannelEnabled(i))
         {
-          mstate.pattern = m.index;
-          mstate.music = memory.music(m.index);
-          mstate.channelMask = m.mask;
-
-          for (size_t i = 0; i < CHANNEL_COUNT; ++i)
-          {
-            if (mstate.music->isChannelEnabled(i))
-            {
-              mstate.channels[i].sound = memory.sound(mstate.music->sound(i));
-              mstate.channels[i].sample = 0;
-              mstate.channels[i].position = 0;
-              mstate.channels[i].end = 31; //TODO: fix according to behavior
-            }
-            else
-              mstate.channels[i].sound = nullptr;
-          }
+          mstate.channels[i].sound = memory.sound(mstate.music->sound(i));
+          mstate.channels[i].sample = 0;
+          mstate.channels[i].position = 0;
+          mstate.channels[i].end = 31; //TODO: fix according to behavior
         }
+        else
+          mstate.channels[i].sound = nullptr;
       }
     }
-
-    queue.clear();
-    queueMutex.unlock();
   }
-
-  /* stop sound on channel*/
 }
 
 void APU::updateMusic()
@@ -373,71 +311,217 @@ void APU::updateChannel(SoundState& channel, const Music* music)
   }
 }
 
-void APU::renderSound(const SoundState& channel, int16_t* buffer, size_t samples)
+namespace
+{
+  /* effects are linear over spans of at most this many samples */
+  constexpr size_t MAX_RAMP_LENGTH = 1024;
+  /* vibrato moves up to a quarter of semitone around the note at 7.5Hz, arpeggios step at multiples
+     of the same rate, values found by matching PICO-8 output */
+  constexpr float VIBRATO_RATE = 7.5f;
+  constexpr float VIBRATO_DEPTH = 1.0594631f - 1.0f;
+}
+
+size_t APU::effect(const SoundState& channel, uint32_t position, size_t samplePerTick, size_t samples, Ramp& ramp) const
 {
-  const SoundSample& sample = channel.sound->samples[channel.sample];
+  constexpr int32_t maxVolume = 4096;
+
+  const Sound& sound = *channel.sound;
+  const SoundSample& sample = sound.samples[channel.sample];
+  const float rate = float(dsp.sampleRate());
+
+  const size_t offset = position % samplePerTick;
+  size_t length = std::min(samples, MAX_RAMP_LENGTH);
+
+  float increment = float(dsp.increment(sample.pitch())), incrementEnd = increment;
+  float volume = float((maxVolume / 8) * sample.volume()), volumeEnd = volume;
 
-  constexpr int16_t maxVolume = 4096;
-  const int16_t volume = (maxVolume / 8) * sample.volume();
-  const frequency_t frequency = Note::frequency(sample.pitch());
+  /* fractions of the note elapsed at both ends of the span */
+  const float t = offset / float(samplePerTick), tEnd = (offset + length) / float(samplePerTick);
 
-  /* render samples */
-  switch (sample.waveform())
+  switch (sample.effect())
   {
-  case Waveform::SQUARE:
-    dsp.squareWave(frequency, volume, 0, channel.position, buffer, samples);
+  case Effect::NONE:
     break;
-  case Waveform::TILTED_SAW:
-    dsp.tiltedSawtoothWave(frequency, volume, 0, 0.85f, channel.position, buffer, samples);
+  /* slides from the previous note pitch, and volume if it was audible */
+  case Effect::SLIDE:
+  {
+    const SoundSample& previous = sound.samples[channel.sample ? channel.sample - 1 : 0];
+    const float from = float(dsp.increment(previous.pitch()));
+    const float fromVolume = float((maxVolume / 8) * previous.volume());
+
+    increment = from + (incrementEnd - from) * t;
+    incrementEnd = from + (incrementEnd - from) * tEnd;
+
+    if (previous.volume() > 0)
+    {
+      volume = fromVolume + (volumeEnd - fromVolume) * t;
+      volumeEnd = fromVolume + (volumeEnd - fromVolume) * tEnd;
+    }
     break;
-  case Waveform::SAW:
-    dsp.sawtoothWave(frequency, volume, 0, channel.position, buffer, samples);
+  }
+  /* triangle LFO, the span stops at its next corner so that it stays linear */
+  case Effect::VIBRATO:
+  {
+    const float half = rate / (2 * VIBRATO_RATE);
+    const float corner = (std::floor(position / half) + 1) * half;
+    length = std::min(length, std::max(size_t(1), size_t(std::ceil(corner - position))));
+
+    auto lfo = [rate](float p) {
+      const float cycle = VIBRATO_RATE * p / rate;
+      return std::fabs(cycle - std::floor(cycle) - 0.5f) - 0.25f;
+    };
+
+    increment *= 1.0f + VIBRATO_DEPTH * lfo(float(position));
+    incrementEnd *= 1.0f + VIBRATO_DEPTH * lfo(float(position + length));
     break;
-  case Waveform::TRIANGLE:
-    dsp.triangleWave(frequency, volume, 0, channel.position, buffer, samples);
+  }
+  case Effect::DROP:
+    increment *= 1.0f - t;
+    incrementEnd *= 1.0f - tEnd;
     break;
-  case Waveform::PULSE:
-    dsp.pulseWave(frequency, volume, 0, 1 / 3.0f, channel.position, buffer, samples);
+  case Effect::FADE_IN:
+    volume *= t;
+    volumeEnd *= tEnd;
     break;
-  case Waveform::ORGAN:
-    dsp.organWave(frequency, volume, 0, 0.5f, channel.position, buffer, samples);
+  case Effect::FADE_OUT:
+    volume *= 1.0f - t;
+    volumeEnd *= 1.0f - tEnd;
     break;
-  case Waveform::NOISE:
-    dsp.noise(frequency, volume, channel.position, buffer, samples);
+  /* cycles over the group of 4 notes the current one belongs to, twice as slow for speeds up to 8 */
+  case Effect::ARPEGGIO_FAST:
+  case Effect::ARPEGGIO_SLOW:
+  {
+    const int32_t notesPerCycle = (sound.speed <= 8 ? 32 : 16) / (sample.effect() == Effect::ARPEGGIO_FAST ? 4 : 8);
+    const float step = rate / (notesPerCycle * VIBRATO_RATE);
+    const uint32_t index = uint32_t(position / step);
+    const float next = (index + 1) * step;
+    length = std::min(length, std::max(size_t(1), size_t(std::ceil(next - position))));
+
+    increment = incrementEnd = float(dsp.increment(sound.samples[(channel.sample & ~3u) | (index & 3)].pitch()));
     break;
   }
+  }
+
+  ramp.increment = uint32_t(increment);
+  ramp.incrementEnd = uint32_t(incrementEnd);
+  ramp.amplitude = int32_t(volume * 65536.0f);
+  ramp.amplitudeEnd = int32_t(volumeEnd * 65536.0f);
+
+  return length;
 }
 
-void APU::renderSounds(int16_t* dest, size_t totalSamples)
+void APU::renderSound(SoundState& channel, size_t samplePerTick, int16_t* buffer, size_t samples)
 {
-  handleCommands();
+  const Waveform waveform = channel.sound->samples[channel.sample].waveform();
+  uint32_t position = channel.position;
+
+  while (samples > 0)
+  {
+    Ramp ramp;
+    const size_t length = effect(channel, position, samplePerTick, samples, ramp);
+
+    if (waveform == Waveform::NOISE)
+      dsp.noise(ramp, buffer, length);
+    else
+      channel.phase = dsp.wave(waveform, channel.phase, ramp, buffer, length);
+
+    buffer += length;
+    samples -= length;
+    position += length;
+  }
+}
 
-  memset(dest, 0, sizeof(int16_t)*totalSamples);
+void APU::renderFrames(int16_t* dest, size_t samples)
+{
+  /* commands further than this from the rendered time mean clocks went apart, the rendered time
+     is moved so that the command is applied right away */
+  const int32_t maxSkew = dsp.sampleRate() / 10;
 
-  for (size_t i = 0; i < CHANNEL_COUNT; ++i)
+  size_t done = 0;
+  while (done < samples)
   {
-    int16_t* buffer = dest;
-    size_t samples = totalSamples;
-
-    SoundState& channel = channels[i].sound ? channels[i] : mstate.channels[i];
-    const Music* music = &channel == &this->mstate.channels[i] ? this->mstate.music : nullptr; //TODO: crappy comparison
-  
-    /* render only if enabled */
-    if ((music && _musicEnabled) || (!music && _soundEnabled))
+    size_t next = samples;
+
+    while (const Command* pending = queue.peek())
     {
-      if (channel.sound)
+      int32_t delay = int32_t(pending->time - (_renderTime + uint32_t(done)));
+
+      if (delay > maxSkew || delay < -maxSkew)
       {
-#if !defined(SF2000)
-        const size_t samplePerTick = (44100 / 128) * (channel.sound->speed + 1);
-#else
-        const size_t samplePerTick = (11025 / 128) * (channel.sound->speed + 1);
-#endif
+        _renderTime = pending->time - uint32_t(done);
+        delay = 0;
+      }
+
+      /* later commands wait for their sample, late ones apply at once */
+      if (delay > 0)
+      {
+        next = std::min(samples, done + size_t(delay));
+        break;
+      }
+
+      Command command = *pending;
+      queue.pop();
+      handleCommand(command);
+    }
+
+    renderChannels(dest + 2 * done, next - done);
+    done = next;
+  }
+
+  _renderTime += uint32_t(samples);
+}
+
+void APU::renderSounds(int16_t* dest, size_t samples)
+{
+  if (!_resampler)
+  {
+    renderFrames(dest, samples);
+    return;
+  }
+
+  /* output is produced in pieces so that the frames rendered for each fit the preallocated input */
+  while (samples > 0)
+  {
+    const size_t frames = std::min(samples, size_t(Mixer::BLOCK_SIZE));
+    const size_t needed = _resampler->needed(frames);
+
+    renderFrames(_resamplerInput.data(), needed);
+    _resampler->push(_resamplerInput.data(), needed);
+    _resampler->pull(dest, frames);
+
+    dest += 2 * frames;
+    samples -= frames;
+  }
+}
+
+void APU::renderChannels(int16_t* dest, size_t totalSamples)
+{
+  while (totalSamples > 0)
+  {
+    const size_t block = std::min(totalSamples, size_t(Mixer::BLOCK_SIZE));
+    const int16_t* sources[CHANNEL_COUNT] = { nullptr };
+
+    for (size_t i = 0; i < CHANNEL_COUNT; ++i)
+    {
+      int16_t* buffer = _channelBuffers[i].data();
+      size_t samples = block;
+
+      SoundState& channel = channels[i].sound ? channels[i] : mstate.channels[i];
+      const Music* music = &channel == &this->mstate.channels[i] ? this->mstate.music : nullptr; //TODO: crappy comparison
+
+      /* render only if enabled */
+      if (channel.sound && ((music && _musicEnabled) || (!music && _soundEnabled)))
+      {
+        memset(buffer, 0, sizeof(int16_t) * block);
+        sources[i] = buffer;
+
+        const size_t samplePerTick = dsp.samplePerTick(channel.sound);
         while (samples > 0 && channel.sound)
         {
           /* generate the maximum amount of samples available for same note */
           // TODO: optimize if next note is equal to current
           size_t available = std::min<ssize_t>(samples, samplePerTick - (channel.position % samplePerTick));
-          renderSound(channel, buffer, available);
+          renderSound(channel, samplePerTick, buffer, available);
 
           samples -= available;
           buffer += available;
@@ -448,7 +532,139 @@ void APU::renderSounds(int16_t* dest, size_t totalSamples)
         }
       }
     }
+
+    mixer.mix(sources, dest, block);
+
+    dest += 2 * block;
+    totalSamples -= block;
+  }
+}
+
+namespace
+{
+  /* sound and music pointers refer to machine memory so they're stored as offsets from its base */
+  int32_t offsetOf(Memory& memory, const void* ptr)
+  {
+    return ptr ? int32_t(static_cast<const uint8_t*>(ptr) - memory.base()) : -1;
+  }
+
+  template<typename T>
+  bool pointerAt(Memory& memory, int32_t offset, const T*& ptr)
+  {
+    if (offset < 0)
+      ptr = nullptr;
+    else if (size_t(offset) + sizeof(T) <= 1024 * 32)
+      ptr = reinterpret_cast<const T*>(memory.base() + offset);
+    else
+      return false;
+
+    return true;
+  }
+
+  void saveChannel(StateWriter& writer, Memory& memory, const SoundState& state)
+  {
+    writer.write(offsetOf(memory, state.sound));
+    writer.write(state.soundIndex);
+    writer.write(state.sample);
+    writer.write(state.position);
+    writer.write(state.end);
+    writer.write(state.phase);
+  }
+
+  bool loadChannel(StateReader& reader, Memory& memory, SoundState& state)
+  {
+    int32_t offset = -1;
+    return reader.read(offset) && pointerAt(memory, offset, state.sound) &&
+      reader.read(state.soundIndex) && reader.read(state.sample) && reader.read(state.position) && reader.read(state.end) &&
+      reader.read(state.phase);
+  }
+}
+
+void APU::saveState(StateWriter& writer)
+{
+  for (const auto& channel : channels)
+    saveChannel(writer, memory, channel);
+
+  for (const auto& channel : mstate.channels)
+    saveChannel(writer, memory, channel);
+  writer.write(offsetOf(memory, mstate.music));
+  writer.write(mstate.pattern);
+  writer.write(mstate.channelMask);
+
+  /* commands not yet consumed by audio rendering */
+  writer.write(uint32_t(queue.size()));
+  for (size_t i = 0; i < queue.size(); ++i)
+    writer.write(&queue[i], sizeof(Command));
+  writer.write(_renderTime);
+  writer.write(dsp.sampleRate());
+}
+
+bool APU::checkState(StateReader& reader) const
+{
+  /* everything is read into scratch states so that the same validation applies */
+  SoundState channel;
+  MusicState music;
+  bool valid = true;
+
+  for (size_t i = 0; i < channels.size() + music.channels.size(); ++i)
+    valid = valid && loadChannel(reader, memory, channel);
+
+  int32_t offset = -1;
+  valid = valid && reader.read(offset) && pointerAt(memory, offset, music.music);
+  valid = valid && reader.read(music.pattern) && reader.read(music.channelMask);
+
+  uint32_t count = 0, time = 0;
+  int32_t rate = 0;
+  valid = valid && reader.read(count) && count <= COMMAND_CAPACITY && reader.fetch(count * sizeof(Command));
+  return valid && reader.read(time) && reader.read(rate) && rate > 0;
+}
+
+bool APU::loadState(StateReader& reader)
+{
+  bool valid = true;
+
+  for (auto& channel : channels)
+    valid = valid && loadChannel(reader, memory, channel);
+
+  for (auto& channel : mstate.channels)
+    valid = valid && loadChannel(reader, memory, channel);
+
+  int32_t music = -1;
+  valid = valid && reader.read(music) && pointerAt(memory, music, mstate.music);
+  valid = valid && reader.read(mstate.pattern) && reader.read(mstate.channelMask);
+
+  uint32_t count = 0;
+  valid = valid && reader.read(count) && count <= COMMAND_CAPACITY;
+  const uint8_t* commands = valid ? reader.fetch(count * sizeof(Command)) : nullptr;
+
+  queue.clear();
+  if (commands)
+  {
+    for (uint32_t i = 0; i < count; ++i)
+    {
+      Command command;
+      std::memcpy(&command, commands + i * sizeof(Command), sizeof(Command));
+      queue.push(command);
+    }
   }
+  else
+    valid = false;
+
+  int32_t rate = 0;
+  valid = valid && reader.read(_renderTime) && reader.read(rate) && rate > 0;
+
+  /* positions were saved in samples of the rate rendering used back then */
+  if (valid && rate != dsp.sampleRate())
+  {
+    const DSP saved(rate);
+    for (auto& channel : channels)
+      rescale(channel, saved, dsp);
+    for (auto& channel : mstate.channels)
+      rescale(channel, saved, dsp);
+    _renderTime = uint32_t(uint64_t(_renderTime) * dsp.sampleRate() / rate);
+  }
+
+  return valid;
 }
 
 #endif
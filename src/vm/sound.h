@@ -3,20 +3,21 @@
 #include "defines.h"
 #include "common.h"
 
+#include "mixer.h"
+#include "resampler.h"
+#include "ring.h"
+
 #include <array>
+#include <memory>
 #include <vector>
-#ifdef __LIBRETRO__
-#include "slock_wrapper.h"
-#endif
-#ifndef USE_SLOCK_WRAPPER
-#include <mutex>
-#endif
 
 #if SOUND_ENABLED
 
 namespace retro8
 {
   class Memory;
+  class StateWriter;
+  class StateReader;
   
   namespace sfx
   {
@@ -26,6 +27,13 @@ namespace retro8
     using channel_index_t = int32_t;
     using sound_index_t = int32_t;
     using music_index_t = int32_t;
+
+    /* rate the APU renders at unless told otherwise */
+#if !defined(SF2000)
+    constexpr int32_t DEFAULT_SAMPLE_RATE = 44100;
+#else
+    constexpr int32_t DEFAULT_SAMPLE_RATE = 11025;
+#endif
     
     enum class Waveform
     {
@@ -137,8 +145,9 @@ namespace retro8
       uint32_t sample;
       uint32_t position; // absolute
       uint32_t end;
+      uint32_t phase; // oscillator, fraction of period in 0.32
 
-      SoundState(): sound(nullptr), soundIndex(0), sample(0), position(0), end(0) {}
+      SoundState(): sound(nullptr), soundIndex(0), sample(0), position(0), end(0), phase(0) {}
     };
 
     struct MusicState
@@ -151,24 +160,31 @@ namespace retro8
       MusicState() : music(nullptr), pattern(0), channelMask(0) {}
     };
     
+    /* oscillator parameters at the start and at the end of a span of samples, they move linearly in
+       between. Increments are 0.32 fractions of a period per sample, amplitudes are 16.16 */
+    struct Ramp
+    {
+      uint32_t increment, incrementEnd;
+      int32_t amplitude, amplitudeEnd;
+    };
+
     class DSP
     {
     private:
       int32_t rate;
+      /* oscillator phase increment for each pitch at rate */
+      std::array<uint32_t, 64> increments;
 
     public:
-      DSP(int32_t rate) : rate(rate) { }
-      void squareWave(uint32_t frequency, int16_t amplitude, int16_t offset, int32_t position, int16_t* dest, size_t samples);
-      void pulseWave(uint32_t frequency, int16_t amplitude, int16_t offset, float dutyCycle, int32_t position, int16_t* dest, size_t samples);
-      void triangleWave(uint32_t frequency, int16_t amplitude, int16_t offset, int32_t position, int16_t* dest, size_t samples);
-      void sawtoothWave(uint32_t frequency, int16_t amplitude, int16_t offset, int32_t position, int16_t* dest, size_t samples);
-      void tiltedSawtoothWave(uint32_t frequency, int16_t amplitude, int16_t offset, float dutyCycle, int32_t position, int16_t* dest, size_t samples);
-      void organWave(uint32_t frequency, int16_t amplitude, int16_t offset, float coefficient, int32_t position, int16_t* dest, size_t samples);
-      void noise(uint32_t frequency, int16_t amplitude, int32_t position, int16_t* dest, size_t samples);
-
-      void fadeIn(int16_t amplitude, int16_t* dest, size_t samples);
-      void fadeOut(int16_t amplitude, int16_t* dest, size_t samples);
+      DSP(int32_t rate);
+
+      int32_t sampleRate() const { return rate; }
+      uint32_t increment(pitch_t pitch) const { return increments[pitch & 63]; }
+      size_t samplePerTick(const Sound* sound) const { return size_t(rate / 128) * (sound->speed + 1); }
 
+      /* band limited periodic waveforms, returns the phase after the samples */
+      uint32_t wave(Waveform waveform, uint32_t phase, const Ramp& ramp, int16_t* dest, size_t samples);
+      void noise(const Ramp& ramp, int16_t* dest, size_t samples);
     };
 
 
@@ -176,6 +192,7 @@ namespace retro8
     {
     public:
       static constexpr size_t CHANNEL_COUNT = 4;
+      static_assert(CHANNEL_COUNT == Mixer::CHANNEL_COUNT, "mixer must have a gain for each channel");
 
     private:
       retro8::Memory& memory;
@@ -184,6 +201,8 @@ namespace retro8
       struct Command
       {
         bool isMusic;
+        /* sample of the machine clock the command was issued at */
+        uint32_t time;
 
         union
         {
@@ -203,44 +222,76 @@ namespace retro8
           } music;
         };
 
-        Command(sound_index_t index, channel_index_t channel, uint32_t start, uint32_t end) : isMusic(false), sound({ index, channel, start, end }) { }
-        Command(music_index_t index, int32_t fadeMs, int32_t mask) : isMusic(true), music({ index, fadeMs, mask }) { }
+        Command() : Command(sound_index_t(0), channel_index_t(0), 0, 0) { }
+        Command(sound_index_t index, channel_index_t channel, uint32_t start, uint32_t end) : isMusic(false), time(0), sound({ index, channel, start, end }) { }
+        Command(music_index_t index, int32_t fadeMs, int32_t mask) : isMusic(true), time(0), music({ index, fadeMs, mask }) { }
       };
 
+      /* commands are issued by the game thread and consumed by audio rendering, which may run on
+         another thread. Each one is applied at the sample its time maps to in the rendered block */
+      static constexpr size_t COMMAND_CAPACITY = 64;
+
       std::array<SoundState, CHANNEL_COUNT> channels;
       MusicState mstate;
 
-#ifdef USE_SLOCK_WRAPPER
-      slock_wrap queueMutex;
-#else
-      std::mutex queueMutex;
-#endif
-      std::vector<Command> queue;
+      Ring<Command, COMMAND_CAPACITY> queue;
+
+      /* machine clock in samples on the game side, and machine clock time of the next sample to render
+         on the audio side, which follows the first one when they drift apart */
+      uint32_t _time, _renderTime;
+
+      Mixer mixer;
+      /* each channel is rendered on its own before mixing */
+      std::array<std::array<int16_t, Mixer::BLOCK_SIZE>, CHANNEL_COUNT> _channelBuffers;
+
+      /* converts to the output rate when it differs from the one channels are rendered at */
+      std::unique_ptr<Resampler> _resampler;
+      std::vector<int16_t> _resamplerInput;
 
       bool _soundEnabled, _musicEnabled;
 
-      void handleCommands();
+      void handleCommand(Command& command);
+      void renderFrames(int16_t* dest, size_t samples);
+      void renderChannels(int16_t* dest, size_t samples);
 
       void updateMusic();
-      void renderSound(const SoundState& sound, int16_t* buffer, size_t samples);
+      /* effect of the current note of a channel as a ramp starting at position, returns how many of the
+         samples it covers, spans end where an effect isn't linear anymore */
+      size_t effect(const SoundState& channel, uint32_t position, size_t samplePerTick, size_t samples, Ramp& ramp) const;
+      void renderSound(SoundState& sound, size_t samplePerTick, int16_t* buffer, size_t samples);
       void updateChannel(SoundState& channel, const Music* music);
 
       
 
     public:
-#if !defined(SF2000)
-      APU(Memory& memory) : memory(memory), dsp(44100), _soundEnabled(true), _musicEnabled(true) { }
-#else
-      APU(Memory& memory) : memory(memory), dsp(11025), _soundEnabled(true), _musicEnabled(true) { }
-#endif
+      APU(Memory& memory, int32_t rate = DEFAULT_SAMPLE_RATE) : memory(memory), dsp(rate), _time(0), _renderTime(0), mixer(rate), _soundEnabled(true), _musicEnabled(true) { }
 
       void init();
 
+      /* game thread, time of the commands issued from now on */
+      void setClock(uint32_t clock, uint32_t clockRate) { _time = uint32_t(uint64_t(clock) * dsp.sampleRate() / clockRate); }
+
       void play(sound_index_t index, channel_index_t channel, uint32_t start, uint32_t end);
       void music(music_index_t index, int32_t fadeMs, int32_t mask);
 
+      /* channels are rendered at rate and resampled to outputRate, which is the rate of renderSounds. Audio
+         must not be rendering while this is called */
+      void setSampleRate(int32_t rate, int32_t outputRate);
+      int32_t sampleRate() const { return dsp.sampleRate(); }
+      int32_t outputRate() const { return _resampler ? _resampler->outputRate() : dsp.sampleRate(); }
+
+      /* dest receives samples interleaved stereo frames at the output rate */
       void renderSounds(int16_t* dest, size_t samples);
 
+      /* gains are linear, 1.0 by default, and apply to music and sfx playing on a channel */
+      void setGain(channel_index_t channel, float left, float right) { mixer.setGain(channel, left, right); }
+      void setMasterGain(float gain) { mixer.setMasterGain(gain); }
+
+      void saveState(StateWriter& writer);
+      /* consumes the same bytes as loadState without changing anything, false if loadState would fail */
+      bool checkState(StateReader& reader) const;
+      bool loadState(StateReader& reader);
+
       bool isMusicEnabled() const { return _musicEnabled; }
       bool isSoundEnabled() const { return _soundEnabled; }
 
@@ -0,0 +1,160 @@
+#include "wavetable.h"
+
+#if SOUND_ENABLED
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <vector>
+
+using namespace retro8;
+using namespace retro8::sfx;
+
+namespace
+{
+  constexpr size_t PERIODIC_COUNT = size_t(Waveform::ORGAN) + 1;
+  constexpr int LEVELS = wavetable::LEVELS;
+  constexpr int MAX_HARMONICS = 1 << (LEVELS - 1);
+
+  constexpr int FRACTION_BITS = 32 - wavetable::TABLE_BITS;
+  constexpr int LERP_BITS = 15;
+
+  /* waveforms are drawn as straight segments over a period in [0, 1] with values in [-1, 1] */
+  struct Segment
+  {
+    double start, end;
+    double from, to;
+  };
+
+  struct Shape
+  {
+    Segment segments[4];
+    size_t count;
+  };
+
+  /* same shapes the naive oscillators drew: tilted saw turns at 0.85, pulse has a 1/3 duty cycle and
+     the organ second hump peaks at half the amplitude */
+  const Shape SHAPES[PERIODIC_COUNT] = {
+    { { { 0.0, 0.5, 1.0, -1.0 }, { 0.5, 1.0, -1.0, 1.0 } }, 2 },
+    { { { 0.0, 0.85, -1.0, 1.0 }, { 0.85, 1.0, 1.0, -1.0 } }, 2 },
+    { { { 0.0, 1.0, -1.0, 1.0 } }, 1 },
+    { { { 0.0, 0.5, -1.0, -1.0 }, { 0.5, 1.0, 1.0, 1.0 } }, 2 },
+    { { { 0.0, 1 / 3.0, 1.0, 1.0 }, { 1 / 3.0, 1.0, -1.0, -1.0 } }, 2 },
+    { { { 0.0, 0.25, 1.0, -1.0 }, { 0.25, 0.5, -1.0, 0.5 }, { 0.5, 0.75, 0.5, -1.0 }, { 0.75, 1.0, -1.0, 1.0 } }, 4 },
+  };
+
+  /* integral of the shape times e^(-i w t) over a period, with w = 2 pi harmonic. A segment a + b t has
+     e^(-i w t) (b / w^2 + i (a + b t) / w) as primitive */
+  std::complex<double> coefficient(const Shape& shape, int harmonic)
+  {
+    const double PI = 3.14159265358979323846, w = 2 * PI * harmonic;
+    std::complex<double> sum = 0.0;
+
+    for (size_t i = 0; i < shape.count; ++i)
+    {
+      const Segment& s = shape.segments[i];
+      const double b = (s.to - s.from) / (s.end - s.start), a = s.from - b * s.start;
+
+      auto primitive = [a, b, w](double t) { return std::polar(1.0, -w * t) * std::complex<double>(b / (w * w), (a + b * t) / w); };
+      sum += primitive(s.end) - primitive(s.start);
+    }
+
+    return sum;
+  }
+
+  struct Tables
+  {
+    int16_t levels[PERIODIC_COUNT][LEVELS][wavetable::TABLE_LENGTH + 1];
+
+    Tables()
+    {
+      const double PI = 3.14159265358979323846;
+      const size_t N = wavetable::TABLE_LENGTH;
+
+      std::vector<double> sine(N), cosine(N), sum(N);
+      for (size_t i = 0; i < N; ++i)
+      {
+        sine[i] = std::sin(2 * PI * i / N);
+        cosine[i] = std::cos(2 * PI * i / N);
+      }
+
+      for (size_t w = 0; w < PERIODIC_COUNT; ++w)
+      {
+        const Shape& shape = SHAPES[w];
+
+        double mean = 0.0;
+        for (size_t i = 0; i < shape.count; ++i)
+          mean += (shape.segments[i].from + shape.segments[i].to) / 2 * (shape.segments[i].end - shape.segments[i].start);
+        std::fill(sum.begin(), sum.end(), mean);
+
+        /* harmonics are added one at a time and each level is taken when its count is reached */
+        int level = LEVELS - 1;
+        for (int h = 1; h <= MAX_HARMONICS; ++h)
+        {
+          const std::complex<double> c = coefficient(shape, h) * 2.0;
+          for (size_t i = 0; i < N; ++i)
+          {
+            const size_t k = (i * h) & (N - 1);
+            sum[i] += c.real() * cosine[k] - c.imag() * sine[k];
+          }
+
+          if (h == MAX_HARMONICS >> level)
+          {
+            int16_t* table = levels[w][level];
+            for (size_t i = 0; i < N; ++i)
+              table[i] = int16_t(std::max(-32768.0, std::min(32767.0, std::floor(sum[i] * (1 << wavetable::SAMPLE_BITS) + 0.5))));
+            table[N] = table[0];
+            --level;
+          }
+        }
+      }
+    }
+  };
+
+  const Tables tables;
+}
+
+bool wavetable::periodic(Waveform waveform)
+{
+  return size_t(waveform) < PERIODIC_COUNT;
+}
+
+const int16_t* wavetable::table(Waveform waveform, uint32_t increment)
+{
+  /* harmonic h of a level is below Nyquist when h * increment < 2^31 */
+  int level = 0;
+  while (level < LEVELS - 1 && uint64_t(MAX_HARMONICS >> level) * increment >= (uint64_t(1) << 31))
+    ++level;
+
+  return tables.levels[size_t(waveform)][level];
+}
+
+uint32_t wavetable::render(const int16_t* table, uint32_t phase, const Ramp& ramp, int16_t* dest, size_t samples)
+{
+  if (!samples)
+    return phase;
+
+  const int32_t incrementStep = int32_t((int64_t(ramp.incrementEnd) - ramp.increment) / int64_t(samples));
+  const int32_t amplitudeStep = (ramp.amplitudeEnd - ramp.amplitude) / int32_t(samples);
+
+  uint32_t increment = ramp.increment;
+  int32_t amplitude = ramp.amplitude;
+
+  for (size_t i = 0; i < samples; ++i)
+  {
+    const uint32_t index = phase >> FRACTION_BITS;
+    const int32_t fraction = int32_t((phase >> (FRACTION_BITS - LERP_BITS)) & ((1 << LERP_BITS) - 1));
+
+    const int32_t a = table[index], b = table[index + 1];
+    const int32_t value = a + (((b - a) * fraction) >> LERP_BITS);
+
+    dest[i] += int16_t((int64_t(value) * amplitude) >> (SAMPLE_BITS + 16));
+    phase += increment;
+    increment += incrementStep;
+    amplitude += amplitudeStep;
+  }
+
+  return phase;
+}
+
+#endif
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "sound.h"
+
+#include <cstddef>
+#include <cstdint>
+
+#if SOUND_ENABLED
+
+namespace retro8
+{
+  namespace sfx
+  {
+    /* band limited single cycle tables of the periodic PICO-8 waveforms, built once from their Fourier
+       series. Each waveform has a level per octave of harmonics, from 256 down to the fundamental only,
+       so that the level picked for a pitch has nothing above the Nyquist frequency of the output */
+    namespace wavetable
+    {
+      constexpr int TABLE_BITS = 10;
+      constexpr size_t TABLE_LENGTH = 1 << TABLE_BITS;
+      constexpr int LEVELS = 9;
+
+      /* entries are 2.14, band limited edges overshoot a bit so there's room above 1.0 */
+      constexpr int SAMPLE_BITS = 14;
+
+      /* true for the waveforms that have tables, noise and phaser don't */
+      bool periodic(Waveform waveform);
+
+      /* TABLE_LENGTH + 1 entries, the last one repeats the first so that interpolation needs no wrap */
+      const int16_t* table(Waveform waveform, uint32_t increment);
+
+      /* adds samples of a table scaled by the ramp amplitude to dest, phase is a 0.32 fraction of the
+         period which advances by the ramp increment for each sample. Returns the phase after the last sample */
+      uint32_t render(const int16_t* table, uint32_t phase, const Ramp& ramp, int16_t* dest, size_t samples);
+    }
+  }
+}
+
+#endif